@@ -0,0 +1,120 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Measures the startup cost of loading bot configurations. "files" replays
+// the former loader (one file at a time: ifstream -> stringstream -> string
+// -> Document::Parse), "dir/N" and "ndjson/N" use the config_loader on a
+// directory of files and on one newline-delimited file with N parser
+// threads. The package has to be available in the package directory.
+// Usage:
+//
+//   config_load [configs] [package dir] [package] [threads]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "boost/filesystem.hpp"
+#include "boost/iostreams/copy.hpp"
+
+#include "../src/bot.h"
+#include "../src/config_loader.h"
+#include "../src/mem_bot_config.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::string make_config(int i, const std::string& package) {
+  std::string modules;
+  for (int m = 0; m < 12; ++m) {
+    modules += "\"module" + std::to_string(m) + "\": {\"active\": \"0\"";
+    for (int s = 0; s < 16; ++s) {
+      modules += ", \"setting" + std::to_string(s) + "\": \"some value\"";
+    }
+    modules += "}, ";
+  }
+  return "{\"username\": \"user" + std::to_string(i) + "\", "
+         "\"password\": \"password\", \"package\": \"" + package + "\", "
+         "\"server\": \"http://test.example.com\", \"modules\": {" + modules +
+         "\"base\": {\"wait_time_factor\": \"1.00\", \"proxy\": \"\"}}}";
+}
+
+void measure(const std::string& name, int configs,
+             const std::function<std::size_t ()>& load) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t loaded = load();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << std::setw(10) << name
+            << std::setw(10) << loaded
+            << std::setw(12) << std::setprecision(3) << elapsed.count()
+            << std::setw(14) << static_cast<long>(configs / elapsed.count())
+            << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int configs = argc > 1 ? std::atoi(argv[1]) : 100000;
+  std::string package_dir = argc > 2 ? argv[2] : "test/packages";
+  std::string package = argc > 3 ? argv[3] : "te";
+  int threads = argc > 4 ? std::atoi(argv[4]) : 0;
+
+  botscript::bot::load_packages(package_dir);
+
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  fs::create_directories(dir / "configs");
+  std::string ndjson_path = (dir / "configs.ndjson").string();
+  {
+    std::ofstream ndjson(ndjson_path.c_str());
+    for (int i = 0; i < configs; ++i) {
+      std::string config = make_config(i, package);
+      ndjson << config << "\n";
+      std::ofstream((dir / "configs" / std::to_string(i)).string().c_str())
+          << config;
+    }
+  }
+
+  auto on_error = [](const std::string& source, const std::string& error) {
+    std::cerr << source << ": " << error << "\n";
+  };
+
+  std::cout << std::setw(10) << "loader" << std::setw(10) << "configs"
+            << std::setw(12) << "seconds" << std::setw(14) << "configs/s"
+            << "\n";
+
+  measure("files", configs, [&dir]() {
+    std::size_t loaded = 0;
+    fs::directory_iterator end;
+    for (fs::directory_iterator i(dir / "configs"); i != end; ++i) {
+      std::ifstream file(i->path().string().c_str(), std::ios::in);
+      std::stringstream content;
+      boost::iostreams::copy(file, content);
+      botscript::mem_bot_config c(content.str());
+      loaded += c.identifier().empty() ? 0 : 1;
+    }
+    return loaded;
+  });
+
+  for (int t : { 1, threads }) {
+    std::string suffix = "/" + (t == 0 ? std::string("all") : std::to_string(t));
+    measure("dir" + suffix, configs, [&dir, t, &on_error]() {
+      return botscript::config_loader::load_directory(
+          (dir / "configs").string(), t, on_error).size();
+    });
+    measure("ndjson" + suffix, configs, [&ndjson_path, t, &on_error]() {
+      return botscript::config_loader::load_ndjson(
+          ndjson_path, t, on_error).size();
+    });
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Compares the update throughput of persisting configurations by rewriting
+// the whole JSON document after every change ("json") with the append-only
+// log_bot_config at different fsync batch sizes ("log/N" flushes every N
+// updates, "log/0" only at the end). Usage:
+//
+//   config_persistence [updates] [modules] [settings per module]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "../src/log_bot_config.h"
+#include "../src/mem_bot_config.h"
+
+using botscript::string_map;
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::map<std::string, string_map> build_settings(int modules, int settings) {
+  std::map<std::string, string_map> result;
+  result["base"]["wait_time_factor"] = "1.00";
+  result["base"]["proxy"] = "";
+  for (int m = 0; m < modules; ++m) {
+    string_map& module = result["module" + std::to_string(m)];
+    module["active"] = "0";
+    for (int s = 0; s < settings; ++s) {
+      module["setting" + std::to_string(s)] = "some value";
+    }
+  }
+  return result;
+}
+
+double measure(int updates, int modules, int settings,
+               const std::function<void (const std::string&,
+                                         const std::string&,
+                                         const std::string&)>& update) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; ++i) {
+    update("module" + std::to_string(i % modules),
+           "setting" + std::to_string((i / modules) % settings),
+           std::to_string(i));
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return updates / elapsed.count();
+}
+
+void print(const std::string& name, double rate, double base) {
+  std::cout << std::setw(8) << name
+            << std::setw(14) << static_cast<long>(rate)
+            << std::setw(10) << std::setprecision(3) << rate / base << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int updates = argc > 1 ? std::atoi(argv[1]) : 5000;
+  int modules = argc > 2 ? std::atoi(argv[2]) : 12;
+  int settings = argc > 3 ? std::atoi(argv[3]) : 16;
+
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  fs::create_directories(dir);
+  std::string json_path = (dir / "config.json").string();
+  std::string log_path = (dir / "config.log").string();
+
+  botscript::mem_bot_config initial("id", "user", "password", "package",
+                                    "server", build_settings(modules, settings));
+
+  std::cout << std::setw(8) << "backend" << std::setw(14) << "updates/s"
+            << std::setw(10) << "speedup" << "\n";
+
+  // Whole document rewrite after every update.
+  botscript::mem_bot_config json_config("id", "user", "password", "package",
+                                        "server", initial.module_settings());
+  double json_rate = measure(updates, modules, settings,
+      [&](const std::string& module, const std::string& key,
+          const std::string& value) {
+        json_config.set(module, key, value);
+        std::ofstream out(json_path.c_str(), std::ios::trunc);
+        out << json_config.to_json(true);
+      });
+  print("json", json_rate, json_rate);
+
+  // Append-only log.
+  for (std::size_t sync_every : { 0, 64, 1 }) {
+    botscript::log_bot_config log_config(log_path, initial, sync_every);
+    double rate = measure(updates, modules, settings,
+        [&](const std::string& module, const std::string& key,
+            const std::string& value) {
+          log_config.set(module, key, value);
+        });
+    print("log/" + std::to_string(sync_every), rate, json_rate);
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Measures the configuration work done per bot command. Every command does
+// what bot::execute does: check the old value for a shared redirect, store
+// the new value, collect the dependent variables of a shared value and read
+// a shared value (lua get_shared). "copy" replays the former access pattern
+// (deep copies of the nested module settings map), "flat" uses the lookups
+// and visitors of mem_bot_config. Usage:
+//
+//   config_throughput [commands] [modules] [settings per module]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../src/mem_bot_config.h"
+
+using botscript::string_map;
+
+namespace {
+
+typedef std::map<std::string, string_map> settings_map;
+
+/// The former storage: nested maps, accessed through by-value copies.
+struct copy_config {
+  explicit copy_config(const settings_map& settings) : settings(settings) {
+  }
+
+  settings_map module_settings() const { return settings; }
+
+  void execute(const std::string& module, const std::string& key,
+               const std::string& value, long* hits) {
+    auto all = module_settings();
+    const std::string& old_val = all[module][key];
+    *hits += !old_val.empty() && old_val[0] == '^';
+    settings[module][key] = value;
+
+    std::string s1 = "$" + key, s2 = "^" + key;
+    for (const auto& m : module_settings()) {
+      for (const auto& s : m.second) {
+        *hits += s.second == s1 || s.second == s2;
+      }
+    }
+
+    auto shared = module_settings()["shared"];
+    *hits += shared.find(key) != shared.end();
+  }
+
+  settings_map settings;
+};
+
+/// The flat storage with by-reference accessors.
+struct flat_config {
+  explicit flat_config(const settings_map& settings)
+    : config("id", "user", "password", "package", "server", settings) {
+  }
+
+  void execute(const std::string& module, const std::string& key,
+               const std::string& value, long* hits) {
+    const std::string* old_val = config.find(module, key);
+    *hits += old_val != nullptr && !old_val->empty() && (*old_val)[0] == '^';
+    config.set(module, key, value);
+
+    std::string s1 = "$" + key, s2 = "^" + key;
+    config.visit([&](const std::string&, const std::string&,
+                     const std::string& v) {
+      *hits += v == s1 || v == s2;
+    });
+
+    *hits += config.find("shared", key) != nullptr;
+  }
+
+  botscript::mem_bot_config config;
+};
+
+settings_map build_settings(int modules, int settings) {
+  settings_map result;
+  result["base"]["wait_time_factor"] = "1.00";
+  result["base"]["proxy"] = "";
+  for (int m = 0; m < modules; ++m) {
+    string_map& module = result["module" + std::to_string(m)];
+    module["active"] = "0";
+    for (int s = 0; s < settings; ++s) {
+      module["setting" + std::to_string(s)] =
+          s % 8 == 0 ? "$setting" + std::to_string(s) : "some value";
+    }
+  }
+  result["shared"]["setting0"] = "shared value";
+  return result;
+}
+
+template<typename Config>
+double run(Config* config, int commands, int modules, int settings,
+           long* hits) {
+  std::vector<std::string> module_names, keys;
+  for (int m = 0; m < modules; ++m) {
+    module_names.push_back("module" + std::to_string(m));
+  }
+  for (int s = 0; s < settings; ++s) {
+    keys.push_back("setting" + std::to_string(s));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < commands; ++i) {
+    config->execute(module_names[i % modules], keys[(i / modules) % settings],
+                    std::to_string(i), hits);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return commands / elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int commands = argc > 1 ? std::atoi(argv[1]) : 20000;
+  int modules = argc > 2 ? std::atoi(argv[2]) : 12;
+  int settings = argc > 3 ? std::atoi(argv[3]) : 16;
+  settings_map initial = build_settings(modules, settings);
+
+  long copy_hits = 0, flat_hits = 0;
+  copy_config copy(initial);
+  flat_config flat(initial);
+  double copy_rate = run(&copy, commands, modules, settings, &copy_hits);
+  double flat_rate = run(&flat, commands, modules, settings, &flat_hits);
+
+  std::cout << std::setw(8) << "storage" << std::setw(14) << "commands/s"
+            << std::setw(9) << "speedup" << "\n";
+  std::cout << std::setw(8) << "copy"
+            << std::setw(14) << static_cast<long>(copy_rate)
+            << std::setw(9) << 1.0 << "\n";
+  std::cout << std::setw(8) << "flat"
+            << std::setw(14) << static_cast<long>(flat_rate)
+            << std::setw(9) << std::setprecision(3) << flat_rate / copy_rate
+            << "\n";
+
+  // Both variants have to see the same values.
+  if (copy_hits != flat_hits) {
+    std::cerr << "result mismatch: " << copy_hits << " != " << flat_hits
+              << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Measures the cost of logging. "stream" replays the former bot::log (time
+// facet + locale + stringstreams per message, std::list of formatted lines),
+// "ring" pushes into a log_ring with the coarse clock and formats the line
+// for the update callback, "ring/store" only stores the record.
+// Usage:
+//
+//   log_ring [messages]
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <locale>
+#include <sstream>
+#include <string>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "../src/log_ring.h"
+
+#define BENCH_LOG_SIZE 50
+
+namespace {
+
+void measure(const std::string& name, int messages,
+             const std::function<std::size_t ()>& run) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t bytes = run();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << std::setw(12) << name
+            << std::setw(12) << std::setprecision(3) << elapsed.count()
+            << std::setw(14) << static_cast<long>(messages / elapsed.count())
+            << std::setw(10) << bytes
+            << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int messages = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  const std::string identifier = "te_user12345";
+  const std::string source = "base";
+  const std::string message = "logged in successfully, next run in 42 seconds";
+
+  std::cout << std::setw(12) << "logger" << std::setw(12) << "seconds"
+            << std::setw(14) << "messages/s" << std::setw(10) << "bytes"
+            << "\n";
+
+  measure("stream", messages, [&]() {
+    std::list<std::string> log_msgs;
+    std::size_t bytes = 0;
+    for (int i = 0; i < messages; ++i) {
+      std::stringstream time;
+      boost::posix_time::time_facet* p_time_output =
+          new boost::posix_time::time_facet();
+      std::locale special_locale(std::locale("C"), p_time_output);
+      time.imbue(special_locale);
+      p_time_output->format("%d.%m %H:%M:%S");
+      time << boost::posix_time::second_clock::local_time();
+
+      std::stringstream msg;
+      msg << "[INFO ]" << "[" << time.str() << "]["
+          << std::left << std::setw(20) << identifier
+          << "][" << std::left << std::setw(8) << source << "] "
+          << message << "\n";
+      if (log_msgs.size() > BENCH_LOG_SIZE) {
+        log_msgs.pop_front();
+      }
+      log_msgs.push_back(msg.str());
+      bytes += msg.str().size();
+    }
+    return bytes;
+  });
+
+  boost::asio::io_service io_service;
+  botscript::coarse_clock::start(&io_service);
+
+  measure("ring", messages, [&]() {
+    botscript::log_ring log(BENCH_LOG_SIZE + 1);
+    std::size_t bytes = 0;
+    for (int i = 0; i < messages; ++i) {
+      log.push(1, source, message);
+      bytes += log.line(1, identifier, source, message).size();
+    }
+    return bytes;
+  });
+
+  measure("ring/store", messages, [&]() {
+    botscript::log_ring log(BENCH_LOG_SIZE + 1);
+    for (int i = 0; i < messages; ++i) {
+      log.push(1, source, message);
+    }
+    return log.str(identifier).size();
+  });
+
+  botscript::coarse_clock::stop();
+  return 0;
+}
@@ -0,0 +1,196 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Measures what real bots hold after loading their modules. A synthetic
+// package is written to a temporary package directory (every module script
+// defines an interface, a status table and a run function) and loaded with
+// bot::load_packages(). The bots are restored like test/bot_test.cpp does
+// (the session check passes, no login): "none" activates no module,
+// "active" the first [active modules] and "all" every module. Bots only
+// instantiate the modules their configuration activates (see bot::apply).
+// The footprints are collected with bot::collect_footprints() after the
+// started modules ran once. Usage:
+//
+//   module_instantiation [bots] [modules] [active modules]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio/deadline_timer.hpp"
+#include "boost/asio/io_service.hpp"
+#include "boost/filesystem.hpp"
+
+#include "../src/bot.h"
+#include "../src/mem_bot_config.h"
+#include "../src/timing_wheel.h"
+
+#define BENCH_DEFAULTS 8
+#define BENCH_SERVER "http://bench.example.com"
+
+namespace asio = boost::asio;
+namespace fs = boost::filesystem;
+using botscript::bot;
+using botscript::string_map;
+
+namespace {
+
+void write_file(const fs::path& path, const std::string& content) {
+  std::ofstream f(path.string().c_str());
+  f << content;
+}
+
+/// Writes the package "bench" to dir/packages/bench.
+void write_package(const fs::path& dir, int module_count) {
+  fs::path package = dir / "packages" / "bench";
+  fs::create_directories(package);
+
+  std::string base;
+  for (int f = 0; f < 64; ++f) {
+    base += "function util" + std::to_string(f) +
+            "(page)\n  return string.match(page, \"<a href=\\\"(.-)\\\">\")"
+            "\nend\n";
+  }
+  base += "function login()\n  return on_finish(true)\nend\n"
+          "function check_login()\n  return on_finish(true)\nend\n";
+  write_file(package / "base.lua", base);
+  write_file(package / "servers.lua",
+             "servers = {}\nservers[\"" BENCH_SERVER "\"] = \"b\"\n");
+
+  for (int m = 0; m < module_count; ++m) {
+    std::string name = "module" + std::to_string(m);
+    std::string script = "interface_" + name + " = {\n  module = \"" + name +
+                         "\",\n";
+    for (int d = 0; d < BENCH_DEFAULTS; ++d) {
+      script += "  setting" + std::to_string(d) +
+                " = { input_type = \"text\", display_name = \"Setting\" },\n";
+    }
+    script += "}\n\nstatus_" + name + " = {\n";
+    for (int d = 0; d < BENCH_DEFAULTS; ++d) {
+      script += "  setting" + std::to_string(d) + " = \"default " +
+                std::to_string(d) + "\",\n";
+    }
+    script += "}\n\nfunction run_" + name + "()\n";
+    for (int s = 0; s < 32; ++s) {
+      script += "  util" + std::to_string(s) + "(\"<a href=\\\"x\\\">\")\n";
+    }
+    script += "  return on_finish(600, 600)\nend\n";
+    write_file(package / (name + ".lua"), script);
+  }
+}
+
+/// The configuration of every bot: the first active_count modules are active.
+std::map<std::string, string_map> build_settings(int module_count,
+                                                 int active_count) {
+  std::map<std::string, string_map> settings;
+  settings["base"]["wait_time_factor"] = "1.00";
+  settings["base"]["proxy"] = "";
+  for (int m = 0; m < module_count; ++m) {
+    string_map& module = settings["module" + std::to_string(m)];
+    module["active"] = m < active_count ? "1" : "0";
+    module["setting0"] = "user value";
+  }
+  return settings;
+}
+
+void measure(const std::string& name, int bots, int module_count,
+             int active_count) {
+  asio::io_service io_service;
+  std::map<std::string, string_map> settings =
+      build_settings(module_count, active_count);
+
+  // Restore the bots (the session check of the package passes).
+  std::vector<std::shared_ptr<bot>> fleet;
+  int restored = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < bots; ++i) {
+    auto config = std::make_shared<botscript::mem_bot_config>(
+        "", "user" + std::to_string(i), "password", "bench", BENCH_SERVER,
+        settings);
+    config->cookies({ { "session", "1" } });
+    fleet.push_back(std::make_shared<bot>(&io_service));
+    fleet.back()->restore(config, std::vector<std::string>(),
+                          [&restored](std::shared_ptr<bot>, std::string err) {
+      if (!err.empty()) {
+        std::cerr << "restore failed: " << err << "\n";
+        std::exit(1);
+      }
+      ++restored;
+    });
+  }
+  while (restored < bots && io_service.run_one() != 0) {
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  // Let the started modules run once, then collect the footprints.
+  bot::fleet_footprint footprints;
+  asio::deadline_timer wait(io_service);
+  wait.expires_from_now(
+      boost::posix_time::milliseconds(3 * TIMING_WHEEL_TICK_MS));
+  wait.async_wait([&io_service, &footprints](
+      const boost::system::error_code&) {
+    bot::collect_footprints([&io_service, &footprints](
+        bot::fleet_footprint fleet) {
+      footprints.swap(fleet);
+      io_service.stop();
+    });
+  });
+  io_service.run();
+  io_service.reset();
+
+  bot::footprint f;
+  for (const auto& b : footprints) {
+    f.settings += b.second.settings;
+    f.browser += b.second.browser + b.second.cookies;
+    f.commands += b.second.commands;
+    f.lua += b.second.lua + b.second.responses;
+  }
+
+  std::cout << std::setw(8) << name
+            << std::setw(10) << std::setprecision(3) << elapsed.count()
+            << std::setw(14) << f.settings / 1024
+            << std::setw(13) << f.browser / 1024
+            << std::setw(14) << f.commands / 1024
+            << std::setw(10) << f.lua / 1024
+            << "\n";
+
+  for (const auto& b : fleet) {
+    b->shutdown();
+  }
+  io_service.poll();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int bots = argc > 1 ? std::atoi(argv[1]) : 200;
+  int module_count = argc > 2 ? std::atoi(argv[2]) : 40;
+  int active_count = argc > 3 ? std::atoi(argv[3]) : 4;
+
+  // The package loader reads relative to the working directory.
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  write_package(dir, module_count);
+  fs::path cwd = fs::current_path();
+  fs::current_path(dir);
+  bot::load_packages("./packages");
+
+  std::cout << std::setw(8) << "modules" << std::setw(10) << "seconds"
+            << std::setw(14) << "settings KiB" << std::setw(13)
+            << "browser KiB" << std::setw(14) << "commands KiB"
+            << std::setw(10) << "lua KiB" << "\n";
+  measure("none", bots, module_count, 0);
+  measure("active", bots, module_count, active_count);
+  measure("all", bots, module_count, module_count);
+
+  fs::current_path(cwd);
+  fs::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+// Measures how the per-bot strand model scales with the number of threads
+// running the io_service. Every simulated bot owns a strand and runs a chain
+// of handlers doing script-like work (regex extraction from a page). Usage:
+//
+//   strand_scaling [max threads] [bots] [handlers per bot]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/asio/strand.hpp"
+#include "boost/regex.hpp"
+#include "boost/thread.hpp"
+
+namespace asio = boost::asio;
+
+namespace {
+
+/// Simulated bot: a strand and a chain of handlers.
+struct sim_bot {
+  sim_bot(asio::io_service* io_service, const std::string* page, int handlers)
+    : strand(*io_service),
+      page(page),
+      remaining(handlers),
+      running(false),
+      overlaps(0),
+      matches(0) {
+  }
+
+  void step() {
+    // Detect handlers of the same bot running concurrently.
+    if (running.exchange(true)) {
+      ++overlaps;
+    }
+
+    static const boost::regex link("<a href=\"([^\"]*)\">");
+    boost::sregex_iterator i(page->begin(), page->end(), link), end;
+    matches += std::distance(i, end);
+
+    running = false;
+    if (--remaining > 0) {
+      strand.post([this]() { step(); });
+    }
+  }
+
+  asio::io_service::strand strand;
+  const std::string* page;
+  int remaining;
+  std::atomic<bool> running;
+  int overlaps;
+  long matches;
+};
+
+std::string build_page() {
+  std::string page = "<html><head></head><body>";
+  for (int i = 0; i < 200; ++i) {
+    page += "<p>entry " + std::to_string(i) + "</p>";
+    page += "<a href=\"/index.php?page=" + std::to_string(i) + "\">link</a>";
+  }
+  page += "</body></html>";
+  return page;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int max_threads = argc > 1 ? std::atoi(argv[1])
+                             : std::max(1u, boost::thread::hardware_concurrency());
+  int bot_count = argc > 2 ? std::atoi(argv[2]) : 256;
+  int handlers = argc > 3 ? std::atoi(argv[3]) : 200;
+  std::string page = build_page();
+
+  double base = 0.0;
+  std::cout << std::setw(8) << "threads" << std::setw(12) << "handlers/s"
+            << std::setw(9) << "speedup" << std::setw(9) << "overlaps" << "\n";
+  for (int threads = 1; threads <= max_threads; ++threads) {
+    asio::io_service io_service;
+    std::vector<std::unique_ptr<sim_bot>> bots;
+    for (int i = 0; i < bot_count; ++i) {
+      bots.emplace_back(new sim_bot(&io_service, &page, handlers));
+      sim_bot* b = bots.back().get();
+      b->strand.post([b]() { b->step(); });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    boost::thread_group group;
+    for (int i = 1; i < threads; ++i) {
+      group.create_thread([&io_service]() { io_service.run(); });
+    }
+    io_service.run();
+    group.join_all();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    int overlaps = 0;
+    for (const auto& b : bots) {
+      overlaps += b->overlaps;
+    }
+
+    double rate = bot_count * handlers / elapsed.count();
+    if (threads == 1) {
+      base = rate;
+    }
+    std::cout << std::setw(8) << threads
+              << std::setw(12) << static_cast<long>(rate)
+              << std::setw(9) << std::setprecision(3) << rate / base
+              << std::setw(9) << overlaps << "\n";
+  }
+
+  return 0;
+}
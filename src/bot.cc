@@ -4,6 +4,8 @@
 
 #include "./bot.h"
 
+#include <atomic>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 
@@ -15,6 +17,9 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 
+#include "./buffered_bot_config.h"
+#include "./footprint.h"
+#include "./login_admission.h"
 #include "./lua/lua_connection.h"
 #include "./mem_bot_config.h"
 
@@ -38,11 +43,25 @@ double round(double r) {
 namespace botscript {
 
 // Initialization of the static bot class attributes.
-std::map<std::string, std::shared_ptr<botscript::package>> bot::packages_;
+std::shared_ptr<const bot::package_map> bot::packages_ =
+    std::make_shared<bot::package_map>();
+std::atomic<int> bot::hibernate_after_(0);
+std::atomic<std::size_t> bot::footprint_budget_(0);
+std::atomic<int> bot::write_behind_ms_(0);
+std::atomic<int> bot::log_level_default_(bot::BS_LOG_DBG);
+std::atomic<std::size_t> bot::write_behind_max_(64);
 
 bot::bot(boost::asio::io_service* io_service)
     : io_service_(io_service),
+      strand_(*io_service),
       wait_time_factor_(1.0f),
+      batch_depth_(0),
+      idle_timer_(*io_service),
+      hibernated_(false),
+      waking_(false),
+      rng_(std::random_device()()),
+      log_(MAX_LOG_SIZE + 1),
+      log_level_(-1),
       login_result_stored_(false),
       login_result_(false),
       proxy_check_active_(false) {
@@ -52,17 +71,32 @@ bot::~bot() {
 }
 
 void bot::shutdown() {
+  // Write pending (buffered) configuration changes.
+  if (nullptr != configuration_) {
+    configuration_->flush();
+
+    auto buffered =
+        std::dynamic_pointer_cast<buffered_bot_config>(configuration_);
+    if (nullptr != buffered) {
+      buffered_bot_config::statistics s = buffered->stats();
+      BS_DBG(this, "base", "config writes: ", s.writes,
+             ", coalesced: ", s.coalesced, ", skipped: ", s.skipped,
+             ", flushes: ", s.flushes,
+             ", mean flush: ", s.mean_flush_us(), "us",
+             ", mean delay: ", s.mean_delay_ms(), "ms");
+    }
+  }
   configuration_ = std::make_shared<mem_bot_config>();
 
   lua_connection::remove(identifier_);
+  idle_timer_.cancel();
   for (const auto& m : modules_) {
-    m->execute("global_set_active", "0");
+    m.second->apply("active", "0");
   }
   modules_.clear();
 
-  std::stringstream msg;
-  msg << "login_callback " << (nullptr == login_cb_ ? "not " : "") << "set";
-  log(BS_LOG_DBG, "base", msg.str());
+  BS_DBG(this, "base", "login_callback ",
+         nullptr == login_cb_ ? "not set" : "set");
 
   update_callback_ = nullptr;
 }
@@ -71,10 +105,19 @@ std::shared_ptr<bot_config> bot::config() { return configuration_; }
 
 bot_browser* bot::browser() { return browser_.get(); }
 
+boost::asio::io_service::strand* bot::strand() { return &strand_; }
+
+std::shared_ptr<const bot::package_map> bot::packages() {
+  return std::atomic_load(&packages_);
+}
+
 void bot::load_packages(const std::string& p) {
   (void) p;
+
+  // Build a new package map, bots keep using the old one until it is stored.
+  auto packages = std::make_shared<package_map>();
 #if defined(ANDROID) || defined(STATIC_PACKAGES)
-  packages_["pg"] = std::make_shared<package>("pg", []() {
+  (*packages)["pg"] = std::make_shared<package>("pg", []() {
       std::map<std::string, std::string> modules;
       for (auto const& [name, id] : pg::get_resource_ids()) {
           auto const res = pg::make_resource(id);
@@ -91,7 +134,6 @@ void bot::load_packages(const std::string& p) {
   }
 
   // Iterate specified directory.
-  packages_.clear();
   using boost::filesystem::directory_iterator;
   for (auto i = directory_iterator(p); i != directory_iterator(); ++i) {
     // Don't load hidden files.
@@ -103,28 +145,112 @@ void bot::load_packages(const std::string& p) {
     std::string module_path = i->path().generic_string();
     try {
       auto module = std::make_shared<package>(module_path);
-      packages_[module->name()] = module;
+      (*packages)[module->name()] = module;
     } catch (const std::runtime_error& e) {
       std::cout << "Unable to load module at " << module_path
                 << ", error: " << e.what() << std::endl;
     }
   }
 #endif
+
+  // Publish the new packages.
+  std::atomic_store(&packages_,
+                    std::shared_ptr<const package_map>(std::move(packages)));
 }
 
 void bot::init(std::shared_ptr<bot_config> configuration, const error_cb& cb) {
+  if (attach(configuration, cb)) {
+    connect(shared_from_this(), started(cb),
+            configuration_->init_command_sequence());
+  }
+}
+
+void bot::restore(std::shared_ptr<bot_config> configuration,
+                  const std::vector<std::string>& proxies,
+                  const error_cb& cb) {
+  if (!attach(configuration, cb)) {
+    return;
+  }
+
+  std::shared_ptr<bot> self = shared_from_this();
+  error_cb done = started(cb);
+  command_sequence commands = configuration_->init_command_sequence();
+  if (!package_->has_login_check() || !configuration_->has_cookies()) {
+    log(BS_LOG_NFO, "base", "restore: session can't be checked");
+    return connect(self, done, commands);
+  }
+
+  // Resume the session if it is still valid: no proxy check, no login.
+  browser_ = std::make_shared<bot_browser>(io_service_, self);
+  browser_->cookies(configuration_->cookies());
+  browser_->restore_proxies(proxies);
+
+  // Give the admission back when the modules are loaded.
+  error_cb loaded = [done](std::shared_ptr<bot> b, std::string err) {
+    login_admission::release();
+    done(b, err);
+  };
+
+  // Session expired: connect like a new bot (without the stale cookies,
+  // they would only be checked again).
+  expired_fn expired = [this, done, commands](std::shared_ptr<bot> self) {
+    log(BS_LOG_NFO, "base", "restore: session expired");
+    login_admission::release();
+    configuration_->cookies(std::map<std::string, std::string>());
+    connect(self, done, commands);
+  };
+
+  std::weak_ptr<bot> weak = self;
+  auto check = [this, weak, loaded, commands, expired]() {
+    std::shared_ptr<bot> self = weak.lock();
+    if (!self) {
+      login_admission::release();
+      return;
+    }
+
+    log(BS_LOG_NFO, "base", "restore: checking session");
+    auto s = std::make_shared<state_wrapper>();
+    login_cb_ = boost::bind(&bot::handle_login_check, this,
+                            self, s, _1, loaded, commands, true, expired);
+    lua_connection::check_login(s->get(), self,
+                                package_->modules().find("base")->second,
+                                &login_cb_);
+  };
+  login_admission::acquire(io_service_, configuration_->server(),
+                           strand_.wrap(check));
+}
+
+std::vector<std::string> bot::proxies() const {
+  if (nullptr == browser_) {
+    return std::vector<std::string>();
+  }
+  return browser_->good_proxies();
+}
+
+bool bot::attach(std::shared_ptr<bot_config> configuration,
+                 const error_cb& cb) {
   // Get shared pointer to keep alive.
   std::shared_ptr<bot> self = shared_from_this();
 
-  // Set configuration.
-  configuration_ = configuration;
+  // Set configuration (buffered if write-behind is enabled).
+  int write_behind_ms = write_behind_ms_;
+  if (write_behind_ms > 0) {
+    configuration_ = std::make_shared<buffered_bot_config>(
+        configuration, io_service_, &strand_,
+        boost::posix_time::milliseconds(write_behind_ms), write_behind_max_);
+  } else {
+    configuration_ = configuration;
+  }
+  index_dependencies();
 
   // Check package information.
-  const auto package_it = packages_.find(configuration_->package());
-  if (package_it == packages_.end()) {
+  auto packages = bot::packages();
+  const auto package_it = packages->find(configuration_->package());
+  if (package_it == packages->end()) {
     throw std::runtime_error("package not found");
   }
   package_ = package_it->second;
+  load_log_levels();
 
   // Set identifier.
   identifier_ = identifier(configuration_->username(),
@@ -133,45 +259,137 @@ void bot::init(std::shared_ptr<bot_config> configuration, const error_cb& cb) {
 
   // Check whether bot already exists.
   if (lua_connection::contains(identifier_)) {
-    return cb(self, "bot already registered");
+    cb(self, "bot already registered");
+    return false;
   }
 
   // Add bot to lua connection.
   lua_connection::add(shared_from_this());
+  return true;
+}
+
+bot::error_cb bot::started(const error_cb& cb) {
+  // Start watching for idleness after the login.
+  return [this, cb](std::shared_ptr<bot> self, std::string err) {
+    if (err.empty()) {
+      last_activity_ = boost::posix_time::second_clock::universal_time();
+      arm_idle_timer();
+    }
+    cb(self, err);
+  };
+}
 
+void bot::connect(std::shared_ptr<bot> self, const error_cb& cb,
+                  const command_sequence& commands) {
   // Instantiate browser with cookies from the configuration.
   browser_ = std::make_shared<bot_browser>(io_service_, self);
   browser_->cookies(configuration_->cookies());
 
   // Set proxy if available.
-  std::string proxy = configuration_->module_settings()["base"]["proxy"];
-  command_sequence commands = configuration_->init_command_sequence();
+  std::string proxy = configuration_->value_of("base", "proxy");
   if (!proxy.empty()) {
     browser_->set_proxy_list(proxy,
                              [this, commands, cb, self, proxy](int success) {
       if (!success) {
-        configuration_->set("base", "proxy", proxy);
+        write("base", "proxy", proxy);
         return cb(self, "no working proxy found");
       } else {
-        log(BS_LOG_NFO, "base", "login: 1. try");
-        std::shared_ptr<state_wrapper> s = std::make_shared<state_wrapper>();
-        login_cb_ = boost::bind(&bot::handle_login, this,
-                                self, s, _1, cb, commands, true, 2);
-        lua_connection::login(
-            s->get(), self,
-            package_->modules().find("base")->second,
-            &login_cb_);
+        start_login(self, cb, commands, true);
       }
     });
   } else {
-    log(BS_LOG_NFO, "base", "login: 1. try");
-    std::shared_ptr<state_wrapper> s = std::make_shared<state_wrapper>();
-    login_cb_ = boost::bind(&bot::handle_login, this,
-                            self, s, _1, cb, commands, true, 2);
-    lua_connection::login(s->get(), self,
-                          package_->modules().find("base")->second,
-                          &login_cb_);
+    start_login(self, cb, commands, true);
+  }
+}
+
+void bot::start_login(std::shared_ptr<bot> self, const error_cb& cb,
+                      const command_sequence& init_commands, bool load_mod) {
+  // Give the admission back when the login has finished.
+  error_cb done = [cb](std::shared_ptr<bot> b, std::string err) {
+    login_admission::release();
+    cb(b, err);
+  };
+
+  // Don't keep bots alive (shut down while waiting) in the admission queue.
+  std::weak_ptr<bot> weak = self;
+  auto start = [this, weak, done, init_commands, load_mod]() {
+    std::shared_ptr<bot> self = weak.lock();
+    if (!self) {
+      login_admission::release();
+      return;
+    }
+
+    if (!package_->has_login_check() || !configuration_->has_cookies()) {
+      return full_login(self, done, init_commands, load_mod);
+    }
+
+    // Fast path: check whether the stored session is still logged in.
+    log(BS_LOG_NFO, "base", "login: checking session");
+    expired_fn expired = [this, done, init_commands, load_mod](
+        std::shared_ptr<bot> self) {
+      full_login(self, done, init_commands, load_mod);
+    };
+    auto s = std::make_shared<state_wrapper>();
+    login_cb_ = boost::bind(&bot::handle_login_check, this, self, s, _1,
+                            done, init_commands, load_mod, expired);
+    lua_connection::check_login(s->get(), self,
+                                package_->modules().find("base")->second,
+                                &login_cb_);
+  };
+
+  login_admission::acquire(io_service_, configuration_->server(),
+                           strand_.wrap(start));
+}
+
+void bot::full_login(std::shared_ptr<bot> self, const error_cb& cb,
+                     const command_sequence& init_commands, bool load_mod) {
+  log(BS_LOG_NFO, "base", "login: 1. try");
+  auto s = std::make_shared<state_wrapper>();
+  login_cb_ = boost::bind(&bot::handle_login, this,
+                          self, s, _1, cb, init_commands, load_mod, 2);
+  lua_connection::login(s->get(), self,
+                        package_->modules().find("base")->second,
+                        &login_cb_);
+}
+
+void bot::handle_login_check(std::shared_ptr<bot> self,
+                             std::shared_ptr<state_wrapper> state_wr,
+                             const std::string& err,
+                             const error_cb& cb,
+                             const command_sequence& init_commands,
+                             bool load_mod, const expired_fn& expired) {
+  bool logged_in = false;
+  if (err.empty()) {
+    lua_State* state = state_wr->get();
+    if (!login_result_stored_) {
+      // First call: read the result of on_finish.
+      login_result_stored_ = true;
+      login_result_ = lua_toboolean(state, -1) == 0 ? false : true;
+      lua_pop(state, 1);
+      return;
+    }
+    logged_in = login_result_;
+  } else {
+    log(BS_LOG_NFO, "base", "login check failed: ", err);
   }
+  login_result_stored_ = false;
+
+  if (logged_in) {
+    log(BS_LOG_NFO, "base", "login: session still valid");
+    if (load_mod) {
+      load_modules(init_commands);
+    }
+    cb(self, "");
+    login_cb_ = nullptr;
+    return;
+  }
+
+  // Session expired. The arguments are bound to login_cb_ and have to be
+  // copied before it is reset.
+  std::shared_ptr<bot> keep = self;
+  expired_fn on_expired = expired;
+  login_cb_ = nullptr;
+  on_expired(keep);
 }
 
 void bot::handle_login(std::shared_ptr<bot> self,
@@ -183,7 +401,7 @@ void bot::handle_login(std::shared_ptr<bot> self,
   if (!err.empty()) {
     login_result_stored_ = false;
 
-    log(BS_LOG_NFO, "base", std::string("login failed: ") + err);
+    log(BS_LOG_NFO, "base", "login failed: ", err);
 
     if (tries == 0) {
       cb(self, err);
@@ -195,8 +413,7 @@ void bot::handle_login(std::shared_ptr<bot> self,
       login_cb_ = boost::bind(&bot::handle_login, this,
                               self, next_state, _1, cb, init_commands,
                               load_mod, tries - 1);
-      std::string t =  boost::lexical_cast<std::string>(4 - tries);
-      log(BS_LOG_NFO, "base", std::string("login: ") + t + ". try");
+      log(BS_LOG_NFO, "base", "login: ", 4 - tries, ". try");
       lua_connection::login(next_state->get(), shared_from_this(),
                             package_->modules().find("base")->second,
                             &login_cb_);
@@ -221,15 +438,14 @@ void bot::handle_login(std::shared_ptr<bot> self,
         login_cb_ = boost::bind(&bot::handle_login, this,
                                 self, next_state, _1, cb, init_commands,
                                 load_mod, tries - 1);
-        std::string t = boost::lexical_cast<std::string>(4 - tries);
-        log(BS_LOG_NFO, "base", std::string("login: ") + t + ". try");
+        log(BS_LOG_NFO, "base", "login: ", 4 - tries, ". try");
         lua_connection::login(
             next_state->get(), shared_from_this(),
             package_->modules().find("base")->second,
             &login_cb_);
       } else /* if (login_result_) */ {
         if (load_mod) {
-          load_modules(init_commands, self);
+          load_modules(init_commands);
         }
         cb(self, "");
         login_cb_ = nullptr;
@@ -239,36 +455,66 @@ void bot::handle_login(std::shared_ptr<bot> self,
   }
 }
 
-void bot::load_modules(const command_sequence& init_commands,
-                       std::shared_ptr<bot> self) {
-  // Load modules from package folder:
-  const std::string& base_script = package_->modules().find("base")->second;
-  for (const auto& m : package_->modules()) {
-    // base and servers ain't no modules.
-    if (m.first == "base" || m.first == "servers") {
-      continue;
+void bot::load_modules(const command_sequence& init_commands) {
+  // All initial statuses are written and notified as one batch.
+  // Modules are instantiated when they get activated (see apply).
+  begin_batch();
+  for(const auto& command : init_commands) {
+    route(command.first, command.second);
+  }
+  end_batch();
+}
+
+std::shared_ptr<module> bot::instantiate(const std::string& name) {
+  // base and servers ain't no modules.
+  const auto& scripts = package_->modules();
+  auto script = scripts.find(name);
+  if (script == scripts.end() || name == "base" || name == "servers") {
+    return nullptr;
+  }
+
+  // Create module.
+  try {
+    auto new_module = std::make_shared<module>(
+        name, scripts.find("base")->second, script->second,
+        package_->status_defaults(name), shared_from_this(), io_service_);
+
+    // Check load success.
+    if (new_module->load_success()) {
+      modules_[name] = new_module;
+      return new_module;
+    } else {
+      log(BS_LOG_ERR, "base", name + " could not be loaded");
     }
+  } catch (...) {
+    log(BS_LOG_ERR, "base", name + " could not be loaded!");
+  }
 
-    // Create module.
-    try {
-      auto new_module = std::make_shared<module>(m.first,
-                                                 base_script, m.second,
-                                                 self, io_service_);
+  return nullptr;
+}
 
-      // Check load success.
-      if (new_module->load_success()) {
-        modules_.push_back(new_module);
-      } else {
-        log(BS_LOG_ERR, "base", m.first + " could not be loaded");
-      }
-    } catch (...) {
-      log(BS_LOG_ERR, "base", m.first + " could not be loaded!");
+void bot::apply(const std::string& name, const std::string& setting,
+                const std::string& argument) {
+  auto it = modules_.find(name);
+  if (it != modules_.end()) {
+    return it->second->apply(setting, argument);
+  }
+
+  // Module not instantiated: settings are only stored.
+  if (setting != "active") {
+    if (package_->status_defaults(name) != nullptr) {
+      log(BS_LOG_NFO, name, "setting ", setting, " to ", argument);
+      status(name + "_" + setting, argument);
     }
+    return;
   }
 
-  // Initialize modules.
-  for(auto command : init_commands) {
-    execute(command.first, command.second);
+  // Instantiate on activation.
+  std::shared_ptr<module> m;
+  if (argument == "1" && (m = instantiate(name)) != nullptr) {
+    m->apply(setting, argument);
+  } else if (package_->status_defaults(name) != nullptr) {
+    refresh_status(name + "_active");
   }
 }
 
@@ -281,8 +527,9 @@ std::string bot::identifier(const std::string& username,
     print_package = print_package.substr(slash_pos + 1);
   }
 
-  const auto package_it = packages_.find(package);
-  if (package_it == packages_.end()) {
+  auto packages = bot::packages();
+  const auto package_it = packages->find(package);
+  if (package_it == packages->end()) {
     std::string error = std::string("package ") + package + " not available";
     throw std::runtime_error(std::move(error));
   }
@@ -295,61 +542,137 @@ std::string bot::identifier(const std::string& username,
 }
 
 int bot::random(int a, int b) {
-  // Generate non-random number. That's enough for our purposes.
-  // With many bots it's already very hard (impossilbe?) to predict the result.
-  static unsigned int seed = 6753;
-  seed *= 31;
-  seed %= 32768;
-  double r = seed / static_cast<double>(32768);
+  // Every bot has its own generator: bots don't step in lockstep.
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  double r = dist(rng_);
   int wait_time = a + static_cast<int>(std::round(r * (b - a) * wait_time_factor_));
   return wait_time;
 }
 
+int bot::wakeup(int a, int b, wakeup_scheduler::reservation* planned) {
+  int max = a + static_cast<int>(std::round((b - a) * wait_time_factor_));
+  return boost::asio::use_service<wakeup_scheduler>(*io_service_)
+      .schedule(a, max, &rng_, planned);
+}
+
+void bot::cancel_wakeup(wakeup_scheduler::reservation planned) {
+  boost::asio::use_service<wakeup_scheduler>(*io_service_).release(planned);
+}
+
 void bot::log(int type, const std::string& source, const std::string& message) {
-  // Build date string.
-  std::stringstream time;
-  boost::posix_time::time_facet* p_time_output =
-      new boost::posix_time::time_facet();
-  std::locale special_locale(std::locale("C"), p_time_output);
-  // special_locale takes ownership of the p_time_output facet
-  time.imbue(special_locale);
-  p_time_output->format("%d.%m %H:%M:%S");
-  time << boost::posix_time::second_clock::local_time();
-
-  // Determine type.
-  std::string type_str;
-  switch(type) {
-    case BS_LOG_DBG: type_str = "[DEBUG]"; break;
-    case BS_LOG_NFO: type_str = "[INFO ]"; break;
-    case BS_LOG_ERR: type_str = "[ERROR]"; break;
-  }
-
-  // Build log string.
-  std::stringstream msg;
-  msg << type_str << "[" << time.str() << "]["\
-      << std::left << std::setw(20) << identifier_
-      << "][" << std::left << std::setw(8) << source << "] " << message << "\n";
-
-  // Store log message.
-  if (log_msgs_.size() > MAX_LOG_SIZE) {
-    log_msgs_.pop_front();
-  }
-  log_msgs_.push_back(msg.str());
+  if (!log_enabled(type, source)) {
+    return;
+  }
+
+  // Stored unformatted, formatted for the update callback only.
+  log_.push(type, source, message);
   if (update_callback_ != nullptr) {
-    update_callback_(identifier_, "log", msg.str());
+    update_callback_(identifier_, "log",
+                     log_.line(type, identifier_, source, message));
   }
 }
 
 std::string bot::log_msgs() {
-  std::stringstream log;
-  for(const std::string& msg : log_msgs_) {
-    log << msg;
+  return log_.str(identifier_);
+}
+
+bool bot::log_enabled(int type, const std::string& source) const {
+#ifdef BS_STRIP_DEBUG_LOG
+  if (type == BS_LOG_DBG) {
+    return false;
   }
-  return log.str();
+#endif
+
+  if (!module_log_levels_.empty()) {
+    auto it = module_log_levels_.find(source);
+    if (it != module_log_levels_.end()) {
+      return type >= it->second;
+    }
+  }
+  return type >= (log_level_ >= 0 ? log_level_ : log_level_default_.load());
+}
+
+void bot::log_level(int level) {
+  log_level_default_ = std::max<int>(BS_LOG_DBG,
+                                     std::min<int>(BS_LOG_ERR, level));
+}
+
+int bot::parse_log_level(const std::string& level) {
+  if (level == "debug" || level == "0") {
+    return BS_LOG_DBG;
+  } else if (level == "info" || level == "1") {
+    return BS_LOG_NFO;
+  } else if (level == "error" || level == "2") {
+    return BS_LOG_ERR;
+  }
+  return -1;
+}
+
+void bot::set_log_level(const std::string& module, const std::string& level) {
+  // An empty level resets the module to the bot's level.
+  bool bot_level = module == "base" || module == "global";
+  int l = parse_log_level(level);
+  if (l < 0 && (bot_level || !level.empty())) {
+    log(BS_LOG_ERR, "base", "invalid log level ", level);
+    return;
+  }
+
+  if (bot_level) {
+    log_level_ = l;
+  } else if (l < 0) {
+    module_log_levels_.erase(module);
+  } else {
+    module_log_levels_[module] = l;
+  }
+  status((bot_level ? std::string("base") : module) + "_log_level", level);
+}
+
+void bot::load_log_levels() {
+  log_level_ = -1;
+  module_log_levels_.clear();
+
+  const std::string* level = configuration_->find("base", "log_level");
+  if (level != nullptr) {
+    log_level_ = parse_log_level(*level);
+  }
+  for (const auto& m : package_->modules()) {
+    level = configuration_->find(m.first, "log_level");
+    int l = level != nullptr ? parse_log_level(*level) : -1;
+    if (l >= 0) {
+      module_log_levels_[m.first] = l;
+    }
+  }
+}
+
+std::string bot::status_of(const std::string& key) const {
+  auto buffered = batch_status_.find(key);
+  if (buffered != batch_status_.end()) {
+    return buffered->second;
+  }
+  return configuration_->value_of(key);
 }
 
 void bot::refresh_status(const std::string& key) {
+  auto buffered = batch_status_.find(key);
+  if (buffered != batch_status_.end()) {
+    return;
+  }
+
   std::string value = configuration_->value_of(key);
+
+  // Statuses of modules that were not instantiated: package defaults.
+  auto pos = key.find("_");
+  if (value.empty() && pos != std::string::npos && package_ != nullptr) {
+    auto defaults = package_->status_defaults(key.substr(0, pos));
+    if (defaults != nullptr) {
+      auto it = defaults->find(key.substr(pos + 1));
+      if (it != defaults->end()) {
+        value = it->second;
+      } else if (key.substr(pos + 1) == "active") {
+        value = "0";
+      }
+    }
+  }
   if (update_callback_ != nullptr) {
     update_callback_(identifier_, key, value);
   }
@@ -357,7 +680,13 @@ void bot::refresh_status(const std::string& key) {
 }
 
 void bot::status(std::string const& key, std::string const& value) {
+  if (batch_depth_ > 0) {
+    batch_status_[key] = value;
+    return;
+  }
+
   configuration_->set(key, value);
+  index_dependency(key, value);
   if (update_callback_ == nullptr) {
     return;
   }
@@ -368,29 +697,61 @@ void bot::status(std::string const& key, std::string const& value) {
 void bot::check_and_update_shared_if_needed(std::string const& key,
                                             std::string const& value) {
   auto pos = key.find("_");
-  if (pos == std::string::npos && key.substr(0, pos) == "shared") {
+  if (pos != std::string::npos && key.substr(0, pos) == "shared") {
     update_shared(key.substr(pos + 1), value);
   }
 }
 
-std::vector<std::string> bot::get_dependent_variables(
-    std::string const& key) const {
-  std::vector<std::string> updates;
-
-  std::string s1 = std::string("$") + key;
-  std::string s2 = std::string("^") + key;
-  auto module_states = configuration_->module_settings();
-  for (auto const& module : module_states) {
-    for (const auto& setting : module.second) {
-      if (setting.second != s1 && setting.second != s2) {
-        continue;
-      }
+void bot::write(const std::string& module, const std::string& setting,
+                const std::string& value) {
+  configuration_->set(module, setting, value);
+  index_dependency(module + "_" + setting, value);
+}
+
+void bot::index_dependency(const std::string& full_key,
+                           const std::string& value) {
+  bool reference = value.size() > 1 && (value[0] == '$' || value[0] == '^');
 
-      updates.emplace_back(module.first + "_" + setting.first);
+  // Forget the old reference (unless it stays the same).
+  auto old = depends_on_.find(full_key);
+  if (old != depends_on_.end()) {
+    if (reference && value.compare(1, std::string::npos, old->second) == 0) {
+      return;
+    }
+    auto dependents = dependents_.find(old->second);
+    dependents->second.erase(full_key);
+    if (dependents->second.empty()) {
+      dependents_.erase(dependents);
     }
+    depends_on_.erase(old);
   }
 
-  return updates;
+  if (reference) {
+    std::string shared = value.substr(1);
+    dependents_[shared].insert(full_key);
+    depends_on_[full_key] = std::move(shared);
+  }
+}
+
+void bot::index_dependencies() {
+  dependents_.clear();
+  depends_on_.clear();
+  configuration_->visit([this](const std::string& module,
+                               const std::string& setting,
+                               const std::string& value) {
+    if (value.size() > 1 && (value[0] == '$' || value[0] == '^')) {
+      index_dependency(module + "_" + setting, value);
+    }
+  });
+}
+
+std::vector<std::string> bot::get_dependent_variables(
+    std::string const& key) const {
+  auto it = dependents_.find(key);
+  if (it == dependents_.end()) {
+    return std::vector<std::string>();
+  }
+  return std::vector<std::string>(it->second.begin(), it->second.end());
 }
 
 void bot::update_shared(std::string const& key, std::string const& value) {
@@ -398,118 +759,442 @@ void bot::update_shared(std::string const& key, std::string const& value) {
     return;
   }
 
-  for (auto const& var : get_dependent_variables(key)) {
+  auto it = dependents_.find(key);
+  if (it == dependents_.end()) {
+    return;
+  }
+  for (auto const& var : it->second) {
     update_callback_(identifier_, var, value);
   }
 }
 
+void bot::set_shared(std::string const& key, std::string const& value) {
+  write("shared", key, value);
+  update_shared(key, value);
+}
+
 std::map<std::string, std::string> bot::update_all_shared() const {
   std::map<std::string, std::string> updates;
 
-  auto module_settings = configuration_->module_settings();
-  auto shared_module_it = module_settings.find("shared");
-  if (shared_module_it == module_settings.end()) {
-    return updates;
-  }
-
-  for (auto const& shared : shared_module_it->second) {
-    for (auto const& dependent_var : get_dependent_variables(shared.first)) {
-      updates[dependent_var] = shared.second;
+  for (auto const& shared : dependents_) {
+    const std::string* value = configuration_->find("shared", shared.first);
+    if (value == nullptr) {
+      continue;
+    }
+    for (auto const& dependent_var : shared.second) {
+      updates[dependent_var] = *value;
     }
   }
 
   return updates;
 }
 
-void bot::execute(std::string command, const std::string& argument) {
+void bot::hibernate_after(int seconds) {
+  hibernate_after_ = std::max(0, seconds);
+}
+
+bool bot::hibernated() const {
+  return hibernated_;
+}
+
+void bot::hibernate() {
   auto self = shared_from_this();
-  io_service_->post([=]() mutable {
-    // Handle shared value replacement.
-    auto pos = command.find("_set_");
-    if (pos != std::string::npos) {
-      std::string module = command.substr(0, pos);
-      std::string setting = command.substr(pos + 5);
-      std::string old_val = configuration_->module_settings()[module][setting];
-      if (old_val.length() != 0 && old_val[0] == '^') {
-        command = "shared_set_" + old_val.substr(1);
+  strand_.post([this, self]() {
+    // Only idle bots hibernate.
+    if (hibernated_ || waking_ || nullptr != login_cb_ || proxy_check_active_ ||
+        nullptr == browser_) {
+      return;
+    }
+    for (const auto& m : modules_) {
+      if (!m.second->idle()) {
+        return;
       }
     }
 
-    // Handle wait time factor command.
-    if (command == "base_set_wait_time_factor") {
-      std::string new_wait_time_factor = argument;
-      if (new_wait_time_factor.find(".") == std::string::npos) {
-        new_wait_time_factor += ".0";
-      }
+    log(BS_LOG_NFO, "base", "hibernating");
+    idle_timer_.cancel();
+    modules_.clear();
+    browser_.reset();
+    package_.reset();
+    log_.clear();
+    hibernated_ = true;
+  });
+}
+
+void bot::footprint_budget(std::size_t bytes) {
+  footprint_budget_ = bytes;
+}
 
-      try {
-        float new_wtf = boost::lexical_cast<float>(new_wait_time_factor);
-        if (wait_time_factor_ <= 0) {
-          log(BS_LOG_ERR, "base",
-              std::string("invalid value for wait time factor"));
+void bot::write_behind(int interval_ms, std::size_t max_pending) {
+  write_behind_ms_ = std::max(0, interval_ms);
+  write_behind_max_ = std::max<std::size_t>(1, max_pending);
+}
+
+void bot::collect_footprints(std::function<void (fleet_footprint)> cb) {
+  // Shared by the collecting handlers: the last one calls the callback.
+  struct collection {
+    boost::mutex mutex;
+    fleet_footprint fleet;
+    std::size_t remaining;
+  };
+
+  std::vector<std::shared_ptr<bot>> bots = lua_connection::bots();
+  if (bots.empty()) {
+    return cb(fleet_footprint());
+  }
+
+  auto c = std::make_shared<collection>();
+  c->remaining = bots.size();
+  for (const auto& b : bots) {
+    b->strand_.post([b, c, cb]() {
+      footprint f = b->memory_footprint();
+      b->enforce_budget(f);
+
+      fleet_footprint fleet;
+      {
+        boost::lock_guard<boost::mutex> lock(c->mutex);
+        c->fleet[b->identifier_] = f;
+        if (--c->remaining != 0) {
           return;
         }
-        wait_time_factor_ = new_wtf;
-        std::stringstream ss;
-        ss << std::setprecision(3) << new_wait_time_factor;
-        std::string wtf = ss.str();
-        status("base_wait_time_factor", ss.str());
-        log(BS_LOG_NFO, "base", std::string("set wait time factor to ") + wtf);
-        return;
-      } catch(const boost::bad_lexical_cast&) {
-        log(BS_LOG_ERR, "base", std::string("could not read wait time factor"));
-        status("base_wait_time_factor",
-            boost::lexical_cast<std::string>(wait_time_factor_));
-        return;
+        fleet.swap(c->fleet);
       }
+      cb(std::move(fleet));
+    });
+  }
+}
+
+bot::footprint bot::memory_footprint() const {
+  footprint f;
+  f.settings = configuration_->settings_footprint();
+  f.cookies = configuration_->cookies_footprint();
+  f.log = log_.footprint();
+  if (nullptr != browser_) {
+    f.browser = browser_->footprint();
+  }
+  for (const auto& m : modules_) {
+    m.second->footprint(&f.lua, &f.responses);
+  }
+
+  // Routes: hash node with the pair key + entry with its status key.
+  f.commands = routes_.bucket_count() * sizeof(void*);
+  for (const auto& r : routes_) {
+    f.commands += 2 * sizeof(void*) + sizeof(std::uint64_t) +
+                  sizeof(route_entry) - sizeof(std::string) +
+                  footprint_of(r.second.status_key);
+  }
+  f.commands += footprint_of(dependents_) + footprint_of(depends_on_) +
+                footprint_of(batch_status_) + footprint_of(wake_commands_);
+  return f;
+}
+
+void bot::enforce_budget(const footprint& f) {
+  std::size_t budget = footprint_budget_;
+  if (budget == 0 || f.total() <= budget) {
+    return;
+  }
+
+  log(BS_LOG_NFO, "base", "footprint ", f.total(), " exceeds budget ", budget);
+
+  // Trim the log to the last messages (drops the formatted output).
+  log_.trim(MAX_LOG_SIZE / 10);
+  std::size_t log_size = log_.footprint();
+
+  if (f.total() - f.log + log_size <= budget) {
+    return;
+  }
+
+  // Hibernation only keeps the configuration and the command bookkeeping.
+  std::size_t kept = f.total() - f.releasable();
+  if (kept > budget) {
+    log(BS_LOG_NFO, "base", "footprint ", kept, " exceeds budget even when "
+        "hibernated, staying awake");
+    return;
+  }
+  hibernate();
+}
+
+void bot::wake_up(std::shared_ptr<bot> self) {
+  if (waking_) {
+    return;
+  }
+
+  // The package may have been reloaded meanwhile.
+  auto packages = bot::packages();
+  const auto package_it = packages->find(configuration_->package());
+  if (package_it == packages->end()) {
+    log(BS_LOG_ERR, "base", "wake up: package not found");
+    wake_commands_.clear();
+    return;
+  }
+  package_ = package_it->second;
+
+  log(BS_LOG_NFO, "base", "waking up");
+  waking_ = true;
+  connect(self, [this](std::shared_ptr<bot>, std::string err) {
+    waking_ = false;
+    if (!err.empty()) {
+      log(BS_LOG_ERR, "base", "wake up failed: ", err);
+      modules_.clear();
+      browser_.reset();
+      wake_commands_.clear();
+      return;
     }
 
-    // Handle set proxy command.
-    if (command == "base_set_proxy") {
-      if (proxy_check_active_) {
-        log(BS_LOG_ERR, "base", "another proxy check is currently active");
-        return;
-      }
+    hibernated_ = false;
 
-      proxy_check_active_ = true;
-      browser_->set_proxy_list(argument, [this, self](int success) {
-        if (!success) {
-          proxy_check_active_ = false;
-          log(BS_LOG_ERR, "base", "no new working proxy found");
-          refresh_status("base_proxy");
-        } else {
-          log(BS_LOG_NFO, "base", "login: 1. try");
-          command_sequence commands;
-          auto cb = [this](std::shared_ptr<bot>, std::string err) {
-            if (!err.empty()) log(BS_LOG_ERR, "base", err);
-            proxy_check_active_ = false;
-            refresh_status("base_proxy");
-          };
-          auto state = std::make_shared<state_wrapper>();
-          login_cb_ = boost::bind(&bot::handle_login, this,
-                                  self, state, _1, cb, commands, false, 2);
-          lua_connection::login(
-              state->get(), self,
-              package_->modules().find("base")->second,
-              &login_cb_);
-        }
-      });
+    begin_batch();
+    for (const auto& command : wake_commands_) {
+      route(command.first, command.second);
     }
+    end_batch();
+    command_sequence().swap(wake_commands_);
+
+    last_activity_ = boost::posix_time::second_clock::universal_time();
+    arm_idle_timer();
+  }, configuration_->init_command_sequence());
+}
+
+void bot::arm_idle_timer() {
+  int timeout = hibernate_after_;
+  if (timeout <= 0) {
+    return;
+  }
 
-    std::string shared_set = "shared_set_";
-    if (boost::starts_with(command, shared_set)) {
-      std::string key = command.substr(shared_set.length());
-      log(BS_LOG_DBG, "shared", "updating shared variable " + key);
-      configuration_->set("shared", key, argument);
-      update_shared(key, argument);
+  auto self = shared_from_this();
+  idle_timer_.expires_from_now(boost::posix_time::seconds(timeout));
+  idle_timer_.async_wait(strand_.wrap(
+      [this, self, timeout](const boost::system::error_code& ec) {
+    if (ec || hibernated_) {
       return;
     }
 
-    // Forward all other commands to modules.
-    for (auto module : modules_) {
-      module->execute(command, argument);
+    enforce_budget(memory_footprint());
+
+    auto idle = boost::posix_time::second_clock::universal_time()
+                - last_activity_;
+    if (configuration_->inactive() || idle.total_seconds() >= timeout) {
+      hibernate();
+    }
+    arm_idle_timer();
+  }));
+}
+
+void bot::execute(std::string command, const std::string& argument) {
+  auto self = shared_from_this();
+  strand_.post([=]() {
+    if (hibernated_) {
+      wake_commands_.emplace_back(command, argument);
+      return wake_up(self);
+    }
+    route(command, argument);
+  });
+}
+
+void bot::execute_batch(command_sequence commands) {
+  auto self = shared_from_this();
+  strand_.post([this, self, commands]() {
+    if (hibernated_) {
+      wake_commands_.insert(wake_commands_.end(),
+                            commands.begin(), commands.end());
+      return wake_up(self);
+    }
+
+    begin_batch();
+    for (const auto& command : commands) {
+      route(command.first, command.second);
     }
+    end_batch();
   });
 }
 
+void bot::begin_batch() {
+  ++batch_depth_;
+}
+
+void bot::end_batch() {
+  if (--batch_depth_ > 0 || batch_status_.empty()) {
+    return;
+  }
+
+  std::map<std::string, std::string> changes;
+  changes.swap(batch_status_);
+  configuration_->set_batch(changes);
+  for (const auto& change : changes) {
+    index_dependency(change.first, change.second);
+  }
+
+  if (batch_update_callback_ != nullptr) {
+    batch_update_callback_(identifier_, changes);
+  } else if (update_callback_ != nullptr) {
+    for (const auto& change : changes) {
+      update_callback_(identifier_, change.first, change.second);
+    }
+  }
+
+  if (update_callback_ != nullptr) {
+    for (const auto& change : changes) {
+      check_and_update_shared_if_needed(change.first, change.second);
+    }
+  }
+}
+
+void bot::route(const std::string& command, const std::string& argument) {
+  last_activity_ = boost::posix_time::second_clock::universal_time();
+
+  // Parse "{module}_set_{setting}".
+  boost::string_ref c(command);
+  auto pos = c.find("_set_");
+  if (pos == boost::string_ref::npos) {
+    BS_DBG(this, "base", "ignoring command ", command);
+    return;
+  }
+  unknown_route unknown;
+  const route_entry* r = &route_of(c.substr(0, pos), c.substr(pos + 5),
+                                   &unknown);
+
+  // Handle shared value replacement (buffered values are newer).
+  const std::string* old_val = nullptr;
+  if (!batch_status_.empty()) {
+    auto buffered = batch_status_.find(r->status_key);
+    if (buffered != batch_status_.end()) {
+      old_val = &buffered->second;
+    }
+  }
+  if (old_val == nullptr) {
+    old_val = configuration_->find(*r->module, *r->setting);
+  }
+  if (old_val != nullptr && !old_val->empty() && (*old_val)[0] == '^') {
+    r = &route_of("shared", boost::string_ref(*old_val).substr(1), &unknown);
+  }
+
+  const std::string& module = *r->module;
+  const std::string& setting = *r->setting;
+  switch (r->kind) {
+    case route_kind::LOG_LEVEL:
+      return set_log_level(module, argument);
+
+    case route_kind::BASE:
+      return set_base(setting, argument);
+
+    case route_kind::SHARED:
+      BS_DBG(this, "shared", "updating shared variable ", setting);
+      return set_shared(setting, argument);
+
+    // Broadcast global settings to all modules.
+    case route_kind::GLOBAL:
+      for (const auto& m : package_->modules()) {
+        apply(m.first, setting, argument);
+      }
+      return;
+
+    // Forward all other commands to their module.
+    case route_kind::MODULE:
+      return apply(module, setting, argument);
+  }
+}
+
+const bot::route_entry& bot::route_of(boost::string_ref module,
+                                      boost::string_ref setting,
+                                      unknown_route* unknown) {
+  key_pool::id module_id, setting_id;
+  bool interned = key_pool::find(module, &module_id) &&
+                  key_pool::find(setting, &setting_id);
+  if (interned) {
+    auto it = routes_.find(key_pool::pair(module_id, setting_id));
+    if (it != routes_.end()) {
+      return it->second;
+    }
+  }
+
+  route_entry* r = unknown;
+  route_entry cached;
+  if (interned) {
+    cached.module = &key_pool::str(module_id);
+    cached.setting = &key_pool::str(setting_id);
+    r = &cached;
+  } else {
+    unknown->module_name.assign(module.data(), module.size());
+    unknown->setting_name.assign(setting.data(), setting.size());
+    unknown->module = &unknown->module_name;
+    unknown->setting = &unknown->setting_name;
+  }
+
+  r->status_key = *r->module + "_" + *r->setting;
+  if (setting == "log_level") {
+    r->kind = route_kind::LOG_LEVEL;
+  } else if (module == "base") {
+    r->kind = route_kind::BASE;
+  } else if (module == "shared") {
+    r->kind = route_kind::SHARED;
+  } else if (module == "global") {
+    r->kind = route_kind::GLOBAL;
+  } else {
+    r->kind = route_kind::MODULE;
+  }
+
+  if (!interned) {
+    return *unknown;
+  }
+  return routes_.emplace(key_pool::pair(module_id, setting_id),
+                         std::move(cached)).first->second;
+}
+
+void bot::set_base(const std::string& setting, const std::string& argument) {
+  // Handle wait time factor command.
+  if (setting == "wait_time_factor") {
+    std::string new_wait_time_factor = argument;
+    if (new_wait_time_factor.find(".") == std::string::npos) {
+      new_wait_time_factor += ".0";
+    }
+
+    try {
+      float new_wtf = boost::lexical_cast<float>(new_wait_time_factor);
+      if (wait_time_factor_ <= 0) {
+        log(BS_LOG_ERR, "base",
+            std::string("invalid value for wait time factor"));
+        return;
+      }
+      wait_time_factor_ = new_wtf;
+      std::stringstream ss;
+      ss << std::setprecision(3) << new_wait_time_factor;
+      std::string wtf = ss.str();
+      status("base_wait_time_factor", ss.str());
+      log(BS_LOG_NFO, "base", std::string("set wait time factor to ") + wtf);
+      return;
+    } catch(const boost::bad_lexical_cast&) {
+      log(BS_LOG_ERR, "base", std::string("could not read wait time factor"));
+      status("base_wait_time_factor",
+          boost::lexical_cast<std::string>(wait_time_factor_));
+      return;
+    }
+  }
+
+  // Handle set proxy command.
+  if (setting == "proxy") {
+    if (proxy_check_active_) {
+      log(BS_LOG_ERR, "base", "another proxy check is currently active");
+      return;
+    }
+
+    auto self = shared_from_this();
+    proxy_check_active_ = true;
+    browser_->set_proxy_list(argument, [this, self](int success) {
+      if (!success) {
+        proxy_check_active_ = false;
+        log(BS_LOG_ERR, "base", "no new working proxy found");
+        refresh_status("base_proxy");
+      } else {
+        command_sequence commands;
+        auto cb = [this](std::shared_ptr<bot>, std::string err) {
+          if (!err.empty()) log(BS_LOG_ERR, "base", err);
+          proxy_check_active_ = false;
+          refresh_status("base_proxy");
+        };
+        start_login(self, cb, commands, false);
+      }
+    });
+  }
+}
+
 }  // namespace botscript
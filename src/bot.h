@@ -9,19 +9,27 @@
 
 #include <string>
 #include <set>
+#include <unordered_map>
 #include <utility>
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <sstream>
 
 #include "boost/utility.hpp"
 #include "boost/asio/io_service.hpp"
+#include "boost/asio/strand.hpp"
 
 #include "./bot_browser.h"
 #include "./module.h"
 #include "./lua/state_wrapper.h"
 #include "./package.h"
 #include "./bot_config.h"
+#include "./key_pool.h"
+#include "./log_ring.h"
+#include "./timing_wheel.h"
+#include "./wakeup_scheduler.h"
 
 namespace botscript {
 
@@ -40,6 +48,43 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// Update callback: called when the bot status changed or for log messages.
   typedef std::function<void (std::string, std::string, std::string)> upd_cb;
 
+  /// Batch update callback: called once with all status changes (key ->
+  /// value) of a command batch.
+  typedef std::function<void (std::string, std::map<std::string, std::string>)>
+      upd_batch_cb;
+
+  /// Approximate memory held by a bot (in bytes).
+  struct footprint {
+    footprint()
+      : settings(0), cookies(0), log(0), browser(0), responses(0), lua(0),
+        commands(0) {
+    }
+
+    /// \return the sum of all parts
+    std::size_t total() const {
+      return settings + cookies + log + browser + responses + lua + commands;
+    }
+
+    /// \return the part released by hibernation
+    std::size_t releasable() const {
+      return log + browser + responses + lua;
+    }
+
+    std::size_t settings;   ///< module settings (bot_config)
+    std::size_t cookies;    ///< cookies (bot_config)
+    std::size_t log;        ///< log messages
+    std::size_t browser;    ///< headers, cookies, proxy lists, request queue
+    std::size_t responses;  ///< responses held by lua views
+    std::size_t lua;        ///< lua heaps of the running modules
+    std::size_t commands;   ///< routes, dependencies, pending commands
+  };
+
+  /// Fleet footprint: bot identifier -> footprint.
+  typedef std::map<std::string, footprint> fleet_footprint;
+
+  /// Package name to package mapping.
+  typedef std::map<std::string, std::shared_ptr<package>> package_map;
+
   /// Callback function for asynchronous actions.
   /// Provides the error message if an error was thrown. The error string is
   /// empty for operations that were completed successfuly.
@@ -47,6 +92,8 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
 
   /// Creates a new bot. The bot needs to be initialized
   /// by a seperate call to bot::init() to be ready for usage.
+  /// If the io_service is run by multiple threads, init() has to be called
+  /// before the io_service runs or from within the strand of the bot.
   ///
   /// \param io_service          the boost asio io_service object
   explicit bot(boost::asio::io_service* io_service);
@@ -57,6 +104,47 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// Starts the shutdown process of the bot (remove shared references, ...)
   void shutdown();
 
+  /// Sets the idle time after which initialized bots hibernate if none of
+  /// their modules is running. Inactive bots hibernate at the next check.
+  ///
+  /// \param seconds the idle time in seconds (0 = don't hibernate)
+  static void hibernate_after(int seconds);
+
+  /// Hibernates the bot if none of its modules is running: releases the
+  /// browser, the modules and the log messages. The bot keeps its
+  /// configuration only. The next execute() wakes it up (login, modules
+  /// initialized from the configuration) and is applied afterwards.
+  void hibernate();
+
+  /// \return whether the bot is hibernated
+  bool hibernated() const;
+
+  /// Sets the soft memory budget per bot. Bots exceeding it trim their log
+  /// messages and hibernate if this is not enough. Checked whenever the
+  /// footprint is collected (fleet snapshot, idle check).
+  ///
+  /// \param bytes the budget in bytes (0 = no budget)
+  static void footprint_budget(std::size_t bytes);
+
+  /// Enables write-behind buffering for bots initialized afterwards: config
+  /// writes (status changes, cookies) are coalesced in memory and flushed
+  /// to the configuration passed to init() at the latest after the given
+  /// interval, when max_pending writes are pending or on shutdown().
+  ///
+  /// \param interval_ms  the flush interval in milliseconds (0 = disabled)
+  /// \param max_pending  the number of pending writes forcing a flush
+  static void write_behind(int interval_ms, std::size_t max_pending);
+
+  /// Collects the footprints of all registered bots (each in its strand).
+  ///
+  /// \param cb the callback to call with the fleet footprint
+  static void collect_footprints(std::function<void (fleet_footprint)> cb);
+
+  /// Has to be called within the strand.
+  ///
+  /// \return the current footprint of this bot
+  footprint memory_footprint() const;
+
   /// Initialization function:
   ///
   ///   * Loads the bot configuration
@@ -70,6 +158,24 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// \param cb the callback to call when the operation has finished
   void init(std::shared_ptr<bot_config> configuration, const error_cb& cb);
 
+  /// Restores a bot from a checkpoint (see fleet_checkpoint) without logging
+  /// in: the browser uses the cookies of the configuration and the given
+  /// (already checked) proxies. If the package's login check confirms that
+  /// the session is still valid, the modules are loaded right away.
+  /// Otherwise (or if the session can't be checked) the bot connects like
+  /// with init() (proxy check, login). Same preconditions as init().
+  ///
+  /// \param configuration the restored configuration
+  /// \param proxies       the proxies that passed the check
+  /// \param cb            the callback to call when the modules are loaded
+  void restore(std::shared_ptr<bot_config> configuration,
+               const std::vector<std::string>& proxies, const error_cb& cb);
+
+  /// Has to be called within the strand.
+  ///
+  /// \return the proxies that passed the check (empty if hibernated)
+  std::vector<std::string> proxies() const;
+
   /// Creates a unique identifier with the given information.
   ///
   /// \param username the bot username
@@ -101,17 +207,42 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// \return the webclient
   bot_browser* browser();
 
-  /// Loads the packages located at the given path into packages_ after clearing
-  /// the packages_ map. Since packages are stored wrapped by shared_ptrs,
-  /// the bots using old packages won't suffer from this.
+  /// All handlers of a bot (module timers, browser callbacks, Lua callbacks
+  /// and executed commands) are run through this strand. This way, the
+  /// io_service can be run by multiple threads without locking in the bot.
+  ///
+  /// \return the strand of this bot
+  boost::asio::io_service::strand* strand();
+
+  /// Loads the packages located at the given path into a new package map
+  /// and replaces packages_ atomically. Since packages are stored wrapped by
+  /// shared_ptrs, the bots using old packages won't suffer from this.
   ///
   /// \param path the path to load the packages from
   static void load_packages(const std::string& path);
 
+  /// Safe to call from any thread (or shard) concurrently to load_packages.
+  ///
+  /// \return the currently loaded packages
+  static std::shared_ptr<const package_map> packages();
+
   /// \return a random wait time between min and max (multiplied with the wtf).
   int random(int a, int b);
 
-  /// \return all log messages in one string.
+  /// Plans a module wakeup with the wakeup_scheduler of the io_service.
+  ///
+  /// \param a the minimum wait time
+  /// \param b the maximum wait time (the window is multiplied with the wtf)
+  /// \param planned the reservation to write (see cancel_wakeup())
+  /// \return the wait time in seconds
+  int wakeup(int a, int b, wakeup_scheduler::reservation* planned);
+
+  /// Gives the reservation of a cancelled module wakeup back.
+  ///
+  /// \param planned the reservation written by wakeup()
+  void cancel_wakeup(wakeup_scheduler::reservation planned);
+
+  /// \return all log messages in one string (cached until the next message)
   std::string log_msgs();
 
   /// Logs a log message.
@@ -121,7 +252,41 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// \param message the message to log
   void log(int type, const std::string& source, const std::string& message);
 
+  /// Logs a message concatenated from the given parts. The parts are only
+  /// formatted if the level is enabled for the source:
+  ///
+  ///   log(BS_LOG_NFO, module_name, "sleeping ", seconds);
+  ///
+  /// \param type the log level
+  /// \param source the logging source (module)
+  /// \param parts the message parts (anything writable to an ostream)
+  template <typename A, typename B, typename... Parts>
+  void log(int type, const std::string& source,
+           const A& a, const B& b, const Parts&... parts);
+
+  /// Debug messages are never enabled if BS_STRIP_DEBUG_LOG is defined.
+  ///
+  /// \param type the log level
+  /// \param source the logging source (module)
+  /// \return whether messages of this level and source are logged
+  bool log_enabled(int type, const std::string& source) const;
+
+  /// Sets the log level of bots that have no own level ("base_log_level").
+  ///
+  /// \param level the minimum level to log (BS_LOG_DBG logs everything)
+  static void log_level(int level);
+
+  /// \param level the log level name (debug, info, error) or number
+  /// \return the log level or -1 if the name is unknown
+  static int parse_log_level(const std::string& level);
+
+  /// \param key the status key
+  /// \return the current status value (including buffered batch changes)
+  std::string status_of(const std::string& key) const;
+
   /// Calls the callback function with the current value of the key.
+  /// Statuses of modules that were not instantiated fall back to the package
+  /// status defaults.
   ///
   /// \param key the key to refresh
   void refresh_status(const std::string& key);
@@ -133,6 +298,7 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   void status(const std::string& key, const std::string& value);
 
   /// Gathers all variable updates for a shared variable: shared_${key}.
+  /// Looked up in the reverse dependency index (O(dependents)).
   ///
   /// \param key    the key of the shared variable
   /// \param value  the value of the shared variable
@@ -154,9 +320,16 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// \param value  the new value
   void update_shared(std::string const& key, std::string const& value);
 
+  /// Sets a shared variable and updates the variables depending on it.
+  /// Has to be called within the strand.
+  ///
+  /// \param key    the key of the shared variable (without "shared_")
+  /// \param value  the new value
+  void set_shared(std::string const& key, std::string const& value);
+
   /// Updates all variables that depend on a shared variables:
-  /// Loops over the shared variables, searches for dependent variables and
-  /// triggers the update_callback_ for each.
+  /// Loops over the indexed shared variables and collects the values of
+  /// their dependent variables.
   std::map<std::string, std::string> update_all_shared() const;
 
   /// Checks if the mentioned key is a shared variable and updates all dependent
@@ -171,20 +344,219 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// \param argument  command argument
   void execute(std::string command, const std::string& argument);
 
+  /// Executes all commands in one handler. Status changes are coalesced,
+  /// written to the configuration in one batch and notified once (with the
+  /// batch update callback if set, with the update callback otherwise).
+  ///
+  /// \param commands  the commands to execute
+  void execute_batch(command_sequence commands);
+
   /// This is the update/status change callback.
   upd_cb update_callback_;
 
-  /// Packages.
-  static std::map<std::string, std::shared_ptr<package>> packages_;
+  /// Status change callback for batches (optional).
+  upd_batch_cb batch_update_callback_;
 
  private:
-  /// Loads the lua modules located at package_. This includes only files that
-  /// end on ".lua", don't start with '.' and are not named 'servers.lua' or
-  /// 'base.lua'. Executes the given command sequence to initialize the modules.
+  /// Packages (copy on write, accessed with std::atomic_load/atomic_store).
+  static std::shared_ptr<const package_map> packages_;
+
+  /// Idle time in seconds until bots hibernate (0 = never).
+  static std::atomic<int> hibernate_after_;
+
+  /// Soft memory budget per bot in bytes (0 = none).
+  static std::atomic<std::size_t> footprint_budget_;
+
+  /// Write-behind flush interval in milliseconds (0 = disabled) and the
+  /// number of pending writes forcing a flush.
+  static std::atomic<int> write_behind_ms_;
+  static std::atomic<std::size_t> write_behind_max_;
+
+  /// Log level of bots without an own level.
+  static std::atomic<int> log_level_default_;
+
+  /// Sets the log level of the bot ("base" or "global") or of a module
+  /// (an empty level makes the module use the bot's level again).
+  ///
+  /// \param module the module name
+  /// \param level the log level name or number
+  void set_log_level(const std::string& module, const std::string& level);
+
+  /// Reads the bot and module log levels from the configuration.
+  void load_log_levels();
+
+  /// Executes the given command sequence to initialize the modules (in one
+  /// batch). Only modules that get activated are instantiated.
   ///
   /// \param init_commands the initialization commands
-  void load_modules(const command_sequence& init_commands,
-                    std::shared_ptr<bot> self);
+  void load_modules(const command_sequence& init_commands);
+
+  /// Creates the module with the given name from the package scripts
+  /// (not base or servers) and adds it to modules_.
+  ///
+  /// \param name the module name
+  /// \return the module or nullptr if it could not be loaded
+  std::shared_ptr<module> instantiate(const std::string& name);
+
+  /// Applies a module setting. Modules that are not instantiated only store
+  /// their settings (as status) until they get activated.
+  ///
+  /// \param name      the module name
+  /// \param setting   the setting to change
+  /// \param argument  the new value
+  void apply(const std::string& name, const std::string& setting,
+             const std::string& argument);
+
+  /// Routes a command ("{module}_set_{setting}") to its target: base and
+  /// shared settings are handled by the bot, global settings are broadcast
+  /// to all modules, module settings are applied by the target module only.
+  /// Has to be called within the strand.
+  ///
+  /// \param command   command to execute
+  /// \param argument  command argument
+  void route(const std::string& command, const std::string& argument);
+
+  /// Target of a routed command.
+  enum class route_kind { LOG_LEVEL, BASE, SHARED, GLOBAL, MODULE };
+
+  /// A routed (module, setting) pair.
+  struct route_entry {
+    route_kind kind;
+    const std::string* module;
+    const std::string* setting;
+
+    /// Status key "{module}_{setting}" (to look up buffered statuses).
+    std::string status_key;
+  };
+
+  /// Route of names that are not interned (holds its names, not cached).
+  struct unknown_route : public route_entry {
+    std::string module_name;
+    std::string setting_name;
+  };
+
+  /// Looks up the route of a (module, setting) pair. Routes of interned
+  /// names are cached on first use. Other names are not interned (commands
+  /// may carry arbitrary names): their route is written to unknown.
+  ///
+  /// \param module   the module name
+  /// \param setting  the setting name
+  /// \param unknown  the route to fill if a name is not interned
+  /// \return the route (cached routes stay valid)
+  const route_entry& route_of(boost::string_ref module,
+                              boost::string_ref setting,
+                              unknown_route* unknown);
+
+  /// Sets the configuration, the package and the identifier and registers
+  /// the bot.
+  ///
+  /// \param configuration the configuration to use
+  /// \param cb            called with an error if the bot already exists
+  /// \return whether the bot was registered
+  /// \throws std::runtime_error if the package is not available
+  bool attach(std::shared_ptr<bot_config> configuration, const error_cb& cb);
+
+  /// \param cb the init callback to wrap
+  /// \return the callback that starts watching for idleness before calling cb
+  error_cb started(const error_cb& cb);
+
+  /// Creates the browser (cookies and proxy from the configuration) and
+  /// starts the login.
+  ///
+  /// \param self      shared pointer to self to keep us in mind
+  /// \param cb        the callback to call on login finish
+  /// \param commands  the commands to initialize the modules with
+  void connect(std::shared_ptr<bot> self, const error_cb& cb,
+               const command_sequence& commands);
+
+  /// Wakes up the hibernated bot: logs in again, loads the modules from the
+  /// configuration and applies the commands received meanwhile.
+  /// Has to be called within the strand.
+  ///
+  /// \param self  shared pointer to self to keep us in mind
+  void wake_up(std::shared_ptr<bot> self);
+
+  /// Starts the timer checking whether the bot is idle.
+  void arm_idle_timer();
+
+  /// Trims the log messages if the footprint exceeds the budget and
+  /// hibernates if this is not enough but releasing the browser, the modules
+  /// and the log is. Has to be called within the strand.
+  ///
+  /// \param f the current footprint
+  void enforce_budget(const footprint& f);
+
+  /// Starts buffering status changes (nestable).
+  void begin_batch();
+
+  /// Writes and notifies the buffered status changes if the outermost batch
+  /// ends.
+  void end_batch();
+
+  /// Applies a base setting (wait time factor, proxy).
+  ///
+  /// \param setting   the base setting
+  /// \param argument  the new value
+  void set_base(const std::string& setting, const std::string& argument);
+
+  /// Writes a setting to the configuration and updates the dependency
+  /// index. All configuration writes of the bot go through here (or
+  /// through index_dependency() for batches).
+  ///
+  /// \param module   the module name
+  /// \param setting  the setting name
+  /// \param value    the new value
+  void write(const std::string& module, const std::string& setting,
+             const std::string& value);
+
+  /// Updates the dependency index for a written setting: a value "$key" or
+  /// "^key" makes the setting depend on the shared variable key.
+  ///
+  /// \param full_key the setting ("{module}_{setting}")
+  /// \param value    the new value
+  void index_dependency(const std::string& full_key, const std::string& value);
+
+  /// Rebuilds the dependency index from the configuration.
+  void index_dependencies();
+
+  /// Starts the login as soon as the login_admission admits it. Checks the
+  /// stored session first if the package defines a login check.
+  ///
+  /// \param self           shared pointer to self to keep us in mind
+  /// \param cb             the callback to call on login finish
+  /// \param init_commands  the commands to call when the login finished
+  /// \param load_mod       whether to load the modules on success
+  void start_login(std::shared_ptr<bot> self, const error_cb& cb,
+                   const command_sequence& init_commands, bool load_mod);
+
+  /// Starts the full login (login function of the base script).
+  ///
+  /// \param self           shared pointer to self to keep us in mind
+  /// \param cb             the callback to call on login finish
+  /// \param init_commands  the commands to call when the login finished
+  /// \param load_mod       whether to load the modules on success
+  void full_login(std::shared_ptr<bot> self, const error_cb& cb,
+                  const command_sequence& init_commands, bool load_mod);
+
+  /// Called by handle_login_check() if the session is not logged in.
+  typedef std::function<void (std::shared_ptr<bot>)> expired_fn;
+
+  /// Session check callback (login and restore): finishes the login if the
+  /// session is still logged in, calls the expired action otherwise.
+  ///
+  /// \param self           shared pointer to self to keep us in mind
+  /// \param state_wr       the lua state that's executing the check
+  /// \param error          the error message (empty if no errors occured)
+  /// \param cb             the callback to call on login finish
+  /// \param init_commands  the commands to call when the login finished
+  /// \param load_mod       whether to load the modules on success
+  /// \param expired        the action if the session is not logged in
+  void handle_login_check(std::shared_ptr<bot> self,
+                          std::shared_ptr<state_wrapper> state_wr,
+                          const std::string& err,
+                          const error_cb& cb,
+                          const command_sequence& init_commands,
+                          bool load_mod, const expired_fn& expired);
 
   /// Login callback.
   std::function<void(std::string)> login_cb_;
@@ -192,6 +564,9 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// Boost Asio I/O service object.
   boost::asio::io_service* io_service_;
 
+  /// Strand serializing the handlers of this bot.
+  boost::asio::io_service::strand strand_;
+
   /// Bot configuration.
   std::shared_ptr<bot_config> configuration_;
 
@@ -201,14 +576,53 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   /// Bot identifier.
   std::string identifier_;
 
-  /// Modules.
-  std::vector<std::shared_ptr<module>> modules_;
+  /// Modules (module name -> module).
+  std::unordered_map<std::string, std::shared_ptr<module>> modules_;
+
+  /// Routes of the commands with interned names seen so far:
+  /// key_pool::pair(module id, setting id) -> route.
+  std::unordered_map<std::uint64_t, route_entry> routes_;
 
   /// Wait time factor.
   float wait_time_factor_;
 
-  /// List of log messages.
-  std::list<std::string> log_msgs_;
+  /// Batch nesting depth (status changes are buffered if > 0).
+  int batch_depth_;
+
+  /// Buffered status changes (key -> value).
+  std::map<std::string, std::string> batch_status_;
+
+  /// Reverse dependency index: shared key -> dependent settings.
+  std::unordered_map<std::string, std::set<std::string>> dependents_;
+
+  /// Dependent setting -> shared key it references.
+  std::unordered_map<std::string, std::string> depends_on_;
+
+  /// Timer checking whether the bot is idle.
+  wheel_timer idle_timer_;
+
+  /// Time of the last command.
+  boost::posix_time::ptime last_activity_;
+
+  /// Whether the bot is hibernated.
+  std::atomic<bool> hibernated_;
+
+  /// Whether the hibernated bot is being woken up.
+  bool waking_;
+
+  /// Commands received while hibernated.
+  command_sequence wake_commands_;
+
+  /// Random number generator (seeded independently for every bot).
+  wakeup_scheduler::rng rng_;
+
+  /// The last log messages.
+  log_ring log_;
+
+  /// Log level of the bot (-1: log_level_default_) and of the modules that
+  /// have an own level (module name -> level).
+  int log_level_;
+  std::map<std::string, int> module_log_levels_;
 
   /// Flag indicating whether the login_result_ variable is active.
   bool login_result_stored_;
@@ -223,6 +637,30 @@ class bot : boost::noncopyable, public std::enable_shared_from_this<bot> {
   std::shared_ptr<package> package_;
 };
 
+template <typename A, typename B, typename... Parts>
+void bot::log(int type, const std::string& source,
+              const A& a, const B& b, const Parts&... parts) {
+  if (!log_enabled(type, source)) {
+    return;
+  }
+  std::ostringstream msg;
+  msg << a << b;
+  int expand[] = { 0, ((msg << parts), 0)... };
+  (void) expand;
+  log(type, source, msg.str());
+}
+
 }  // namespace botscript
 
+/// Logs a debug message: logger->log(BS_LOG_DBG, args...) where logger is a
+/// bot (args: source, message parts) or a bot_browser (args: message parts).
+/// Compiled out (arguments are not evaluated) if BS_STRIP_DEBUG_LOG is
+/// defined.
+#ifdef BS_STRIP_DEBUG_LOG
+#define BS_DBG(logger, ...) do { } while (false)
+#else
+#define BS_DBG(logger, ...) \
+    (logger)->log(::botscript::bot::BS_LOG_DBG, __VA_ARGS__)
+#endif
+
 #endif  // BOT_H_
@@ -7,6 +7,8 @@
 
 #include "http/useragents.h"
 
+#include "./footprint.h"
+
 namespace botscript {
 
 bot_browser::bot_browser(boost::asio::io_service* io_service,
@@ -15,10 +17,13 @@ bot_browser::bot_browser(boost::asio::io_service* io_service,
                       http::useragents::random_ua(
                         b->config()->package() == "pg"
                           ? http::useragents::ua_type::PG
-                          : http::useragents::ua_type::KV)),
+                          : http::useragents::ua_type::KV),
+                      b->strand()),
       bot_(b),
       current_proxy_(-1),
-      server_(b->config()->server()) {
+      server_(b->config()->server()),
+      max_parallel_(MAX_PARALLEL_REQUESTS),
+      running_(0) {
   check_fun_ = std::bind(&bot_browser::check_proxy_response, this,
                          std::placeholders::_1);
 }
@@ -26,6 +31,18 @@ bot_browser::bot_browser(boost::asio::io_service* io_service,
 bot_browser::~bot_browser() {
 }
 
+std::size_t bot_browser::footprint() const {
+  std::size_t size = footprint_of(headers_) + footprint_of(cookies_);
+  for (const auto& p : good_) {
+    size += sizeof(proxy) + footprint_of(p.str()) + footprint_of(p.host())
+            + footprint_of(p.port()) - 3 * sizeof(std::string);
+  }
+  size += proxy_checks_.size() * sizeof(proxy_check);
+  size += error_log_.size() * (sizeof(std::time_t) + 2 * sizeof(void*));
+  size += queue_.size() * sizeof(std::function<void()>);
+  return size;
+}
+
 void bot_browser::cookies(std::map<std::string, std::string> const& cookies) {
   cookies_ = cookies;
   set_cookies_header();
@@ -38,7 +55,7 @@ bool bot_browser::change_proxy() {
 
   if (good_.size() == 1) {
     proxy& p = good_[0];
-    log(bot::BS_LOG_NFO, std::string("set proxy to ") + p.str());
+    log(bot::BS_LOG_NFO, "set proxy to ", p.str());
     set_proxy(p.host(), p.port());
     return false;
   }
@@ -50,7 +67,7 @@ bool bot_browser::change_proxy() {
   }
 
   proxy& p = good_[current_proxy_];
-  log(bot::BS_LOG_NFO, std::string("set proxy to ") + p.str());
+  log(bot::BS_LOG_NFO, "set proxy to ", p.str());
   set_proxy(p.host(), p.port());
   return true;
 }
@@ -117,8 +134,9 @@ void bot_browser::set_proxy_list(std::vector<std::string> proxy_list,
       auto c = std::make_shared<proxy_check>(io_service_, pr,
                                              check_request, &check_fun_);
       proxy_checks_[pr.str()] = c;
-      c->check(std::bind(&bot_browser::proxy_check_callback, this, callback,
-                         std::placeholders::_1, std::placeholders::_2));
+      c->check(strand_->wrap(
+          std::bind(&bot_browser::proxy_check_callback, this, callback,
+                    std::placeholders::_1, std::placeholders::_2)));
     }
   }
 
@@ -129,8 +147,24 @@ void bot_browser::set_proxy_list(std::vector<std::string> proxy_list,
   }
 
   // Log proxy count.
-  std::string size_str = boost::lexical_cast<std::string>(proxy_checks);
-  log(bot::BS_LOG_NFO, std::string("checking ") + size_str + " proxies");
+  log(bot::BS_LOG_NFO, "checking ", proxy_checks, " proxies");
+}
+
+void bot_browser::restore_proxies(const std::vector<std::string>& proxy_list) {
+  good_.clear();
+  for (const auto& p : proxy_list) {
+    good_.emplace_back(p);
+  }
+  current_proxy_ = -1;
+  change_proxy();
+}
+
+std::vector<std::string> bot_browser::good_proxies() const {
+  std::vector<std::string> proxy_list;
+  for (const auto& p : good_) {
+    proxy_list.push_back(p.str());
+  }
+  return proxy_list;
 }
 
 void bot_browser::submit_with_retry(
@@ -144,8 +178,11 @@ void bot_browser::submit_with_retry(
                                                input_params, action,
                                                cb, timeout * 2, _1,
                                                boost::system::error_code());
-  callback req_cb = boost::bind(&bot_browser::request_cb, this,
-      shared_from_this(), tries, retry, cb, _1, _2);
+  auto self = shared_from_this();
+  callback req_cb = [this, self, tries, retry, cb](
+      std::string response, boost::system::error_code ec) {
+    request_cb(self, tries, retry, cb, std::move(response), ec);
+  };
   return webclient::submit(xpath, page, input_params, action,
                            req_cb, timeout, ec);
 }
@@ -158,11 +195,44 @@ void bot_browser::request_with_retry(
                                                this,
                                                u, method, body,
                                                cb, timeout * 2, _1);
-  callback req_cb = boost::bind(&bot_browser::request_cb, this,
-                            shared_from_this(), tries, retry, cb, _1, _2);
-  webclient::request(u, method, body, req_cb, MAX_REDIRECT, timeout);
+  auto self = shared_from_this();
+  callback req_cb = [this, self, tries, retry, cb](
+      std::string response, boost::system::error_code ec) {
+    request_cb(self, tries, retry, cb, std::move(response), ec);
+  };
+  webclient::request(u, method, std::move(body), std::move(req_cb),
+                     MAX_REDIRECT, timeout);
 }
 
+void bot_browser::queued_request(
+    const http::url& u, int method, std::string body,
+    callback cb,
+    boost::posix_time::time_duration timeout, int tries) {
+  auto self = shared_from_this();
+  queue_.emplace_back([=]() {
+    request_with_retry(u, method, body,
+        [this, self, cb](std::string response, boost::system::error_code ec) {
+          --running_;
+          start_queued();
+          cb(std::move(response), ec);
+        }, timeout, tries);
+  });
+  start_queued();
+}
+
+void bot_browser::max_parallel(std::size_t n) {
+  max_parallel_ = std::max<std::size_t>(n, 1);
+  start_queued();
+}
+
+void bot_browser::start_queued() {
+  while (running_ < max_parallel_ && !queue_.empty()) {
+    std::function<void()> next = std::move(queue_.front());
+    queue_.pop_front();
+    ++running_;
+    next();
+  }
+}
 
 void bot_browser::request_cb(std::shared_ptr<bot_browser> /* self */, int tries,
                              std::function<void(int)> retry_fun, callback cb,
@@ -177,21 +247,20 @@ void bot_browser::request_cb(std::shared_ptr<bot_browser> /* self */, int tries,
     if (ec) {
       log_error();
     }
-    return cb(response, ec);
+    return cb(std::move(response), ec);
   } else {
-    std::string msg = std::string("error: '") + ec.message() + "', ";
     if (tries == 1) {
-      msg += "last try";
+      log(bot::BS_LOG_ERR, "error: '", ec.message(), "', last try");
     } else {
-      msg += boost::lexical_cast<std::string>(tries - 1) + " tries remaining";
+      log(bot::BS_LOG_ERR, "error: '", ec.message(), "', ",
+          tries - 1, " tries remaining");
     }
-    log(bot::BS_LOG_ERR, msg);
     return retry_fun(tries - 1);
   }
 }
 
 void bot_browser::log_error() {
-  log(bot::BS_LOG_DBG, "logging connection error");
+  BS_DBG(this, "logging connection error");
 
   // Remove entries older than one hour.
   std::time_t now = std::time(NULL);
@@ -203,7 +272,7 @@ void bot_browser::log_error() {
 
   // Change proxy if proxy failed >3 times last hour.
   if (error_log_.size() > 3) {
-    log(bot::BS_LOG_DBG, "proxy failed too often - changing");
+    BS_DBG(this, "proxy failed too often - changing");
     change_proxy();
   }
 }
@@ -212,10 +281,9 @@ void bot_browser::proxy_check_callback(std::function<void(int)> callback,
                                        std::shared_ptr<proxy_check> check,
                                        boost::system::error_code ec) {
   // Log check result.
-  std::stringstream msg;
-  msg << std::left << std::setw(21) << check->get_proxy().str()
-      << ": " << (ec ? ec.message() : "connection successful");
-  log(ec ? bot::BS_LOG_ERR : bot::BS_LOG_NFO, msg.str());
+  log(ec ? bot::BS_LOG_ERR : bot::BS_LOG_NFO,
+      std::left, std::setw(21), check->get_proxy().str(),
+      ": ", ec ? ec.message() : "connection successful");
 
   // Remove check and add proxy to good_ if it passed the test.
   proxy_checks_.erase(check->get_proxy().str());
@@ -256,10 +324,11 @@ bool bot_browser::check_proxy_response(const std::string& /* page */) {
   return true;
 }
 
-void bot_browser::log(int level, const std::string& message) {
+template <typename... Parts>
+void bot_browser::log(int level, const Parts&... parts) {
   std::shared_ptr<bot> bot_lock = bot_.lock();
   if (bot_lock != std::shared_ptr<bot>()) {
-    bot_lock->log(level, "browser", message);
+    bot_lock->log(level, "browser", parts...);
   }
 }
 
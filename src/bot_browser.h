@@ -6,6 +6,7 @@
 #define BOT_BROWSER_H_
 
 #include <ctime>
+#include <deque>
 #include <list>
 #include <string>
 #include <vector>
@@ -21,6 +22,8 @@
 #include "./proxy_check.h"
 #include "./bot.h"
 
+#define MAX_PARALLEL_REQUESTS 4
+
 namespace botscript {
 
 class bot;
@@ -31,6 +34,7 @@ class bot;
 ///     proxy failed more than 8 times in this time period
 ///   - Retries failed requests up to three times with increasing timeout values
 ///     (first try 15sec, second try 30sec, last try 60sec)
+///   - Runs all request and proxy check callbacks in the strand of the bot
 class bot_browser : public std::enable_shared_from_this<bot_browser>,
                     public http::webclient {
  public:
@@ -50,6 +54,15 @@ class bot_browser : public std::enable_shared_from_this<bot_browser>,
   void set_proxy_list(std::vector<std::string> proxy_list,
                       std::function<void(int)> callback);
 
+  /// Uses proxies that passed the check before (restored from a
+  /// checkpoint) without checking them again.
+  ///
+  /// \param proxy_list the checked proxies
+  void restore_proxies(const std::vector<std::string>& proxy_list);
+
+  /// \return the proxies that passed the check
+  std::vector<std::string> good_proxies() const;
+
   void submit_with_retry(const std::string& xpath, const std::string& page,
               std::map<std::string, std::string> input_params,
               const std::string& action, callback cb,
@@ -59,7 +72,25 @@ class bot_browser : public std::enable_shared_from_this<bot_browser>,
   void request_with_retry(const http::url& u, int method, std::string body, callback cb,
                boost::posix_time::time_duration timeout, int tries);
 
+  /// Like request_with_retry, but limits the number of requests running in
+  /// parallel to max_parallel(). Further requests are queued.
+  void queued_request(const http::url& u, int method, std::string body,
+                      callback cb, boost::posix_time::time_duration timeout,
+                      int tries);
+
+  /// \param n the maximum number of parallel queued requests (at least 1)
+  void max_parallel(std::size_t n);
+
+  /// \return the maximum number of parallel queued requests
+  std::size_t max_parallel() const { return max_parallel_; }
+
+  /// \return the approximate memory held by headers, cookies, proxy lists
+  ///         and queued requests (in bytes)
+  std::size_t footprint() const;
+
  private:
+  void start_queued();
+
   void request_cb(std::shared_ptr<bot_browser> self, int tries,
                   std::function<void(int)> retry_fun, callback cb,
                   std::string response, boost::system::error_code ec);
@@ -74,7 +105,10 @@ class bot_browser : public std::enable_shared_from_this<bot_browser>,
 
   void update_bot_proxy_status();
 
-  void log(int level, const std::string& message);
+  /// Logs a message (source "browser") concatenated from the given parts,
+  /// formatted only if the level is enabled (see bot::log).
+  template <typename... Parts>
+  void log(int level, const Parts&... parts);
 
   std::weak_ptr<bot> bot_;
   std::vector<proxy> good_;
@@ -83,6 +117,8 @@ class bot_browser : public std::enable_shared_from_this<bot_browser>,
   std::size_t current_proxy_;
   std::list<std::time_t> error_log_;
   std::string server_;
+  std::size_t max_parallel_, running_;
+  std::deque<std::function<void()>> queue_;
 };
 
 }  // namespace botscript
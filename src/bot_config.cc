@@ -4,6 +4,8 @@
 
 #include "./bot_config.h"
 
+#include "./footprint.h"
+
 namespace botscript {
 
 bool bot_config::valid() {
@@ -12,11 +14,50 @@ bool bot_config::valid() {
     return false;
   }
 
-  auto modules = module_settings();
-  auto base = modules.find("base");
-  return base != modules.end() &&
-         base->second.find("wait_time_factor") != base->second.end() &&
-         base->second.find("proxy") != base->second.end();
+  return find("base", "wait_time_factor") != nullptr &&
+         find("base", "proxy") != nullptr;
+}
+
+std::string bot_config::value_of(boost::string_ref module,
+                                 boost::string_ref key) const {
+  const std::string* value = find(module, key);
+  return value != nullptr ? *value : "";
+}
+
+void bot_config::visit(const setting_visitor& visitor) const {
+  for (const auto& module : module_settings()) {
+    for (const auto& setting : module.second) {
+      visitor(module.first, setting.first, setting.second);
+    }
+  }
+}
+
+void bot_config::visit(boost::string_ref module,
+                       const setting_visitor& visitor) const {
+  visit([&module, &visitor](const std::string& m, const std::string& key,
+                            const std::string& value) {
+    if (m == module) {
+      visitor(m, key, value);
+    }
+  });
+}
+
+bool bot_config::has_cookies() const {
+  return !cookies().empty();
+}
+
+std::size_t bot_config::settings_footprint() const {
+  return footprint_of(module_settings());
+}
+
+std::size_t bot_config::cookies_footprint() const {
+  return footprint_of(cookies());
+}
+
+void bot_config::set_batch(const string_map& values) {
+  for (const auto& value : values) {
+    set(value.first, value.second);
+  }
 }
 
 }  // namespace botscript
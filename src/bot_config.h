@@ -5,16 +5,25 @@
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
+#include <cstddef>
+#include <functional>
 #include <vector>
 #include <string>
 #include <map>
 #include <utility>
 
+#include "boost/utility/string_ref.hpp"
+
 namespace botscript {
 
 typedef std::map<std::string, std::string> string_map;
 typedef std::vector<std::pair<std::string, std::string>> command_sequence;
 
+// Visitor for module settings: (module, key, value).
+typedef std::function<void (const std::string&,
+                            const std::string&,
+                            const std::string&)> setting_visitor;
+
 class bot_config {
  public:
   bot_config() {
@@ -31,6 +40,24 @@ class bot_config {
   virtual std::string to_json(bool with_password) const = 0;
   virtual std::string value_of(const std::string& key) const = 0;
 
+  // Looks up a module setting without copying it.
+  // Returns nullptr if the setting is not set. The pointer is valid until
+  // the next modification of the configuration.
+  virtual const std::string* find(boost::string_ref module,
+                                  boost::string_ref key) const = 0;
+
+  // Returns a copy of the module setting (empty if the setting is not set).
+  std::string value_of(boost::string_ref module, boost::string_ref key) const;
+
+  // Calls the visitor for every module setting / every setting of a module.
+  // The default implementations iterate a copy of module_settings().
+  virtual void visit(const setting_visitor& visitor) const;
+  virtual void visit(boost::string_ref module,
+                     const setting_visitor& visitor) const;
+
+  // The default implementation checks a copy of cookies().
+  virtual bool has_cookies() const;
+
   virtual void inactive(bool flag) = 0;
   virtual bool inactive() const = 0;
 
@@ -48,6 +75,21 @@ class bot_config {
                    const std::string& value) = 0;
   virtual void set(const std::string& key,
                    const std::string& value) = 0;
+
+  // Approximate memory held by the module settings / cookies (in bytes).
+  // The default implementations measure copies of module_settings() and
+  // cookies().
+  virtual std::size_t settings_footprint() const;
+  virtual std::size_t cookies_footprint() const;
+
+  // Writes all values (key -> value) in one transaction.
+  // The default implementation calls set(key, value) for every value.
+  virtual void set_batch(const string_map& values);
+
+  // Makes all writes durable (backends that buffer or batch writes).
+  // The default implementation does nothing.
+  virtual void flush() {
+  }
 };
 
 }  // namespace botscript
@@ -0,0 +1,334 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./buffered_bot_config.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "boost/asio/error.hpp"
+
+#include "./footprint.h"
+#include "./mem_bot_config.h"
+
+namespace botscript {
+
+namespace pt = boost::posix_time;
+
+buffered_bot_config::buffered_bot_config(
+    std::shared_ptr<bot_config> backend,
+    boost::asio::io_service* io_service,
+    boost::asio::io_service::strand* strand,
+    pt::time_duration interval,
+    std::size_t max_pending)
+    : backend_(backend),
+      strand_(strand),
+      interval_(interval),
+      max_pending_(std::max<std::size_t>(1, max_pending)),
+      cookies_(backend->cookies()),
+      cookies_dirty_(false),
+      timer_(*io_service),
+      timer_armed_(false),
+      lifetime_(std::make_shared<lifetime>()) {
+  lifetime_->alive = true;
+}
+
+buffered_bot_config::~buffered_bot_config() {
+  {
+    // Waits for a flush handler running on another thread.
+    boost::lock_guard<boost::mutex> lock(lifetime_->mutex);
+    lifetime_->alive = false;
+  }
+  try {
+    flush();
+  } catch (const std::exception&) {
+    // Nothing to do: the backend lost the pending writes.
+  }
+}
+
+void buffered_bot_config::absorbed() {
+  if (oldest_.is_not_a_date_time()) {
+    oldest_ = pt::microsec_clock::universal_time();
+  }
+
+  if (pending_.size() >= max_pending_) {
+    return flush();
+  }
+
+  if (!timer_armed_) {
+    timer_armed_ = true;
+    timer_.expires_from_now(interval_);
+    std::weak_ptr<lifetime> weak = lifetime_;
+    timer_.async_wait(strand_->wrap([this, weak](
+        boost::system::error_code ec) {
+      std::shared_ptr<lifetime> l = weak.lock();
+      if (l == nullptr || ec == boost::asio::error::operation_aborted) {
+        return;
+      }
+      boost::lock_guard<boost::mutex> lock(l->mutex);
+      if (!l->alive) {
+        return;
+      }
+      timer_armed_ = false;
+      flush();
+    }));
+  }
+}
+
+void buffered_bot_config::flush() {
+  if (timer_armed_) {
+    timer_armed_ = false;
+    timer_.cancel();
+  }
+
+  if (pending_.empty() && !cookies_dirty_) {
+    return;
+  }
+
+  pt::ptime start = pt::microsec_clock::universal_time();
+
+  // All settings in one transaction.
+  std::size_t flushed = pending_.size() + (cookies_dirty_ ? 1 : 0);
+  if (!pending_.empty()) {
+    string_map batch;
+    for (const auto& w : pending_) {
+      batch[*w.second.module + "_" + *w.second.key] = w.second.value;
+    }
+    backend_->set_batch(batch);
+    pending_.clear();
+  }
+  if (cookies_dirty_) {
+    backend_->cookies(cookies_);
+    cookies_dirty_ = false;
+  }
+
+  pt::ptime end = pt::microsec_clock::universal_time();
+  std::uint64_t flush_us = std::max<std::int64_t>(
+      0, (end - start).total_microseconds());
+  std::uint64_t delay_ms = std::max<std::int64_t>(
+      0, (end - oldest_).total_milliseconds());
+  oldest_ = pt::ptime();
+
+  boost::lock_guard<boost::mutex> lock(stats_mutex_);
+  ++stats_.flushes;
+  stats_.flushed += flushed;
+  stats_.total_flush_us += flush_us;
+  stats_.max_flush_us = std::max(stats_.max_flush_us, flush_us);
+  stats_.total_delay_ms += delay_ms;
+  stats_.max_delay_ms = std::max(stats_.max_delay_ms, delay_ms);
+}
+
+std::size_t buffered_bot_config::pending() const {
+  return pending_.size() + (cookies_dirty_ ? 1 : 0);
+}
+
+buffered_bot_config::statistics buffered_bot_config::stats() const {
+  boost::lock_guard<boost::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+std::unique_ptr<bot_config> buffered_bot_config::merged() const {
+  std::unique_ptr<bot_config> c(new mem_bot_config(
+      backend_->identifier(), backend_->username(), backend_->password(),
+      backend_->package(), backend_->server(), module_settings()));
+  c->inactive(backend_->inactive());
+  c->cookies(cookies_);
+  return c;
+}
+
+command_sequence buffered_bot_config::init_command_sequence() const {
+  if (pending_.empty()) {
+    return backend_->init_command_sequence();
+  }
+  return merged()->init_command_sequence();
+}
+
+std::string buffered_bot_config::to_json(bool with_password) const {
+  if (pending_.empty() && !cookies_dirty_) {
+    return backend_->to_json(with_password);
+  }
+  return merged()->to_json(with_password);
+}
+
+std::string buffered_bot_config::value_of(const std::string& key) const {
+  auto pos = key.find("_");
+  if (pos == std::string::npos) {
+    return "";
+  }
+
+  boost::string_ref k(key);
+  return value_of(k.substr(0, pos), k.substr(pos + 1));
+}
+
+const std::string* buffered_bot_config::find(boost::string_ref module,
+                                             boost::string_ref key) const {
+  key_pool::id module_id, key_id;
+  if (!pending_.empty() &&
+      key_pool::find(module, &module_id) && key_pool::find(key, &key_id)) {
+    auto it = pending_.find(key_pool::pair(module_id, key_id));
+    if (it != pending_.end()) {
+      return &it->second.value;
+    }
+  }
+
+  return backend_->find(module, key);
+}
+
+void buffered_bot_config::visit(const setting_visitor& visitor) const {
+  if (pending_.empty()) {
+    return backend_->visit(visitor);
+  }
+
+  // Backend values that are not overwritten, then the pending writes.
+  // Pending names are interned: names that are not can't be overwritten.
+  backend_->visit([this, &visitor](const std::string& module,
+                                   const std::string& key,
+                                   const std::string& value) {
+    key_pool::id module_id, key_id;
+    if (!key_pool::find(module, &module_id) || !key_pool::find(key, &key_id) ||
+        pending_.find(key_pool::pair(module_id, key_id)) == pending_.end()) {
+      visitor(module, key, value);
+    }
+  });
+  for (const auto& w : pending_) {
+    visitor(*w.second.module, *w.second.key, w.second.value);
+  }
+}
+
+void buffered_bot_config::visit(boost::string_ref module,
+                                const setting_visitor& visitor) const {
+  key_pool::id module_id;
+  if (pending_.empty() || !key_pool::find(module, &module_id)) {
+    return backend_->visit(module, visitor);
+  }
+
+  backend_->visit(module, [this, module_id, &visitor](const std::string& m,
+                                                      const std::string& key,
+                                                      const std::string& v) {
+    key_pool::id key_id;
+    if (!key_pool::find(key, &key_id) ||
+        pending_.find(key_pool::pair(module_id, key_id)) == pending_.end()) {
+      visitor(m, key, v);
+    }
+  });
+  for (const auto& w : pending_) {
+    if (w.first >> 32 == module_id) {
+      visitor(*w.second.module, *w.second.key, w.second.value);
+    }
+  }
+}
+
+bool buffered_bot_config::has_cookies() const {
+  return !cookies_.empty();
+}
+
+void buffered_bot_config::inactive(bool flag) {
+  backend_->inactive(flag);
+}
+
+bool buffered_bot_config::inactive() const {
+  return backend_->inactive();
+}
+
+std::string buffered_bot_config::identifier() const {
+  return backend_->identifier();
+}
+
+std::string buffered_bot_config::username() const {
+  return backend_->username();
+}
+
+std::string buffered_bot_config::password() const {
+  return backend_->password();
+}
+
+std::string buffered_bot_config::package() const {
+  return backend_->package();
+}
+
+std::string buffered_bot_config::server() const {
+  return backend_->server();
+}
+
+std::map<std::string, string_map> buffered_bot_config::module_settings()
+    const {
+  std::map<std::string, string_map> settings = backend_->module_settings();
+  for (const auto& w : pending_) {
+    settings[*w.second.module][*w.second.key] = w.second.value;
+  }
+  return settings;
+}
+
+std::map<std::string, std::string> buffered_bot_config::cookies() const {
+  return cookies_;
+}
+
+void buffered_bot_config::cookies(
+    std::map<std::string, std::string> const& cookies) {
+  if (cookies == cookies_) {
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    ++stats_.skipped;
+    return;
+  }
+
+  cookies_ = cookies;
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    ++stats_.writes;
+    stats_.coalesced += cookies_dirty_ ? 1 : 0;
+  }
+  cookies_dirty_ = true;
+  absorbed();
+}
+
+std::size_t buffered_bot_config::settings_footprint() const {
+  std::size_t size = backend_->settings_footprint() +
+                     pending_.bucket_count() * sizeof(void*);
+  for (const auto& w : pending_) {
+    size += 2 * sizeof(void*) + sizeof(std::uint64_t) +
+            sizeof(write) - sizeof(std::string) + footprint_of(w.second.value);
+  }
+  return size;
+}
+
+std::size_t buffered_bot_config::cookies_footprint() const {
+  return backend_->cookies_footprint() + footprint_of(cookies_);
+}
+
+void buffered_bot_config::set(const std::string& module,
+                              const std::string& key,
+                              const std::string& value) {
+  const std::string* current = find(module, key);
+  if (current != nullptr && *current == value) {
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    ++stats_.skipped;
+    return;
+  }
+
+  key_pool::id module_id = key_pool::intern(module);
+  key_pool::id key_id = key_pool::intern(key);
+  write& w = pending_[key_pool::pair(module_id, key_id)];
+  bool coalesced = w.module != nullptr;
+  if (!coalesced) {
+    w.module = &key_pool::str(module_id);
+    w.key = &key_pool::str(key_id);
+  }
+  w.value = value;
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mutex_);
+    ++stats_.writes;
+    stats_.coalesced += coalesced ? 1 : 0;
+  }
+  absorbed();
+}
+
+void buffered_bot_config::set(const std::string& key,
+                              const std::string& value) {
+  auto pos = key.find("_");
+  if (pos != std::string::npos) {
+    set(key.substr(0, pos), key.substr(pos + 1), value);
+  }
+}
+
+}  // namespace botscript
@@ -0,0 +1,176 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef BUFFERED_CONFIG_H_
+#define BUFFERED_CONFIG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/asio/strand.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "./bot_config.h"
+#include "./key_pool.h"
+#include "./timing_wheel.h"
+
+namespace botscript {
+
+/// Write-behind decorator for any bot_config.
+///
+/// Setting and cookie writes are absorbed in memory: repeated writes to the
+/// same key are coalesced, writes that don't change the value are skipped.
+/// Pending writes are flushed to the wrapped backend (settings with one
+/// set_batch call) when the flush interval elapsed, when the number of
+/// pending writes reaches the threshold or when flush() is called. Reads see
+/// the pending writes.
+///
+/// Not thread safe (like the other configurations): it has to be used
+/// within the strand passed to the constructor (the flush timer uses it).
+class buffered_bot_config : public bot_config {
+ public:
+  /// Flush statistics.
+  struct statistics {
+    statistics()
+      : writes(0), coalesced(0), skipped(0), flushes(0), flushed(0),
+        total_flush_us(0), max_flush_us(0), total_delay_ms(0),
+        max_delay_ms(0) {
+    }
+
+    /// \return the mean duration of a flush in microseconds
+    double mean_flush_us() const {
+      return flushes == 0 ? 0.0 : static_cast<double>(total_flush_us) / flushes;
+    }
+
+    /// \return the mean age of the oldest pending write at flush time
+    double mean_delay_ms() const {
+      return flushes == 0 ? 0.0 : static_cast<double>(total_delay_ms) / flushes;
+    }
+
+    std::uint64_t writes;          ///< writes absorbed
+    std::uint64_t coalesced;       ///< writes replacing a pending write
+    std::uint64_t skipped;         ///< writes not changing the value
+    std::uint64_t flushes;         ///< flushes to the backend
+    std::uint64_t flushed;         ///< writes passed to the backend
+    std::uint64_t total_flush_us;  ///< time spent in the backend
+    std::uint64_t max_flush_us;
+    std::uint64_t total_delay_ms;  ///< age of the oldest pending write
+    std::uint64_t max_delay_ms;
+  };
+
+  /// \param backend      the configuration to write to
+  /// \param io_service   the io_service running the flush timer
+  /// \param strand       the strand the configuration is used in
+  /// \param interval     the maximum time a write stays pending
+  /// \param max_pending  flush when this many writes are pending
+  buffered_bot_config(std::shared_ptr<bot_config> backend,
+                      boost::asio::io_service* io_service,
+                      boost::asio::io_service::strand* strand,
+                      boost::posix_time::time_duration interval,
+                      std::size_t max_pending);
+
+  /// Flushes the pending writes.
+  virtual ~buffered_bot_config();
+
+  virtual command_sequence init_command_sequence() const override;
+  virtual std::string to_json(bool with_password) const override;
+  virtual std::string value_of(const std::string& key) const override;
+  using bot_config::value_of;
+
+  virtual const std::string* find(boost::string_ref module,
+                                  boost::string_ref key) const override;
+  virtual void visit(const setting_visitor& visitor) const override;
+  virtual void visit(boost::string_ref module,
+                     const setting_visitor& visitor) const override;
+  virtual bool has_cookies() const override;
+
+  virtual void inactive(bool flag) override;
+  virtual bool inactive() const override;
+
+  virtual std::string identifier() const override;
+  virtual std::string username() const override;
+  virtual std::string password() const override;
+  virtual std::string package() const override;
+  virtual std::string server() const override;
+  virtual std::map<std::string, string_map> module_settings() const override;
+
+  virtual std::map<std::string, std::string> cookies() const override;
+  virtual void cookies(std::map<std::string, std::string> const&) override;
+
+  virtual std::size_t settings_footprint() const override;
+  virtual std::size_t cookies_footprint() const override;
+
+  virtual void set(const std::string& module,
+                   const std::string& key,
+                   const std::string& value) override;
+  virtual void set(const std::string& key,
+                   const std::string& value) override;
+
+  /// Writes all pending writes to the backend (synchronously).
+  virtual void flush() override;
+
+  /// \return the wrapped configuration
+  std::shared_ptr<bot_config> backend() const { return backend_; }
+
+  /// \return the number of pending writes
+  std::size_t pending() const;
+
+  /// \return the flush statistics
+  statistics stats() const;
+
+ private:
+  /// A pending setting write. Module and key reference the interned names.
+  struct write {
+    const std::string* module;
+    const std::string* key;
+    std::string value;
+  };
+
+  /// Accounts an absorbed write and flushes or arms the flush timer.
+  void absorbed();
+
+  /// \return a copy of the configuration including the pending writes
+  std::unique_ptr<bot_config> merged() const;
+
+  std::shared_ptr<bot_config> backend_;
+  boost::asio::io_service::strand* strand_;
+  boost::posix_time::time_duration interval_;
+  std::size_t max_pending_;
+
+  /// Pending setting writes: (module id, setting id) -> write.
+  std::unordered_map<std::uint64_t, write> pending_;
+
+  /// The current cookies (the last written cookies are pending if dirty).
+  std::map<std::string, std::string> cookies_;
+  bool cookies_dirty_;
+
+  /// Time of the oldest pending write.
+  boost::posix_time::ptime oldest_;
+
+  wheel_timer timer_;
+  bool timer_armed_;
+
+  /// State shared with the queued flush handlers (they hold a weak_ptr).
+  /// The destructor clears alive under the mutex, a handler only flushes
+  /// while it holds the mutex and alive is set.
+  struct lifetime {
+    boost::mutex mutex;
+    bool alive;
+  };
+  std::shared_ptr<lifetime> lifetime_;
+
+  /// Protects stats_ (read from other threads).
+  mutable boost::mutex stats_mutex_;
+  statistics stats_;
+};
+
+}  // namespace botscript
+
+#endif  // BUFFERED_CONFIG_H_
@@ -0,0 +1,165 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./config_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+
+#include "boost/filesystem.hpp"
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/thread.hpp"
+#include "rapidjson/document.h"
+
+#include "./mem_bot_config.h"
+
+namespace botscript {
+
+namespace ip = boost::interprocess;
+namespace fs = boost::filesystem;
+
+config_loader::config_map config_loader::load_ndjson(
+    const std::string& path, std::size_t threads, const error_fn& on_error) {
+  if (fs::file_size(path) == 0) {
+    return config_map();
+  }
+
+  // Private mapping: the in-situ parser writes into the pages, not the file.
+  std::unique_ptr<ip::mapped_region> region;
+  try {
+    ip::file_mapping file(path.c_str(), ip::read_only);
+    region.reset(new ip::mapped_region(file, ip::copy_on_write));
+  } catch (const ip::interprocess_exception& e) {
+    throw std::runtime_error(path + ": " + e.what());
+  }
+
+  // One job per non-empty line, terminated in place.
+  std::vector<job> jobs;
+  char* pos = static_cast<char*>(region->get_address());
+  char* end = pos + region->get_size();
+  for (std::size_t line = 1; pos < end; ++line) {
+    char* eol = static_cast<char*>(std::memchr(pos, '\n', end - pos));
+    char* line_end = eol == nullptr ? end : eol;
+    auto non_space = [](char c) {
+      return !std::isspace(static_cast<unsigned char>(c));
+    };
+    if (std::find_if(pos, line_end, non_space) != line_end) {
+      job j;
+      j.source = path + ":" + std::to_string(line);
+      if (eol != nullptr) {
+        *eol = '\0';
+        j.text = pos;
+      } else {
+        // The last line is not terminated: copy it.
+        j.text = nullptr;
+        j.buffer.assign(pos, end);
+        j.buffer.push_back('\0');
+      }
+      jobs.push_back(std::move(j));
+    }
+    pos = line_end + 1;
+  }
+
+  return parse(&jobs, threads, on_error);
+}
+
+config_loader::config_map config_loader::load_directory(
+    const std::string& path, std::size_t threads, const error_fn& on_error) {
+  // The files are read by the parser threads.
+  std::vector<job> jobs;
+  for (fs::directory_iterator i = fs::directory_iterator(path);
+       i != fs::directory_iterator(); ++i) {
+    if (!fs::is_regular_file(i->status()) || i->path().extension() == ".log") {
+      continue;
+    }
+
+    job j;
+    j.source = i->path().relative_path().generic_string();
+    j.text = nullptr;
+    jobs.push_back(std::move(j));
+  }
+
+  // Sorted like the former directory walk into a map.
+  std::sort(jobs.begin(), jobs.end(), [](const job& a, const job& b) {
+    return a.source < b.source;
+  });
+
+  return parse(&jobs, threads, on_error);
+}
+
+config_loader::config_map config_loader::parse(std::vector<job>* jobs,
+                                               std::size_t threads,
+                                               const error_fn& on_error) {
+  if (threads == 0) {
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+  }
+  threads = std::max<std::size_t>(1, std::min(threads, jobs->size()));
+
+  std::vector<std::shared_ptr<bot_config>> configs(jobs->size());
+  std::vector<std::string> errors(jobs->size());
+  std::atomic<std::size_t> next(0);
+
+  auto worker = [jobs, &configs, &errors, &next]() {
+    for (std::size_t i = next++; i < jobs->size(); i = next++) {
+      job& j = (*jobs)[i];
+      if (j.text == nullptr && j.buffer.empty()) {
+        std::ifstream file(j.source.c_str(), std::ios::in | std::ios::binary);
+        j.buffer.assign(std::istreambuf_iterator<char>(file),
+                        std::istreambuf_iterator<char>());
+        j.buffer.push_back('\0');
+      }
+      if (j.text == nullptr) {
+        j.text = j.buffer.data();
+      }
+
+      rapidjson::Document document;
+      if (document.ParseInsitu<0>(j.text).HasParseError()) {
+        errors[i] = "invalid JSON";
+        continue;
+      }
+
+      try {
+        configs[i] = std::make_shared<mem_bot_config>(document);
+      } catch (const std::runtime_error& e) {
+        errors[i] = e.what();
+      }
+    }
+  };
+
+  boost::thread_group group;
+  for (std::size_t i = 1; i < threads; ++i) {
+    group.create_thread(worker);
+  }
+  worker();
+  group.join_all();
+
+  // Report in input order, the first configuration of an identifier wins.
+  config_map loaded;
+  std::set<std::string> identifiers;
+  for (std::size_t i = 0; i < jobs->size(); ++i) {
+    const std::string& source = (*jobs)[i].source;
+    if (configs[i] != nullptr &&
+        !identifiers.insert(configs[i]->identifier()).second) {
+      errors[i] = "duplicate identifier " + configs[i]->identifier();
+    }
+
+    if (!errors[i].empty()) {
+      if (on_error != nullptr) {
+        on_error(source, errors[i]);
+      }
+      continue;
+    }
+    loaded[source] = std::move(configs[i]);
+  }
+
+  return loaded;
+}
+
+}  // namespace botscript
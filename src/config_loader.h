@@ -0,0 +1,79 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef CONFIG_LOADER_H_
+#define CONFIG_LOADER_H_
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./bot_config.h"
+
+namespace botscript {
+
+/// Bulk loader for JSON bot configurations.
+///
+/// Configurations are parsed in parallel with rapidjson's in-situ parser
+/// (strings are not copied into the DOM but referenced in the input buffer)
+/// and read into mem_bot_configs. Invalid configurations and duplicate
+/// identifiers are reported and skipped.
+class config_loader {
+ public:
+  /// Loaded configurations: source -> configuration.
+  typedef std::map<std::string, std::shared_ptr<bot_config>> config_map;
+
+  /// Called for every configuration that could not be loaded.
+  typedef std::function<void (const std::string& source,
+                              const std::string& error)> error_fn;
+
+  /// Loads a file with one JSON configuration per line (NDJSON). The file
+  /// is memory-mapped copy-on-write and the lines are parsed in place.
+  /// Empty lines are skipped.
+  ///
+  /// \param path      the file to load
+  /// \param threads   the number of parser threads (0: one per core)
+  /// \param on_error  called for every invalid line (may be nullptr)
+  /// \return the configurations ("{path}:{line}" -> configuration)
+  /// \throws std::runtime_error if the file can't be mapped
+  static config_map load_ndjson(const std::string& path, std::size_t threads,
+                                const error_fn& on_error);
+
+  /// Loads all files of a directory as JSON configurations, except for
+  /// configuration logs (*.log).
+  ///
+  /// \param path      the directory to load
+  /// \param threads   the number of parser threads (0: one per core)
+  /// \param on_error  called for every invalid file (may be nullptr)
+  /// \return the configurations (file path -> configuration)
+  static config_map load_directory(const std::string& path,
+                                   std::size_t threads,
+                                   const error_fn& on_error);
+
+ private:
+  /// A configuration to parse: its source and its null-terminated text.
+  /// If there is no text, the source file is read into the buffer.
+  struct job {
+    std::string source;
+    char* text;
+    std::vector<char> buffer;
+  };
+
+  /// Parses the jobs on parallel threads, then checks for duplicate
+  /// identifiers and reports the errors in the order of the jobs.
+  ///
+  /// \param jobs      the configurations to parse (modified in place)
+  /// \param threads   the number of parser threads (0: one per core)
+  /// \param on_error  called for every invalid configuration
+  /// \return the configurations (source -> configuration)
+  static config_map parse(std::vector<job>* jobs, std::size_t threads,
+                          const error_fn& on_error);
+};
+
+}  // namespace botscript
+
+#endif  // CONFIG_LOADER_H_
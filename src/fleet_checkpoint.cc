@@ -0,0 +1,377 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./fleet_checkpoint.h"
+
+#include <cstdlib>
+
+#include "boost/asio/error.hpp"
+#include "boost/crc.hpp"
+
+#include "./bot.h"
+#include "./lua/lua_connection.h"
+#include "./mem_bot_config.h"
+
+namespace botscript {
+
+namespace {
+
+// Record types. Every record consists of the type and its fields, each field
+// is prefixed with its length (4 byte).
+enum : char {
+  BOT     = 'B',  // identifier, username, password, package, server,
+                  // inactive, session, #cookies, name, value, ...,
+                  // #proxies, proxy, ..., module, key, value, ...
+  REMOVED = 'R',  // identifier
+  TIME    = 'T'   // time of the checkpoint (seconds since epoch)
+};
+
+std::uint32_t checksum(boost::string_ref record) {
+  boost::crc_32_type crc;
+  crc.process_bytes(record.data(), record.size());
+  return crc.checksum();
+}
+
+/// \return the identifier (first field) of a bot or tombstone record
+boost::string_ref identifier_of(boost::string_ref record) {
+  boost::string_ref identifier;
+  record.remove_prefix(1);
+  record_log::get_field(&record, &identifier);
+  return identifier;
+}
+
+/// Collects the latest record of every bot (references into the mapping).
+///
+/// \param log     the checkpoint log
+/// \param latest  the records to write (identifier -> record)
+/// \return the last time record (empty if there is none)
+boost::string_ref latest_records(
+    const record_log& log,
+    std::map<boost::string_ref, boost::string_ref>* latest) {
+  boost::string_ref time;
+  log.replay([latest, &time](boost::string_ref record) {
+    if (record.empty()) {
+      return;
+    }
+
+    switch (record.front()) {
+      case BOT:
+        (*latest)[identifier_of(record)] = record;
+        break;
+
+      case REMOVED:
+        latest->erase(identifier_of(record));
+        break;
+
+      case TIME:
+        time = record;
+        break;
+    }
+  });
+  return time;
+}
+
+bool get_count(boost::string_ref* record, std::size_t* count) {
+  boost::string_ref field;
+  if (!record_log::get_field(record, &field)) {
+    return false;
+  }
+  *count = 0;
+  for (char c : field) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    *count = *count * 10 + static_cast<std::size_t>(c - '0');
+  }
+  return true;
+}
+
+}  // namespace
+
+fleet_checkpoint::fleet_checkpoint(const std::string& path)
+    : log_(path, 0, nullptr),
+      live_(0),
+      interval_(0) {
+}
+
+fleet_checkpoint::~fleet_checkpoint() {
+  stop();
+}
+
+std::time_t fleet_checkpoint::restore(const restore_fn& fn) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  std::map<boost::string_ref, boost::string_ref> latest;
+  boost::string_ref time_record = latest_records(log_, &latest);
+  std::time_t time = 0;
+  if (!time_record.empty()) {
+    boost::string_ref field;
+    time_record.remove_prefix(1);
+    if (record_log::get_field(&time_record, &field)) {
+      time = std::strtoll(field.to_string().c_str(), nullptr, 10);
+    }
+  }
+
+  written_.clear();
+  live_ = 0;
+  for (const auto& r : latest) {
+    entry e;
+    if (!parse(r.second.substr(1), &e)) {
+      continue;
+    }
+
+    written& w = written_[r.first.to_string()];
+    w.crc = checksum(r.second);
+    w.size = r.second.size();
+    live_ += w.size;
+
+    fn(e);
+  }
+
+  return time;
+}
+
+void fleet_checkpoint::checkpoint(const done_fn& cb) {
+  // Shared by the serializing handlers: the last one writes the checkpoint.
+  struct collection {
+    boost::mutex mutex;
+    std::map<std::string, std::string> records;
+    std::size_t remaining;
+  };
+
+  std::vector<std::shared_ptr<bot>> bots = lua_connection::bots();
+  if (bots.empty()) {
+    std::size_t count = write(std::map<std::string, std::string>());
+    return cb(count);
+  }
+
+  auto c = std::make_shared<collection>();
+  c->remaining = bots.size();
+  for (const auto& b : bots) {
+    b->strand()->post([this, b, c, cb]() {
+      std::string record = serialize(b);
+
+      std::map<std::string, std::string> records;
+      {
+        boost::lock_guard<boost::mutex> lock(c->mutex);
+        if (!record.empty()) {
+          c->records[identifier_of(record).to_string()] = std::move(record);
+        }
+        if (--c->remaining != 0) {
+          return;
+        }
+        records.swap(c->records);
+      }
+      cb(write(records));
+    });
+  }
+}
+
+void fleet_checkpoint::start(boost::asio::io_service* io_service,
+                             int seconds) {
+  timer_.reset(new boost::asio::deadline_timer(*io_service));
+  interval_ = seconds;
+  schedule();
+}
+
+void fleet_checkpoint::stop() {
+  if (timer_ != nullptr) {
+    timer_->cancel();
+  }
+}
+
+void fleet_checkpoint::schedule() {
+  timer_->expires_from_now(boost::posix_time::seconds(interval_));
+  timer_->async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+    checkpoint([this](std::size_t) { schedule(); });
+  });
+}
+
+std::shared_ptr<bot_config> fleet_checkpoint::make_config(const entry& e) {
+  std::map<std::string, string_map> settings;
+  for (const auto& s : e.settings) {
+    settings[s.module.to_string()][s.key.to_string()] = s.value.to_string();
+  }
+
+  auto config = std::make_shared<mem_bot_config>(
+      e.identifier.to_string(), e.username.to_string(),
+      e.password.to_string(), e.package.to_string(), e.server.to_string(),
+      settings);
+  config->inactive(e.inactive);
+
+  std::map<std::string, std::string> cookies;
+  for (const auto& cookie : e.cookies) {
+    cookies[cookie.first.to_string()] = cookie.second.to_string();
+  }
+  config->cookies(cookies);
+
+  return config;
+}
+
+std::string fleet_checkpoint::serialize(std::shared_ptr<bot> b) {
+  std::shared_ptr<bot_config> config = b->config();
+  if (config == nullptr) {
+    return "";
+  }
+  return serialize(*config, !b->hibernated(), b->proxies());
+}
+
+std::string fleet_checkpoint::serialize(
+    const bot_config& config, bool session,
+    const std::vector<std::string>& proxies) {
+  if (config.identifier().empty()) {
+    return "";
+  }
+
+  std::string record(1, BOT);
+  record_log::put_field(&record, config.identifier());
+  record_log::put_field(&record, config.username());
+  record_log::put_field(&record, config.password());
+  record_log::put_field(&record, config.package());
+  record_log::put_field(&record, config.server());
+  record_log::put_field(&record, config.inactive() ? "1" : "0");
+  record_log::put_field(&record, session ? "1" : "0");
+
+  std::map<std::string, std::string> cookies = config.cookies();
+  record_log::put_field(&record, std::to_string(cookies.size()));
+  for (const auto& cookie : cookies) {
+    record_log::put_field(&record, cookie.first);
+    record_log::put_field(&record, cookie.second);
+  }
+
+  record_log::put_field(&record, std::to_string(proxies.size()));
+  for (const auto& proxy : proxies) {
+    record_log::put_field(&record, proxy);
+  }
+
+  config.visit([&record](const std::string& module, const std::string& key,
+                          const std::string& value) {
+    record_log::put_field(&record, module);
+    record_log::put_field(&record, key);
+    record_log::put_field(&record, value);
+  });
+
+  return record;
+}
+
+bool fleet_checkpoint::parse(boost::string_ref record, entry* e) {
+  boost::string_ref inactive, session;
+  if (!record_log::get_field(&record, &e->identifier) ||
+      !record_log::get_field(&record, &e->username) ||
+      !record_log::get_field(&record, &e->password) ||
+      !record_log::get_field(&record, &e->package) ||
+      !record_log::get_field(&record, &e->server) ||
+      !record_log::get_field(&record, &inactive) ||
+      !record_log::get_field(&record, &session)) {
+    return false;
+  }
+  e->inactive = inactive == "1";
+  e->session = session == "1";
+
+  std::size_t count;
+  if (!get_count(&record, &count)) {
+    return false;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    boost::string_ref name, value;
+    if (!record_log::get_field(&record, &name) ||
+        !record_log::get_field(&record, &value)) {
+      return false;
+    }
+    e->cookies.emplace_back(name, value);
+  }
+
+  if (!get_count(&record, &count)) {
+    return false;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    boost::string_ref proxy;
+    if (!record_log::get_field(&record, &proxy)) {
+      return false;
+    }
+    e->proxies.push_back(proxy);
+  }
+
+  entry::setting s;
+  while (record_log::get_field(&record, &s.module)) {
+    if (!record_log::get_field(&record, &s.key) ||
+        !record_log::get_field(&record, &s.value)) {
+      return false;
+    }
+    e->settings.push_back(s);
+  }
+
+  return true;
+}
+
+std::size_t fleet_checkpoint::write(
+    const std::map<std::string, std::string>& records) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  // Changed and new bots.
+  std::size_t count = 0;
+  for (const auto& r : records) {
+    std::uint32_t crc = checksum(r.second);
+    auto it = written_.find(r.first);
+    if (it != written_.end()) {
+      if (it->second.crc == crc && it->second.size == r.second.size()) {
+        continue;
+      }
+      live_ -= it->second.size;
+    } else {
+      it = written_.insert(std::make_pair(r.first, written())).first;
+    }
+
+    log_.append(r.second);
+    it->second.crc = crc;
+    it->second.size = r.second.size();
+    live_ += r.second.size();
+    ++count;
+  }
+
+  // Tombstones for removed bots.
+  for (auto it = written_.begin(); it != written_.end();) {
+    if (records.find(it->first) != records.end()) {
+      ++it;
+      continue;
+    }
+
+    std::string record(1, REMOVED);
+    record_log::put_field(&record, it->first);
+    log_.append(record);
+    live_ -= it->second.size;
+    it = written_.erase(it);
+  }
+
+  std::string time(1, TIME);
+  record_log::put_field(&time, std::to_string(std::time(nullptr)));
+  log_.append(time);
+  log_.sync();
+
+  if (log_.size() > FLEET_CHECKPOINT_COMPACT_MIN &&
+      log_.size() > FLEET_CHECKPOINT_COMPACT_RATIO * live_) {
+    compact();
+  }
+
+  return count;
+}
+
+void fleet_checkpoint::compact() {
+  std::map<boost::string_ref, boost::string_ref> latest;
+  boost::string_ref time = latest_records(log_, &latest);
+
+  std::vector<std::string> records;
+  for (const auto& r : latest) {
+    records.push_back(r.second.to_string());
+  }
+  if (!time.empty()) {
+    records.push_back(time.to_string());
+  }
+  log_.rewrite(records);
+}
+
+}  // namespace botscript
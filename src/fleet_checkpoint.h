@@ -0,0 +1,167 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef FLEET_CHECKPOINT_H_
+#define FLEET_CHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/asio/deadline_timer.hpp"
+#include "boost/asio/io_service.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/utility/string_ref.hpp"
+
+#include "./bot_config.h"
+#include "./record_log.h"
+
+/// Compact when the checkpoint is this many times larger than its live data...
+#define FLEET_CHECKPOINT_COMPACT_RATIO 4
+
+/// ...and larger than this (in bytes).
+#define FLEET_CHECKPOINT_COMPACT_MIN (1024 * 1024)
+
+namespace botscript {
+
+class bot;
+
+/// Binary checkpoint of all registered bots for fast process restarts.
+///
+/// For every bot the checkpoint stores its configuration (settings including
+/// the module states and shared variables, cookies), the proxies that passed
+/// the check and whether it had a session (was logged in, not hibernated).
+///
+/// Checkpoints are written incrementally to a record_log: a bot record is
+/// only appended if it changed since the last checkpoint, removed bots get a
+/// tombstone. The latest record of each bot wins. Restoring reads the records
+/// directly from the mapped file.
+class fleet_checkpoint {
+ public:
+  /// A restored bot. All references point into the mapped checkpoint file
+  /// and are only valid during the restore callback.
+  struct entry {
+    struct setting {
+      boost::string_ref module;
+      boost::string_ref key;
+      boost::string_ref value;
+    };
+
+    boost::string_ref identifier;
+    boost::string_ref username;
+    boost::string_ref password;
+    boost::string_ref package;
+    boost::string_ref server;
+    bool inactive;
+
+    /// Whether the bot was logged in when the checkpoint was written.
+    bool session;
+
+    std::vector<std::pair<boost::string_ref, boost::string_ref>> cookies;
+    std::vector<boost::string_ref> proxies;
+
+    std::vector<setting> settings;
+  };
+
+  typedef std::function<void (const entry&)> restore_fn;
+  typedef std::function<void (std::size_t)> done_fn;
+
+  /// Opens or creates the checkpoint file.
+  ///
+  /// \param path  the checkpoint file path
+  /// \throws std::runtime_error if the file is no checkpoint
+  explicit fleet_checkpoint(const std::string& path);
+
+  /// Stops the periodic checkpoints.
+  ~fleet_checkpoint();
+
+  fleet_checkpoint(const fleet_checkpoint&) = delete;
+  fleet_checkpoint& operator=(const fleet_checkpoint&) = delete;
+
+  /// Calls the function for every bot in the checkpoint.
+  /// Bots restored this way are only written again when they changed.
+  ///
+  /// \param fn  the function to call
+  /// \return the time of the last checkpoint (0 if there is none)
+  std::time_t restore(const restore_fn& fn);
+
+  /// Serializes every registered bot within its strand and appends the
+  /// changed ones. The checkpoint has to outlive the bot strands.
+  ///
+  /// \param cb  called with the number of bot records written
+  void checkpoint(const done_fn& cb);
+
+  /// Writes a checkpoint periodically.
+  ///
+  /// \param io_service  the io_service running the timer
+  /// \param seconds     the checkpoint interval
+  void start(boost::asio::io_service* io_service, int seconds);
+
+  /// Stops the periodic checkpoints.
+  void stop();
+
+  /// \param e  the restored bot
+  /// \return a configuration with the settings, cookies and state of e
+  static std::shared_ptr<bot_config> make_config(const entry& e);
+
+  /// \param config   the configuration to serialize
+  /// \param session  whether the bot is logged in
+  /// \param proxies  the proxies that passed the check
+  /// \return the bot record (empty if the configuration has no identifier)
+  static std::string serialize(const bot_config& config, bool session,
+                               const std::vector<std::string>& proxies);
+
+  /// \param record  the bot record (without type)
+  /// \param e       the entry to write
+  /// \return whether the record was complete
+  static bool parse(boost::string_ref record, entry* e);
+
+  /// Appends the changed records and the tombstones of removed bots.
+  ///
+  /// \param records  the current bot records (identifier -> record)
+  /// \return the number of bot records written
+  std::size_t write(const std::map<std::string, std::string>& records);
+
+ private:
+  /// The last written record of a bot.
+  struct written {
+    std::uint32_t crc;
+    std::size_t size;
+  };
+
+  /// \param b  the bot to serialize (has to be called within its strand)
+  /// \return the bot record (empty if the bot is not initialized)
+  static std::string serialize(std::shared_ptr<bot> b);
+
+  /// Rewrites the checkpoint with only the latest records.
+  /// Has to be called with mutex_ locked.
+  void compact();
+
+  /// Arms the periodic checkpoint timer.
+  void schedule();
+
+  /// Guards log_, written_ and live_.
+  boost::mutex mutex_;
+
+  record_log log_;
+
+  /// Identifier -> last written record.
+  std::map<std::string, written> written_;
+
+  /// Size of the latest records.
+  std::size_t live_;
+
+  std::unique_ptr<boost::asio::deadline_timer> timer_;
+  int interval_;
+};
+
+}  // namespace botscript
+
+#endif  // FLEET_CHECKPOINT_H_
@@ -0,0 +1,66 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef FOOTPRINT_H_
+#define FOOTPRINT_H_
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace botscript {
+
+// Approximate heap usage of containers (in bytes). Map nodes are counted with
+// their tree node header (color, parent, left, right), hash nodes with their
+// next pointer and cached hash plus the bucket array, strings with their
+// allocated buffer if it doesn't fit into the small string buffer.
+
+inline std::size_t footprint_of(const std::string& s) {
+  return sizeof(std::string) +
+         (s.capacity() >= sizeof(std::string) ? s.capacity() + 1 : 0);
+}
+
+template<typename K, typename V>
+std::size_t footprint_of(const std::map<K, V>& m) {
+  std::size_t size = 0;
+  for (const auto& e : m) {
+    size += 4 * sizeof(void*) + footprint_of(e.first) + footprint_of(e.second);
+  }
+  return size;
+}
+
+template<typename K>
+std::size_t footprint_of(const std::set<K>& s) {
+  std::size_t size = 0;
+  for (const auto& e : s) {
+    size += 4 * sizeof(void*) + footprint_of(e);
+  }
+  return size;
+}
+
+template<typename K, typename V>
+std::size_t footprint_of(const std::unordered_map<K, V>& m) {
+  std::size_t size = m.bucket_count() * sizeof(void*);
+  for (const auto& e : m) {
+    size += 2 * sizeof(void*) + footprint_of(e.first) + footprint_of(e.second);
+  }
+  return size;
+}
+
+template<typename A, typename B>
+std::size_t footprint_of(const std::vector<std::pair<A, B>>& v) {
+  std::size_t size = (v.capacity() - v.size()) * sizeof(std::pair<A, B>);
+  for (const auto& e : v) {
+    size += footprint_of(e.first) + footprint_of(e.second);
+  }
+  return size;
+}
+
+}  // namespace botscript
+
+#endif  // FOOTPRINT_H_
@@ -9,6 +9,7 @@
 #include "boost/asio.hpp"
 #include "boost/bind.hpp"
 #include "boost/iostreams/copy.hpp"
+#include "boost/iostreams/device/back_inserter.hpp"
 #include "boost/iostreams/filter/gzip.hpp"
 #include "boost/iostreams/filtering_streambuf.hpp"
 
@@ -24,8 +25,9 @@ http_con::http_con(boost::asio::io_service* io_service, std::string host,
       resolver_(*io_service_),
       ssl_ctx_(asio::ssl::context::sslv23),
       socket_(*io_service, ssl_ctx_),
+      strand_(*io_service),
       req_timeout_timer_(*io_service, std::move(timeout)),
-      src_(std::make_shared<http_source>(&socket_)),
+      src_(std::make_shared<http_source>(&socket_, &strand_)),
       host_(std::move(host)),
       port_(std::move(port)),
       connected_(false) {
@@ -33,9 +35,10 @@ http_con::http_con(boost::asio::io_service* io_service, std::string host,
 }
 
 void http_con::operator()(std::string request_str, callback cb) {
-  req_timeout_timer_.async_wait(
-      boost::bind(&http_con::timer_callback, this, shared_from_this(), _1));
-  return request(shared_from_this(), std::move(request_str), std::move(cb));
+  req_timeout_timer_.async_wait(strand_.wrap(
+      boost::bind(&http_con::timer_callback, this, shared_from_this(), _1)));
+  strand_.dispatch(boost::bind(&http_con::request, this, shared_from_this(),
+                               std::move(request_str), std::move(cb)));
 }
 
 void http_con::request(std::shared_ptr<http_con> self, std::string request_str,
@@ -54,8 +57,9 @@ void http_con::resolve(std::shared_ptr<http_con> self, std::string request_str,
                        callback cb) {
   asio::ip::tcp::resolver::query query(host_, port_);
   return resolver_.async_resolve(
-      query, boost::bind(&http_con::connect, this, std::move(self),
-                         std::move(request_str), std::move(cb), _1, _2));
+      query, strand_.wrap(boost::bind(&http_con::connect, this,
+                                      std::move(self), std::move(request_str),
+                                      std::move(cb), _1, _2)));
 }
 
 void http_con::connect(std::shared_ptr<http_con> self, std::string request_str,
@@ -64,8 +68,8 @@ void http_con::connect(std::shared_ptr<http_con> self, std::string request_str,
   if (!ec) {
     return asio::async_connect(
         socket_.lowest_layer(), iterator,
-        boost::bind(&http_con::on_connect, this, std::move(self),
-                    std::move(request_str), std::move(cb), _1));
+        strand_.wrap(boost::bind(&http_con::on_connect, this, std::move(self),
+                                 std::move(request_str), std::move(cb), _1)));
   } else {
     return cb(self, "", ec);
   }
@@ -77,8 +81,9 @@ void http_con::on_connect(std::shared_ptr<http_con> self,
   if (!ec) {
     return socket_.async_handshake(
         asio::ssl::stream_base::client,
-        boost::bind(&http_con::on_ssl_handshake, this, std::move(self),
-                    std::move(request_str), std::move(cb), _1));
+        strand_.wrap(boost::bind(&http_con::on_ssl_handshake, this,
+                                 std::move(self), std::move(request_str),
+                                 std::move(cb), _1)));
   } else {
     return cb(self, "", ec);
   }
@@ -122,22 +127,24 @@ void http_con::request_finish(std::shared_ptr<http_con> self, callback cb,
     typedef boost::reference_wrapper<http::http_source> http_stream_ref;
     boost::iostreams::stream<http_stream_ref> s(boost::ref(*http_src));
 
-    std::stringstream response;
+    // Read the response directly into the string that gets passed on.
+    std::string response;
+    auto sink = boost::iostreams::back_inserter(response);
     if (http_src->header("content-encoding") == "gzip") {
       try {
         boost::iostreams::filtering_streambuf<boost::iostreams::input> filter;
         filter.push(boost::iostreams::gzip_decompressor());
         filter.push(s);
-        boost::iostreams::copy(filter, response);
+        boost::iostreams::copy(filter, sink);
       } catch (const boost::iostreams::gzip_error& e) {
         return cb(self, "", boost::system::error_code(error::GZIP_FAILURE,
                                                       webclient::cat_));
       }
     } else {
-      boost::iostreams::copy(s, response);
+      boost::iostreams::copy(s, sink);
     }
 
-    return cb(self, response.str(), boost::system::error_code());
+    return cb(self, std::move(response), boost::system::error_code());
   } else {
     return cb(self, "", ec);
   }
@@ -25,6 +25,10 @@ namespace http {
 /// To ensure that the http_con object won't be deleted after starting the
 /// asynchronous request, it keeps a std::shared_ptr to itself while requesting.
 /// Therefore, it is derived from std::enable_shared_from_this<http_con>.
+///
+/// All handlers of a connection (including the timeout timer) run through
+/// the connection's strand, so it can be used with an io_service that is run
+/// by multiple threads. The callback is called from within this strand.
 class http_con : public std::enable_shared_from_this<http_con> {
 public:
   /// Callback function definition. If the error code is 'Success', the string
@@ -110,6 +114,9 @@ private:
   /// The request socket.
   boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket_;
 
+  /// Strand serializing the handlers of this connection.
+  boost::asio::io_service::strand strand_;
+
   /// Timeout timer that will stop the request if a timeout occured.
   boost::asio::deadline_timer req_timeout_timer_;
 
@@ -21,8 +21,13 @@ namespace http {
 boost::regex http_source::chunk_size_rx_("\r?\n?[0-9a-fA-F]+\r\n");
 
 http_source::http_source(
-    boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket)
-    : socket_(socket), response_stream_(&buf_), status_code_(0), length_(0) {}
+    boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket,
+    boost::asio::io_service::strand* strand)
+    : socket_(socket),
+      strand_(strand),
+      response_stream_(&buf_),
+      status_code_(0),
+      length_(0) {}
 
 std::streamsize http_source::read(char_type* s, std::streamsize n) {
   std::size_t ret = std::min(static_cast<std::size_t>(n), response_.size());
@@ -59,7 +64,7 @@ void http_source::transfer(boost::system::error_code ec,
     }
 
     using std::placeholders::_1;
-    auto re = std::bind(&http_source::transfer, this, _1, cb);
+    auto re = strand_->wrap(std::bind(&http_source::transfer, this, _1, cb));
     std::size_t read, chunk_size, chunk_bytes, to_transfer, original;
 
     reenter(this) {
@@ -40,7 +40,9 @@ public:
 
   /// \param socket the socket to use for requests.
   ///        This needs to be already connected to the remote host.
-  http_source(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket);
+  /// \param strand the strand of the connection (serializes all handlers)
+  http_source(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket,
+              boost::asio::io_service::strand* strand);
 
   /// Starts the asynchronous operation.
   ///
@@ -82,6 +84,9 @@ private:
   /// Points to the socket to use for the communication.
   boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket_;
 
+  /// Points to the strand of the connection.
+  boost::asio::io_service::strand* strand_;
+
   /// Request buffer that will be sent.
   std::string request_;
 
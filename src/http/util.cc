@@ -99,7 +99,7 @@ std::string store_location(std::string p, const std::string& url) {
   // Insert location meta tag if head tag was found.
   if (head != std::string::npos) {
     std::string tag = "\n<meta name=\"location\" content=\"" + url + "\" />\n";
-    p = p.substr(0, head + 6) + tag + p.substr(head + 7, p.length());
+    p.replace(head + 6, 1, tag);
   }
 
   return p;
@@ -164,7 +164,7 @@ std::string tidy(std::string page) {
   }
 
   if (rc >= 0) {
-    page = std::string(reinterpret_cast<char*>(output.bp), output.size);
+    page.assign(reinterpret_cast<char*>(output.bp), output.size);
   }
 
   tidyBufFree(&output);
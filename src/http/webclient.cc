@@ -21,8 +21,11 @@ namespace http {
 error::http_category webclient::cat_;
 
 webclient::webclient(boost::asio::io_service* io_service,
-                     std::map<std::string, std::string> headers)
-    : headers_(std::move(headers)), io_service_(io_service) {}
+                     std::map<std::string, std::string> headers,
+                     boost::asio::io_service::strand* strand)
+    : headers_(std::move(headers)),
+      io_service_(io_service),
+      strand_(strand) {}
 
 webclient::~webclient() {}
 
@@ -56,8 +59,24 @@ void webclient::request(const url& u, int method, std::string body, callback cb,
   http_ptr c = std::make_shared<http_con>(io_service_, host, port, timeout);
   std::string req = util::build_request(u, method, body, headers_, use_proxy);
 
-  c->operator()(req, boost::bind(&webclient::request_finish, this, u, timeout,
-                                 remaining_redirects, cb, _1, _2, _3));
+  c->operator()(std::move(req),
+                [this, u, timeout, remaining_redirects, cb](
+                    std::shared_ptr<http_con> con, std::string response,
+                    boost::system::error_code ec) {
+                  if (nullptr == strand_) {
+                    return request_finish(u, timeout, remaining_redirects,
+                                          cb, std::move(con),
+                                          std::move(response), ec);
+                  }
+
+                  // Continue in our strand (without copying the response).
+                  auto r = std::make_shared<std::string>(std::move(response));
+                  strand_->dispatch([this, u, timeout, remaining_redirects,
+                                     cb, con, r, ec]() {
+                    request_finish(u, timeout, remaining_redirects, cb, con,
+                                   std::move(*r), ec);
+                  });
+                });
 }
 
 void webclient::request_finish(const url& request_url,
@@ -74,10 +93,11 @@ void webclient::request_finish(const url& request_url,
     std::string u = con_ptr->http_src().header("location");
     if (u.empty() || !remaining_redirects) {
       if (!boost::ends_with(request_url.str(), ".xml")) {
-        response = util::tidy(response);
-        response = util::store_location(response, request_url.str());
+        response = util::tidy(std::move(response));
+        response = util::store_location(std::move(response),
+                                        request_url.str());
       }
-      return cb(response, ec);
+      return cb(std::move(response), ec);
     }
 
     // Fix relative location declaration.
@@ -10,6 +10,7 @@
 #include <map>
 
 #include "boost/asio/io_service.hpp"
+#include "boost/asio/strand.hpp"
 #include "boost/system/error_code.hpp"
 
 #include "pugixml.hpp"
@@ -32,8 +33,12 @@ class webclient {
                        > callback;
 
   /// \param io_service points to the Asio io_service object to use for requests
+  /// \param headers    the headers to send
+  /// \param strand     strand to run the request handlers and callbacks in
+  ///                   (nullptr: run them in the connection strand)
   webclient(boost::asio::io_service* io_service,
-            std::map<std::string, std::string> headers);
+            std::map<std::string, std::string> headers,
+            boost::asio::io_service::strand* strand = nullptr);
 
   virtual ~webclient();
 
@@ -111,6 +116,9 @@ class webclient {
 
   /// Points to the Asio io_service object to use for requests
   boost::asio::io_service* io_service_;
+
+  /// Strand serializing handlers and callbacks (may be nullptr).
+  boost::asio::io_service::strand* strand_;
 };
 
 }  // namespace http
@@ -0,0 +1,115 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./key_pool.h"
+
+#include <stdexcept>
+
+#include "boost/thread/locks.hpp"
+
+namespace botscript {
+
+boost::mutex key_pool::mutex_;
+std::atomic<key_pool::id> key_pool::size_(0);
+std::atomic<std::string*> key_pool::chunks_[KEY_POOL_MAX_CHUNKS];
+std::atomic<key_pool::table*> key_pool::table_(nullptr);
+std::vector<std::unique_ptr<key_pool::table>> key_pool::tables_;
+
+key_pool::table::table(std::size_t capacity)
+  : mask(capacity - 1),
+    slots(new std::atomic<id>[capacity]) {
+  for (std::size_t i = 0; i < capacity; ++i) {
+    slots[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+std::size_t key_pool::hash(boost::string_ref s) {
+  std::uint64_t h = 14695981039346656037ULL;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ULL;
+  }
+  return static_cast<std::size_t>(h);
+}
+
+void key_pool::insert(table* t, id key) {
+  std::size_t i = hash(str(key)) & t->mask;
+  while (t->slots[i].load(std::memory_order_relaxed) != 0) {
+    i = (i + 1) & t->mask;
+  }
+  t->slots[i].store(key + 1, std::memory_order_release);
+}
+
+key_pool::id key_pool::intern(boost::string_ref name) {
+  id key;
+  if (find(name, &key)) {
+    return key;
+  }
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  // Check again: another thread could have interned it meanwhile.
+  if (find(name, &key)) {
+    return key;
+  }
+
+  key = size_.load(std::memory_order_relaxed);
+  std::size_t chunk = key / KEY_POOL_CHUNK;
+  if (chunk >= KEY_POOL_MAX_CHUNKS) {
+    throw std::length_error("key pool exhausted");
+  }
+  std::string* names = chunks_[chunk].load(std::memory_order_relaxed);
+  if (names == nullptr) {
+    names = new std::string[KEY_POOL_CHUNK];
+    chunks_[chunk].store(names, std::memory_order_release);
+  }
+  names[key % KEY_POOL_CHUNK].assign(name.data(), name.size());
+  size_.store(key + 1, std::memory_order_release);
+
+  // Keep the load factor below 1/2: readers of the replaced table miss
+  // only names that are inserted after they started.
+  table* t = table_.load(std::memory_order_relaxed);
+  if (t == nullptr || 2 * (key + 1) > t->mask + 1) {
+    std::size_t capacity = t == nullptr ? 2 * KEY_POOL_CHUNK
+                                        : 2 * (t->mask + 1);
+    tables_.emplace_back(new table(capacity));
+    t = tables_.back().get();
+    for (id k = 0; k <= key; ++k) {
+      insert(t, k);
+    }
+    table_.store(t, std::memory_order_release);
+  } else {
+    insert(t, key);
+  }
+  return key;
+}
+
+bool key_pool::find(boost::string_ref name, id* out) {
+  const table* t = table_.load(std::memory_order_acquire);
+  if (t == nullptr) {
+    return false;
+  }
+
+  for (std::size_t i = hash(name) & t->mask;; i = (i + 1) & t->mask) {
+    id slot = t->slots[i].load(std::memory_order_acquire);
+    if (slot == 0) {
+      return false;
+    }
+    if (str(slot - 1) == name) {
+      *out = slot - 1;
+      return true;
+    }
+  }
+}
+
+const std::string& key_pool::str(id key) {
+  return chunks_[key / KEY_POOL_CHUNK].load(std::memory_order_acquire)
+      [key % KEY_POOL_CHUNK];
+}
+
+std::size_t key_pool::size() {
+  return size_.load(std::memory_order_acquire);
+}
+
+}  // namespace botscript
@@ -0,0 +1,100 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef KEY_POOL_H_
+#define KEY_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility/string_ref.hpp"
+#include "boost/thread/mutex.hpp"
+
+/// Names per storage chunk.
+#define KEY_POOL_CHUNK 1024
+
+/// Maximum number of storage chunks (KEY_POOL_CHUNK names each).
+#define KEY_POOL_MAX_CHUNKS 4096
+
+namespace botscript {
+
+/// Process wide pool of interned module and setting names.
+///
+/// Bots of the same package use the same module and setting names. Every name
+/// is stored once and identified by a small integer, so configurations can
+/// key their values by (module id, setting id) instead of string copies.
+/// Interned strings are never released: only the configurations intern
+/// (the names of the stored settings). Lookups from commands use find() and
+/// don't intern arbitrary names.
+///
+/// Reads (find(), str(), size()) don't lock: names are stored in append-only
+/// chunks and looked up in an open addressing table that is replaced (not
+/// modified in place) when it grows. Only intern() takes a lock to insert.
+class key_pool {
+ public:
+  typedef std::uint32_t id;
+
+  /// Interns the given name (inserts it if it is new).
+  ///
+  /// \param name  the name to intern
+  /// \return the id of the name
+  static id intern(boost::string_ref name);
+
+  /// Looks up the id of a name without inserting it (doesn't allocate).
+  ///
+  /// \param name  the name to look up
+  /// \param out   the id to write (only written if the name was found)
+  /// \return whether the name is interned
+  static bool find(boost::string_ref name, id* out);
+
+  /// \param key  the id to resolve (has to be returned by intern())
+  /// \return the interned string (valid until the program ends)
+  static const std::string& str(id key);
+
+  /// \return the number of interned names
+  static std::size_t size();
+
+  /// \return a single key for the pair (module id, setting id)
+  static std::uint64_t pair(id module, id key) {
+    return (static_cast<std::uint64_t>(module) << 32) | key;
+  }
+
+ private:
+  /// Open addressing table of ids (id + 1, 0 = empty slot).
+  struct table {
+    explicit table(std::size_t capacity);
+
+    std::size_t mask;
+    std::unique_ptr<std::atomic<id>[]> slots;
+  };
+
+  /// FNV-1a hash on string references.
+  static std::size_t hash(boost::string_ref s);
+
+  /// Inserts the id into the table (the name has to be stored).
+  static void insert(table* t, id key);
+
+  /// Serializes intern() calls.
+  static boost::mutex mutex_;
+
+  /// Number of stored names (published after the name is stored).
+  static std::atomic<id> size_;
+
+  /// Storage chunks of the names (KEY_POOL_CHUNK names each).
+  static std::atomic<std::string*> chunks_[KEY_POOL_MAX_CHUNKS];
+
+  /// The current table.
+  static std::atomic<table*> table_;
+
+  /// All tables (replaced tables may still be read, they are kept).
+  static std::vector<std::unique_ptr<table>> tables_;
+};
+
+}  // namespace botscript
+
+#endif  // KEY_POOL_H_
@@ -0,0 +1,237 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./log_bot_config.h"
+
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+namespace botscript {
+
+namespace {
+
+// Record types. Every record consists of the type and its fields, each field
+// is prefixed with its length (4 byte).
+enum : char {
+  BASE     = 'B',  // identifier, username, password, package, server
+  SET      = 'S',  // module, key, value
+  COOKIES  = 'C',  // name, value, name, value, ...
+  INACTIVE = 'I'   // "1" or "0"
+};
+
+std::string make_record(char type,
+                        std::initializer_list<boost::string_ref> fields) {
+  std::string record(1, type);
+  for (const auto& field : fields) {
+    record_log::put_field(&record, field);
+  }
+  return record;
+}
+
+std::string cookies_record(const std::map<std::string, std::string>& cookies) {
+  std::string record(1, COOKIES);
+  for (const auto& cookie : cookies) {
+    record_log::put_field(&record, cookie.first);
+    record_log::put_field(&record, cookie.second);
+  }
+  return record;
+}
+
+}  // namespace
+
+log_bot_config::log_bot_config(const std::string& path, std::size_t sync_every)
+    : log_(path, sync_every,
+           [this](boost::string_ref record) { replay(record); }),
+      snapshot_size_(log_.size()) {
+  if (state_ == nullptr) {
+    throw std::runtime_error(path + ": no configuration");
+  }
+}
+
+log_bot_config::log_bot_config(const std::string& path,
+                               const bot_config& initial,
+                               std::size_t sync_every)
+    : state_(new mem_bot_config(initial.identifier(), initial.username(),
+                                initial.password(), initial.package(),
+                                initial.server(), initial.module_settings())),
+      log_(path, sync_every, nullptr),
+      snapshot_size_(0) {
+  state_->inactive(initial.inactive());
+  state_->cookies(initial.cookies());
+  compact();
+}
+
+void log_bot_config::replay(boost::string_ref record) {
+  if (record.empty()) {
+    return;
+  }
+
+  char type = record.front();
+  record.remove_prefix(1);
+  std::vector<std::string> f;
+  boost::string_ref field;
+  while (record_log::get_field(&record, &field)) {
+    f.push_back(field.to_string());
+  }
+
+  // Everything before the base record is meaningless.
+  if (type == BASE && f.size() == 5) {
+    state_.reset(new mem_bot_config(f[0], f[1], f[2], f[3], f[4],
+                                    std::map<std::string, string_map>()));
+    return;
+  } else if (state_ == nullptr) {
+    return;
+  }
+
+  switch (type) {
+    case SET:
+      if (f.size() == 3) {
+        state_->set(f[0], f[1], f[2]);
+      }
+      break;
+
+    case COOKIES: {
+      std::map<std::string, std::string> cookies;
+      for (std::size_t i = 0; i + 1 < f.size(); i += 2) {
+        cookies[f[i]] = f[i + 1];
+      }
+      state_->cookies(cookies);
+      break;
+    }
+
+    case INACTIVE:
+      if (f.size() == 1) {
+        state_->inactive(f[0] == "1");
+      }
+      break;
+  }
+}
+
+void log_bot_config::append(const std::string& record) {
+  log_.append(record);
+  if (log_.size() > LOG_CONFIG_COMPACT_MIN &&
+      log_.size() > LOG_CONFIG_COMPACT_RATIO * snapshot_size_) {
+    compact();
+  }
+}
+
+void log_bot_config::flush() {
+  log_.sync();
+}
+
+void log_bot_config::compact() {
+  std::vector<std::string> records;
+  records.push_back(make_record(BASE, { state_->identifier(),
+                                        state_->username(),
+                                        state_->password(),
+                                        state_->package(),
+                                        state_->server() }));
+  records.push_back(make_record(INACTIVE, { state_->inactive() ? "1" : "0" }));
+  records.push_back(cookies_record(state_->cookies()));
+  state_->visit([&records](const std::string& module, const std::string& key,
+                           const std::string& value) {
+    records.push_back(make_record(SET, { module, key, value }));
+  });
+
+  log_.rewrite(records);
+  snapshot_size_ = log_.size();
+}
+
+command_sequence log_bot_config::init_command_sequence() const {
+  return state_->init_command_sequence();
+}
+
+std::string log_bot_config::to_json(bool with_password) const {
+  return state_->to_json(with_password);
+}
+
+std::string log_bot_config::value_of(const std::string& key) const {
+  return state_->value_of(key);
+}
+
+const std::string* log_bot_config::find(boost::string_ref module,
+                                        boost::string_ref key) const {
+  return state_->find(module, key);
+}
+
+void log_bot_config::visit(const setting_visitor& visitor) const {
+  state_->visit(visitor);
+}
+
+void log_bot_config::visit(boost::string_ref module,
+                           const setting_visitor& visitor) const {
+  state_->visit(module, visitor);
+}
+
+bool log_bot_config::has_cookies() const {
+  return state_->has_cookies();
+}
+
+void log_bot_config::inactive(bool flag) {
+  state_->inactive(flag);
+  append(make_record(INACTIVE, { flag ? "1" : "0" }));
+}
+
+bool log_bot_config::inactive() const {
+  return state_->inactive();
+}
+
+std::string log_bot_config::identifier() const {
+  return state_->identifier();
+}
+
+std::string log_bot_config::username() const {
+  return state_->username();
+}
+
+std::string log_bot_config::password() const {
+  return state_->password();
+}
+
+std::string log_bot_config::package() const {
+  return state_->package();
+}
+
+std::string log_bot_config::server() const {
+  return state_->server();
+}
+
+std::map<std::string, string_map> log_bot_config::module_settings() const {
+  return state_->module_settings();
+}
+
+std::map<std::string, std::string> log_bot_config::cookies() const {
+  return state_->cookies();
+}
+
+void log_bot_config::cookies(
+    std::map<std::string, std::string> const& cookies) {
+  state_->cookies(cookies);
+  append(cookies_record(cookies));
+}
+
+std::size_t log_bot_config::settings_footprint() const {
+  return state_->settings_footprint();
+}
+
+std::size_t log_bot_config::cookies_footprint() const {
+  return state_->cookies_footprint();
+}
+
+void log_bot_config::set(const std::string& module,
+                         const std::string& key,
+                         const std::string& value) {
+  state_->set(module, key, value);
+  append(make_record(SET, { module, key, value }));
+}
+
+void log_bot_config::set(const std::string& key, const std::string& value) {
+  auto pos = key.find("_");
+  if (pos != std::string::npos) {
+    set(key.substr(0, pos), key.substr(pos + 1), value);
+  }
+}
+
+}  // namespace botscript
@@ -0,0 +1,114 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef LOG_CONFIG_H_
+#define LOG_CONFIG_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "./bot_config.h"
+#include "./mem_bot_config.h"
+#include "./record_log.h"
+
+/// Compact when the log is this many times larger than the last snapshot...
+#define LOG_CONFIG_COMPACT_RATIO 4
+
+/// ...and larger than this (in bytes).
+#define LOG_CONFIG_COMPACT_MIN (1024 * 1024)
+
+namespace botscript {
+
+/// Persistent configuration: every mutation (set, cookies, inactive) is
+/// appended to a record_log in O(1). The current state is held in memory and
+/// restored by replaying the log. When the log grows too large, it gets
+/// compacted to a snapshot of the current state.
+class log_bot_config : public bot_config {
+ public:
+  /// Opens an existing configuration log.
+  ///
+  /// \param path        the log file path
+  /// \param sync_every  flush the log to disk every n mutations
+  ///                    (0 = only on flush() and compaction)
+  /// \throws std::runtime_error if the log contains no configuration
+  log_bot_config(const std::string& path, std::size_t sync_every);
+
+  /// Creates a configuration log (replaces an existing log).
+  ///
+  /// \param path        the log file path
+  /// \param initial     the configuration to store initially
+  /// \param sync_every  flush the log to disk every n mutations
+  log_bot_config(const std::string& path, const bot_config& initial,
+                 std::size_t sync_every);
+
+  virtual command_sequence init_command_sequence() const override;
+  virtual std::string to_json(bool with_password) const override;
+  virtual std::string value_of(const std::string& key) const override;
+  using bot_config::value_of;
+
+  virtual const std::string* find(boost::string_ref module,
+                                  boost::string_ref key) const override;
+  virtual void visit(const setting_visitor& visitor) const override;
+  virtual void visit(boost::string_ref module,
+                     const setting_visitor& visitor) const override;
+  virtual bool has_cookies() const override;
+
+  virtual void inactive(bool flag) override;
+  virtual bool inactive() const override;
+
+  virtual std::string identifier() const override;
+  virtual std::string username() const override;
+  virtual std::string password() const override;
+  virtual std::string package() const override;
+  virtual std::string server() const override;
+  virtual std::map<std::string, string_map> module_settings() const override;
+
+  virtual std::map<std::string, std::string> cookies() const override;
+  virtual void cookies(std::map<std::string, std::string> const&) override;
+
+  virtual std::size_t settings_footprint() const override;
+  virtual std::size_t cookies_footprint() const override;
+
+  virtual void set(const std::string& module,
+                   const std::string& key,
+                   const std::string& value) override;
+  virtual void set(const std::string& key,
+                   const std::string& value) override;
+
+  /// Flushes all mutations to disk.
+  virtual void flush() override;
+
+  /// Replaces the log with a snapshot of the current state.
+  void compact();
+
+  /// \return the log size in bytes
+  std::size_t log_size() const { return log_.size(); }
+
+ private:
+  /// Applies a record read from the log.
+  ///
+  /// \param record  the record to apply
+  void replay(boost::string_ref record);
+
+  /// Appends a record and compacts the log if it grew too large.
+  /// Has to be called after the mutation was applied to the state (the
+  /// snapshot written by the compaction includes it).
+  ///
+  /// \param record  the record to append
+  void append(const std::string& record);
+
+  /// The current state.
+  std::unique_ptr<mem_bot_config> state_;
+
+  record_log log_;
+
+  /// Size of the log after the last compaction.
+  std::size_t snapshot_size_;
+};
+
+}  // namespace botscript
+
+#endif  // LOG_CONFIG_H_
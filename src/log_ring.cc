@@ -0,0 +1,163 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./log_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "boost/asio/error.hpp"
+
+namespace botscript {
+
+std::atomic<std::time_t> coarse_clock::now_(0);
+std::atomic<bool> coarse_clock::running_(false);
+std::unique_ptr<boost::asio::deadline_timer> coarse_clock::timer_;
+
+std::time_t coarse_clock::now() {
+  return running_ ? now_.load() : std::time(nullptr);
+}
+
+void coarse_clock::start(boost::asio::io_service* io_service) {
+  timer_.reset(new boost::asio::deadline_timer(*io_service));
+  now_ = std::time(nullptr);
+  running_ = true;
+  tick();
+}
+
+void coarse_clock::stop() {
+  running_ = false;
+  if (timer_ != nullptr) {
+    timer_->cancel();
+  }
+}
+
+void coarse_clock::tick() {
+  timer_->expires_from_now(boost::posix_time::seconds(1));
+  timer_->async_wait([](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted || !running_) {
+      return;
+    }
+    now_ = std::time(nullptr);
+    tick();
+  });
+}
+
+log_ring::log_ring(std::size_t capacity)
+    : capacity_(std::max<std::size_t>(1, capacity)),
+      first_(0),
+      size_(0),
+      cache_valid_(false),
+      formatted_time_(-1) {
+  time_str_[0] = '\0';
+}
+
+void log_ring::push(int level, boost::string_ref source,
+                    boost::string_ref message) {
+  if (records_ == nullptr) {
+    records_.reset(new record[capacity_]);
+  }
+
+  // Overwrite the oldest record if the ring is full.
+  record* r;
+  if (size_ == capacity_) {
+    r = &records_[first_];
+    first_ = (first_ + 1) % capacity_;
+  } else {
+    r = &records_[(first_ + size_) % capacity_];
+    ++size_;
+  }
+
+  r->time = coarse_clock::now();
+  r->level = static_cast<std::uint8_t>(level);
+  r->source_size = static_cast<std::uint8_t>(
+      std::min<std::size_t>(source.size(), LOG_RING_SOURCE_SIZE));
+  std::memcpy(r->source, source.data(), r->source_size);
+
+  // Cut messages are marked with "...".
+  if (message.size() > LOG_RING_MESSAGE_SIZE) {
+    std::memcpy(r->message, message.data(), LOG_RING_MESSAGE_SIZE - 3);
+    std::memcpy(r->message + LOG_RING_MESSAGE_SIZE - 3, "...", 3);
+    r->message_size = LOG_RING_MESSAGE_SIZE;
+  } else {
+    std::memcpy(r->message, message.data(), message.size());
+    r->message_size = static_cast<std::uint16_t>(message.size());
+  }
+
+  cache_valid_ = false;
+}
+
+std::string log_ring::line(int level, const std::string& identifier,
+                           boost::string_ref source,
+                           boost::string_ref message) {
+  std::string line;
+  format(level, coarse_clock::now(), identifier, source, message, &line);
+  return line;
+}
+
+const std::string& log_ring::str(const std::string& identifier) {
+  if (!cache_valid_) {
+    cache_.clear();
+    for (std::size_t i = 0; i < size_; ++i) {
+      const record& r = records_[(first_ + i) % capacity_];
+      format(r.level, r.time, identifier,
+             boost::string_ref(r.source, r.source_size),
+             boost::string_ref(r.message, r.message_size), &cache_);
+    }
+    cache_valid_ = true;
+  }
+  return cache_;
+}
+
+void log_ring::trim(std::size_t n) {
+  if (size_ > n) {
+    first_ = (first_ + size_ - n) % capacity_;
+    size_ = n;
+  }
+  std::string().swap(cache_);
+  cache_valid_ = false;
+}
+
+void log_ring::clear() {
+  records_.reset();
+  first_ = 0;
+  size_ = 0;
+  std::string().swap(cache_);
+  cache_valid_ = false;
+}
+
+std::size_t log_ring::footprint() const {
+  return (records_ != nullptr ? capacity_ * sizeof(record) : 0) +
+         cache_.capacity();
+}
+
+void log_ring::format(int level, std::time_t time,
+                      const std::string& identifier, boost::string_ref source,
+                      boost::string_ref message, std::string* out) {
+  static const char* levels[] = { "[DEBUG]", "[INFO ]", "[ERROR]" };
+
+  if (time != formatted_time_) {
+    std::tm local;
+#if defined _WIN32 || defined _WIN64
+    localtime_s(&local, &time);
+#else
+    localtime_r(&time, &local);
+#endif
+    std::strftime(time_str_, sizeof(time_str_), "%d.%m %H:%M:%S", &local);
+    formatted_time_ = time;
+  }
+
+  out->append(level >= 0 && level < 3 ? levels[level] : "");
+  out->append("[").append(time_str_).append("][").append(identifier);
+  if (identifier.size() < 20) {
+    out->append(20 - identifier.size(), ' ');
+  }
+  out->append("][").append(source.data(), source.size());
+  if (source.size() < 8) {
+    out->append(8 - source.size(), ' ');
+  }
+  out->append("] ").append(message.data(), message.size()).append("\n");
+}
+
+}  // namespace botscript
@@ -0,0 +1,143 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef LOG_RING_H_
+#define LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#include "boost/asio/deadline_timer.hpp"
+#include "boost/asio/io_service.hpp"
+#include "boost/utility/string_ref.hpp"
+
+/// Maximum length of a log source (longer sources are cut).
+#define LOG_RING_SOURCE_SIZE 16
+
+/// Maximum length of a log message (longer messages are cut).
+#define LOG_RING_MESSAGE_SIZE 200
+
+namespace botscript {
+
+/// Process wide clock with a resolution of one second for log timestamps.
+/// While started, the time is cached and refreshed by a timer every second.
+class coarse_clock {
+ public:
+  /// \return the cached time (the current time if the clock is not started)
+  static std::time_t now();
+
+  /// Starts refreshing the cached time every second.
+  ///
+  /// \param io_service  the io_service running the refresh timer
+  static void start(boost::asio::io_service* io_service);
+
+  /// Stops refreshing (now() returns the current time again).
+  static void stop();
+
+ private:
+  /// Refreshes the cached time and arms the timer.
+  static void tick();
+
+  static std::atomic<std::time_t> now_;
+  static std::atomic<bool> running_;
+  static std::unique_ptr<boost::asio::deadline_timer> timer_;
+};
+
+/// Ring of the last log messages of a bot.
+///
+/// Messages are stored as fixed-size records (level, coarse timestamp,
+/// source and message) in a buffer allocated with the first message, the
+/// oldest record is overwritten when the ring is full. Records are only
+/// formatted when they are read. The concatenated output of all records is
+/// cached until the next message arrives.
+///
+/// Like the bot it belongs to, the ring has a single writer (the bot's
+/// strand) and needs no locking.
+class log_ring {
+ public:
+  /// \param capacity  the maximum number of records
+  explicit log_ring(std::size_t capacity);
+
+  /// Appends a record, overwriting the oldest one if the ring is full.
+  ///
+  /// \param level    the log level (bot::BS_LOG_DBG, _NFO or _ERR)
+  /// \param source   the log source
+  /// \param message  the log message
+  void push(int level, boost::string_ref source, boost::string_ref message);
+
+  /// Formats a line like the stored records (without storing or cutting
+  /// it), for example to pass it to the update callback.
+  ///
+  /// \param level       the log level
+  /// \param identifier  the bot identifier to show in the line
+  /// \param source      the log source
+  /// \param message     the log message
+  /// \return the formatted line
+  std::string line(int level, const std::string& identifier,
+                   boost::string_ref source, boost::string_ref message);
+
+  /// \param identifier  the bot identifier to show in the lines
+  /// \return all records formatted, oldest first (cached until the next push)
+  const std::string& str(const std::string& identifier);
+
+  /// Drops all but the last n records and the cached output.
+  ///
+  /// \param n  the number of records to keep
+  void trim(std::size_t n);
+
+  /// Drops all records and releases the buffer.
+  void clear();
+
+  /// \return the number of records
+  std::size_t size() const { return size_; }
+
+  /// \return the memory held by the ring (buffer and cached output)
+  std::size_t footprint() const;
+
+ private:
+  /// A log record.
+  struct record {
+    std::time_t time;
+    std::uint16_t message_size;
+    std::uint8_t level;
+    std::uint8_t source_size;
+    char source[LOG_RING_SOURCE_SIZE];
+    char message[LOG_RING_MESSAGE_SIZE];
+  };
+
+  /// Appends a formatted line to the output:
+  /// "[LEVEL][dd.mm HH:MM:SS][identifier][source] message\n"
+  ///
+  /// \param level       the log level
+  /// \param time        the timestamp
+  /// \param identifier  the bot identifier (padded to 20 characters)
+  /// \param source      the log source (padded to 8 characters)
+  /// \param message     the log message
+  /// \param out         the output to append to
+  void format(int level, std::time_t time, const std::string& identifier,
+              boost::string_ref source, boost::string_ref message,
+              std::string* out);
+
+  std::size_t capacity_;
+  std::unique_ptr<record[]> records_;
+
+  /// Index of the oldest record and number of records.
+  std::size_t first_, size_;
+
+  /// Cached output of str() (valid if cache_valid_).
+  std::string cache_;
+  bool cache_valid_;
+
+  /// Last formatted timestamp (records of the same second share it).
+  std::time_t formatted_time_;
+  char time_str_[16];
+};
+
+}  // namespace botscript
+
+#endif  // LOG_RING_H_
@@ -0,0 +1,300 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./log_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+#include <utility>
+
+#if defined _WIN32 || defined _WIN64
+#include <io.h>
+#include <sys/stat.h>
+#include <cstdio>
+#else
+#include <unistd.h>
+#endif
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/filesystem.hpp"
+
+namespace botscript {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+#if defined _WIN32 || defined _WIN64
+int open_append(const std::string& path) {
+  return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+}
+
+long write_some(int fd, const char* data, std::size_t size) {
+  return _write(fd, data, static_cast<unsigned int>(size));
+}
+
+std::size_t size_of(int fd) {
+  long size = _lseek(fd, 0, SEEK_END);
+  return size < 0 ? 0 : static_cast<std::size_t>(size);
+}
+
+void close_fd(int fd) { _close(fd); }
+
+int stdout_fd() { return _fileno(stdout); }
+#else
+int open_append(const std::string& path) {
+  return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
+
+long write_some(int fd, const char* data, std::size_t size) {
+  return ::write(fd, data, size);
+}
+
+std::size_t size_of(int fd) {
+  off_t size = ::lseek(fd, 0, SEEK_END);
+  return size < 0 ? 0 : static_cast<std::size_t>(size);
+}
+
+void close_fd(int fd) { ::close(fd); }
+
+int stdout_fd() { return STDOUT_FILENO; }
+#endif
+
+}  // namespace
+
+log_sink::log_sink(const std::string& directory, file_fn file_of,
+                   std::size_t rotate_bytes, int rotate_seconds)
+    : directory_(directory),
+      file_of_(std::move(file_of)),
+      rotate_bytes_(rotate_bytes),
+      rotate_seconds_(std::max(0, rotate_seconds)),
+      queue_(LOG_SINK_CAPACITY),
+      stopped_(false),
+      pushed_(0),
+      dropped_(0),
+      lines_(0),
+      writes_(0),
+      bytes_(0),
+      rotations_(0),
+      errors_(0) {
+  if (!directory_.empty()) {
+    fs::create_directories(directory_);
+  }
+  writer_ = boost::thread([this]() { run(); });
+}
+
+log_sink::~log_sink() {
+  stop();
+
+  // Lines pushed while stopping.
+  entry* e;
+  while (queue_.pop(e)) {
+    delete e;
+    ++dropped_;
+  }
+}
+
+bool log_sink::push(std::string identifier, std::string line) {
+  if (stopped_) {
+    ++dropped_;
+    return false;
+  }
+
+  entry* e = new entry{ std::move(identifier), std::move(line) };
+  if (!queue_.bounded_push(e)) {
+    delete e;
+    ++dropped_;
+    return false;
+  }
+  ++pushed_;
+  return true;
+}
+
+void log_sink::stop() {
+  stopped_ = true;
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+log_sink::statistics log_sink::stats() const {
+  statistics s;
+  s.pushed = pushed_;
+  s.dropped = dropped_;
+  s.lines = lines_;
+  s.writes = writes_;
+  s.bytes = bytes_;
+  s.rotations = rotations_;
+  s.errors = errors_;
+  return s;
+}
+
+log_sink::file_fn log_sink::single(const std::string& name) {
+  return [name](const std::string&) { return name; };
+}
+
+log_sink::file_fn log_sink::per_bot() {
+  return [](const std::string& identifier) {
+    std::string name = identifier.empty() ? std::string("botscript")
+                                          : identifier;
+    for (char& c : name) {
+      bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+                     c == '.';
+      if (!allowed) {
+        c = '_';
+      }
+    }
+    return name;
+  };
+}
+
+void log_sink::run() {
+  for (;;) {
+    // Read the flag before draining: lines pushed before stop() are written.
+    bool stopping = stopped_;
+
+    // Collect the queued lines by file.
+    std::unordered_map<std::string, std::string> batch;
+    std::size_t bytes = 0, lines = 0;
+    entry* e;
+    while (bytes < LOG_SINK_BATCH_BYTES && queue_.pop(e)) {
+      std::unique_ptr<entry> owned(e);
+      std::string name = directory_.empty() ? std::string()
+                                            : file_of_(e->identifier);
+      batch[name] += e->line;
+      bytes += e->line.size();
+      ++lines;
+    }
+
+    for (const auto& b : batch) {
+      write(b.first, b.second);
+    }
+    lines_ += lines;
+
+    if (bytes == 0) {
+      if (stopping) {
+        break;
+      }
+      boost::this_thread::sleep(
+          boost::posix_time::milliseconds(LOG_SINK_IDLE_MS));
+    }
+  }
+
+  for (const auto& f : files_) {
+    close_fd(f.second.fd);
+  }
+  files_.clear();
+}
+
+void log_sink::write(const std::string& name, const std::string& data) {
+  std::time_t now = std::time(nullptr);
+
+  file* f = nullptr;
+  int fd = stdout_fd();
+  if (!directory_.empty()) {
+    if ((f = open(name)) == nullptr) {
+      ++errors_;
+      return;
+    }
+
+    bool full = rotate_bytes_ > 0 && f->size + data.size() > rotate_bytes_;
+    bool old = rotate_seconds_ > 0 && now - f->opened >= rotate_seconds_;
+    if (f->size > 0 && (full || old) && !rotate(name, f)) {
+      return;
+    }
+    fd = f->fd;
+  }
+
+  // Write everything (write may write less than requested).
+  std::size_t written = 0;
+  while (written < data.size()) {
+    long n = write_some(fd, data.data() + written, data.size() - written);
+    ++writes_;
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      ++errors_;
+      break;
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  bytes_ += written;
+
+  if (f != nullptr) {
+    f->size += written;
+    f->last_write = now;
+  }
+}
+
+log_sink::file* log_sink::open(const std::string& name) {
+  auto it = files_.find(name);
+  if (it != files_.end()) {
+    return &it->second;
+  }
+
+  // Close the least recently written file if too many files are open.
+  if (files_.size() >= LOG_SINK_MAX_OPEN) {
+    auto oldest = files_.begin();
+    for (auto i = files_.begin(); i != files_.end(); ++i) {
+      if (i->second.last_write < oldest->second.last_write) {
+        oldest = i;
+      }
+    }
+    close_fd(oldest->second.fd);
+    files_.erase(oldest);
+  }
+
+  int fd = open_append(path(name));
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::time_t now = std::time(nullptr);
+  file& f = files_[name];
+  f.fd = fd;
+  f.size = size_of(fd);
+  f.opened = now;
+  f.last_write = now;
+  return &f;
+}
+
+bool log_sink::rotate(const std::string& name, file* f) {
+  close_fd(f->fd);
+
+  // Rename to {path}.{time}, add a counter if rotated twice a second.
+  std::string current = path(name);
+  std::string rotated = current + "." + boost::posix_time::to_iso_string(
+      boost::posix_time::second_clock::local_time());
+  std::string target = rotated;
+  boost::system::error_code ec;
+  for (int i = 1; fs::exists(target, ec); ++i) {
+    target = rotated + "-" + std::to_string(i);
+  }
+  fs::rename(current, target, ec);
+  if (ec) {
+    ++errors_;
+  } else {
+    ++rotations_;
+  }
+
+  int fd = open_append(current);
+  if (fd < 0) {
+    files_.erase(name);
+    ++errors_;
+    return false;
+  }
+  f->fd = fd;
+  f->size = size_of(fd);
+  f->opened = std::time(nullptr);
+  return true;
+}
+
+std::string log_sink::path(const std::string& name) const {
+  return (fs::path(directory_) / (name + ".log")).string();
+}
+
+}  // namespace botscript
@@ -0,0 +1,171 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef LOG_SINK_H_
+#define LOG_SINK_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "boost/lockfree/queue.hpp"
+#include "boost/thread/thread.hpp"
+
+/// Capacity of the log line queue (lines pushed to a full queue are dropped).
+#define LOG_SINK_CAPACITY 65536
+
+/// Maximum number of bytes collected before they are written.
+#define LOG_SINK_BATCH_BYTES (1 << 20)
+
+/// Time the writer sleeps if the queue is empty (milliseconds).
+#define LOG_SINK_IDLE_MS 50
+
+/// Maximum number of open log files (the least recently written is closed).
+#define LOG_SINK_MAX_OPEN 256
+
+namespace botscript {
+
+/// Asynchronous log output to files (or to stdout).
+///
+/// Log lines are pushed into a lock-free queue and written by a background
+/// thread: all lines queued for a file are collected and written with one
+/// write(2) call. Pushing never blocks, if the queue is full the line is
+/// dropped (and counted).
+///
+/// Each line is written to the file the file function returns for the
+/// identifier of the bot ({directory}/{name}.log), so lines can be split by
+/// bot, by shard or not at all. Files are rotated ({name}.log renamed to
+/// {name}.log.{time}) when they exceed the size limit or when they were
+/// opened longer ago than the rotation interval.
+class log_sink {
+ public:
+  /// Maps a bot identifier to a file name (without directory and ".log").
+  /// Called on the writer thread.
+  typedef std::function<std::string (const std::string& identifier)> file_fn;
+
+  /// Output statistics.
+  struct statistics {
+    statistics()
+      : pushed(0), dropped(0), lines(0), writes(0), bytes(0), rotations(0),
+        errors(0) {
+    }
+
+    std::uint64_t pushed;     ///< lines queued
+    std::uint64_t dropped;    ///< lines dropped (queue full or stopped)
+    std::uint64_t lines;      ///< lines written (or failed to write)
+    std::uint64_t writes;     ///< write calls
+    std::uint64_t bytes;      ///< bytes written
+    std::uint64_t rotations;  ///< rotated files
+    std::uint64_t errors;     ///< failed opens, writes and renames
+  };
+
+  /// Starts the writer thread.
+  ///
+  /// \param directory       the log directory (created if missing), empty to
+  ///                        write all lines to stdout (without rotation)
+  /// \param file_of         the file function (see single(), per_bot())
+  /// \param rotate_bytes    the file size to rotate at (0 = never)
+  /// \param rotate_seconds  the file age to rotate at (0 = never)
+  /// \throws boost::filesystem::filesystem_error if the directory can't be
+  ///         created
+  log_sink(const std::string& directory, file_fn file_of,
+           std::size_t rotate_bytes, int rotate_seconds);
+
+  /// Writes the queued lines and stops the writer thread.
+  ~log_sink();
+
+  log_sink(const log_sink&) = delete;
+  log_sink& operator=(const log_sink&) = delete;
+
+  /// Queues a log line (thread safe, never blocks).
+  ///
+  /// \param identifier  the bot identifier
+  /// \param line        the log line (including the line break)
+  /// \return false if the line was dropped
+  bool push(std::string identifier, std::string line);
+
+  /// Writes the queued lines, stops the writer thread and closes the files.
+  /// Lines pushed afterwards are dropped.
+  void stop();
+
+  /// \return the output statistics
+  statistics stats() const;
+
+  /// \param name the file name
+  /// \return a file function writing all lines to one file
+  static file_fn single(const std::string& name);
+
+  /// \return a file function writing one file per bot (named like the bot
+  ///         identifier, characters not allowed in file names replaced)
+  static file_fn per_bot();
+
+ private:
+  /// A queued log line.
+  struct entry {
+    std::string identifier;
+    std::string line;
+  };
+
+  /// An open log file.
+  struct file {
+    int fd;
+    std::size_t size;
+    std::time_t opened;
+    std::time_t last_write;
+  };
+
+  /// Writer thread: drains the queue, writes the batches.
+  void run();
+
+  /// Writes data to the log file with the given name (rotates it if needed).
+  ///
+  /// \param name  the file name
+  /// \param data  the lines to write
+  void write(const std::string& name, const std::string& data);
+
+  /// \param name the file name
+  /// \return the open file (opened if necessary) or nullptr on failure
+  file* open(const std::string& name);
+
+  /// Closes the file, renames it to {path}.{time} and opens a new one.
+  ///
+  /// \param name  the file name
+  /// \param f     the open file
+  /// \return whether a new file could be opened
+  bool rotate(const std::string& name, file* f);
+
+  /// \param name the file name
+  /// \return the path of the log file
+  std::string path(const std::string& name) const;
+
+  std::string directory_;
+  file_fn file_of_;
+  std::size_t rotate_bytes_;
+  int rotate_seconds_;
+
+  /// Queued lines (owned by the queue until they are written).
+  boost::lockfree::queue<entry*> queue_;
+  std::atomic<bool> stopped_;
+
+  /// Open files (writer thread only).
+  std::unordered_map<std::string, file> files_;
+
+  boost::thread writer_;
+
+  std::atomic<std::uint64_t> pushed_;
+  std::atomic<std::uint64_t> dropped_;
+  std::atomic<std::uint64_t> lines_;
+  std::atomic<std::uint64_t> writes_;
+  std::atomic<std::uint64_t> bytes_;
+  std::atomic<std::uint64_t> rotations_;
+  std::atomic<std::uint64_t> errors_;
+};
+
+}  // namespace botscript
+
+#endif  // LOG_SINK_H_
@@ -0,0 +1,153 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./login_admission.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <utility>
+
+#include "boost/asio/deadline_timer.hpp"
+
+namespace botscript {
+
+namespace pt = boost::posix_time;
+
+// Initialization of the static login_admission class attributes.
+boost::mutex login_admission::mutex_;
+unsigned int login_admission::max_concurrent_ = 0;
+double login_admission::rate_ = 0.0;
+unsigned int login_admission::burst_ = 1;
+unsigned int login_admission::running_ = 0;
+std::deque<login_admission::waiter> login_admission::waiting_;
+std::map<std::string, login_admission::bucket> login_admission::buckets_;
+boost::asio::io_service* login_admission::refill_service_ = nullptr;
+pt::ptime login_admission::refill_due_;
+
+void login_admission::configure(unsigned int max_concurrent, double rate,
+                                unsigned int burst) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  max_concurrent_ = max_concurrent;
+  rate_ = std::max(0.0, rate);
+  burst_ = std::max(1u, burst);
+  buckets_.clear();
+  pump();
+}
+
+void login_admission::refill_service(boost::asio::io_service* io_service) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  refill_service_ = io_service;
+}
+
+void login_admission::acquire(boost::asio::io_service* io_service,
+                              const std::string& server,
+                              std::function<void()> start) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  waiting_.push_back(waiter{ io_service, server, std::move(start) });
+  pump();
+}
+
+void login_admission::release() {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  if (running_ > 0) {
+    --running_;
+  }
+  pump();
+}
+
+unsigned int login_admission::running() {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return running_;
+}
+
+std::size_t login_admission::waiting() {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return waiting_.size();
+}
+
+void login_admission::pump() {
+  pt::ptime now = pt::microsec_clock::universal_time();
+  pt::time_duration next_refill = pt::pos_infin;
+  boost::asio::io_service* refill_io_service = nullptr;
+
+  // Servers whose bucket is empty: keep the FIFO order per server.
+  std::set<std::string> blocked;
+
+  for (auto i = waiting_.begin(); i != waiting_.end();) {
+    if (max_concurrent_ != 0 && running_ >= max_concurrent_) {
+      break;
+    }
+
+    if (blocked.find(i->server) != blocked.end()) {
+      ++i;
+      continue;
+    }
+
+    pt::time_duration wait = take(i->server, now);
+    if (!wait.is_zero()) {
+      blocked.insert(i->server);
+      if (wait < next_refill) {
+        next_refill = wait;
+        refill_io_service = i->io_service;
+      }
+      ++i;
+      continue;
+    }
+
+    ++running_;
+    i->io_service->post(std::move(i->start));
+    i = waiting_.erase(i);
+  }
+
+  // Come back when the first empty bucket has been refilled. A pending
+  // timer overdue by more than a second will never fire (its io_service
+  // stopped): it is replaced.
+  bool pending = !refill_due_.is_not_a_date_time() &&
+                 now < refill_due_ + pt::seconds(1);
+  if (nullptr != refill_io_service && !pending) {
+    if (nullptr != refill_service_) {
+      refill_io_service = refill_service_;
+    }
+    refill_due_ = now + next_refill;
+    auto timer = std::make_shared<boost::asio::deadline_timer>(
+        *refill_io_service, next_refill);
+    timer->async_wait([timer](const boost::system::error_code& ec) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      refill_due_ = pt::ptime();
+      if (ec != boost::asio::error::operation_aborted) {
+        pump();
+      }
+    });
+  }
+}
+
+pt::time_duration login_admission::take(const std::string& server,
+                                        const pt::ptime& now) {
+  if (rate_ <= 0.0) {
+    return pt::time_duration(0, 0, 0);
+  }
+
+  auto i = buckets_.find(server);
+  if (i == buckets_.end()) {
+    i = buckets_.insert(std::make_pair(server, bucket{ double(burst_), now }))
+        .first;
+  }
+
+  // Refill.
+  bucket& b = i->second;
+  double elapsed = (now - b.updated).total_microseconds() / 1000000.0;
+  b.tokens = std::min<double>(burst_, b.tokens + elapsed * rate_);
+  b.updated = now;
+
+  if (b.tokens >= 1.0) {
+    b.tokens -= 1.0;
+    return pt::time_duration(0, 0, 0);
+  }
+
+  double missing = (1.0 - b.tokens) / rate_;
+  return pt::microseconds(static_cast<std::int64_t>(missing * 1000000) + 1);
+}
+
+}  // namespace botscript
@@ -0,0 +1,114 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef LOGIN_ADMISSION_H_
+#define LOGIN_ADMISSION_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/thread.hpp"
+
+namespace botscript {
+
+/// Fleet wide login admission control.
+///
+/// Limits the number of logins running concurrently (all servers) and the
+/// rate of logins per server (token bucket). Logins that can't be admitted
+/// are queued (FIFO) and started as soon as a running login finishes or the
+/// server bucket has been refilled.
+class login_admission {
+ public:
+  /// \param max_concurrent the maximum number of concurrent logins
+  ///                       (0 = unlimited)
+  /// \param rate           the logins per second per server (0 = unlimited)
+  /// \param burst          the number of logins a server bucket can hold
+  static void configure(unsigned int max_concurrent, double rate,
+                        unsigned int burst);
+
+  /// Sets the io_service running the refill timers. It should outlive the
+  /// bots (a timer on a stopped io_service never fires). Without it, the
+  /// timer runs on the io_service of the first rate limited login.
+  ///
+  /// \param io_service the io_service to run the refill timers on
+  static void refill_service(boost::asio::io_service* io_service);
+
+  /// Requests to start a login. The start function is posted to the given
+  /// io_service as soon as the login has been admitted. Every admitted login
+  /// has to be finished with release().
+  ///
+  /// \param io_service the io_service to post the start function to
+  /// \param server     the server to login to
+  /// \param start      the function starting the login
+  static void acquire(boost::asio::io_service* io_service,
+                      const std::string& server,
+                      std::function<void()> start);
+
+  /// Marks an admitted login as finished.
+  static void release();
+
+  /// \return the number of logins currently running
+  static unsigned int running();
+
+  /// \return the number of logins waiting for admission
+  static std::size_t waiting();
+
+ private:
+  /// A login waiting for admission.
+  struct waiter {
+    boost::asio::io_service* io_service;
+    std::string server;
+    std::function<void()> start;
+  };
+
+  /// Token bucket of a server.
+  struct bucket {
+    double tokens;
+    boost::posix_time::ptime updated;
+  };
+
+  /// Starts all waiting logins that can be admitted.
+  /// Has to be called with mutex_ locked.
+  static void pump();
+
+  /// Refills the bucket of the given server and takes a token if available.
+  /// Has to be called with mutex_ locked.
+  ///
+  /// \param server the server
+  /// \param now    the current time
+  /// \return the time until a token is available (zero if taken)
+  static boost::posix_time::time_duration take(
+      const std::string& server, const boost::posix_time::ptime& now);
+
+  /// Guards the members below.
+  static boost::mutex mutex_;
+
+  /// Configuration.
+  static unsigned int max_concurrent_;
+  static double rate_;
+  static unsigned int burst_;
+
+  /// Number of logins running.
+  static unsigned int running_;
+
+  /// Logins waiting for admission.
+  static std::deque<waiter> waiting_;
+
+  /// Token buckets (server -> bucket).
+  static std::map<std::string, bucket> buckets_;
+
+  /// io_service running the refill timers (may be nullptr).
+  static boost::asio::io_service* refill_service_;
+
+  /// Expiry of the pending refill timer (not_a_date_time if none).
+  static boost::posix_time::ptime refill_due_;
+};
+
+}  // namespace botscript
+
+#endif  // LOGIN_ADMISSION_H_
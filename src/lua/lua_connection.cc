@@ -5,6 +5,7 @@
 #include "./lua_connection.h"
 
 #include <cstring>
+#include <new>
 #include <sstream>
 
 #include "lua.h"
@@ -19,25 +20,25 @@ namespace botscript {
 std::map<std::string, std::shared_ptr<bot>> lua_connection::bots_;
 boost::mutex lua_connection::bots_mutex_;
 
+// The address of this variable is the registry key of the state context.
+static const char context_key = 0;
+
+// Name of the metatable of the state context userdata.
+static const char* const context_meta = "botscript.context";
+
 namespace json = rapidjson;
 
-jsonval_ptr lua_connection::iface(const std::string& script,
+jsonval_ptr lua_connection::iface(lua_State* state,
+                                  const std::string& script,
                                   const std::string& name,
                                   json::Document::AllocatorType* allocator) {
-  // Initialize lua_State.
-  lua_State* state = luaL_newstate();
-  if (nullptr == state) {
-    throw lua_exception("could not create script state");
-  }
-  luaL_openlibs(state);
-
   // Execute script.
+  lua_settop(state, 0);
   try {
     do_buffer(state, script, name);
   } catch (const lua_exception& e) {
-    lua_close(state);
-    throw std::runtime_error(std::string("Could not execute servers script ")
-                             + e.what());
+    throw std::runtime_error(std::string("Could not execute ") + name
+                             + " script " + e.what());
   }
 
   // Push lua variable to stack.
@@ -45,58 +46,171 @@ jsonval_ptr lua_connection::iface(const std::string& script,
 
   // Read interface description as rapid-json value.
   jsonval_ptr iface = to_json(state, -1, allocator);
-
-  // Free lua script resources.
-  lua_close(state);
+  lua_pop(state, 1);
 
   return iface;
 }
 
-std::map<std::string, std::string> lua_connection::server_list(const std::string& script) {
-  // Initialize lua_State.
-  lua_State* state = luaL_newstate();
-  if (nullptr == state) {
-    throw std::runtime_error("Could not open state to read server list");
-  }
-  luaL_openlibs(state);
-
+std::map<std::string, std::string> lua_connection::server_list(
+    lua_State* state, const std::string& script) {
   // Execute script.
+  lua_settop(state, 0);
   try {
     do_buffer(state, script, "servers");
   } catch (const lua_exception& e) {
-    lua_close(state);
     throw std::runtime_error(std::string("Could not execute servers script ")
                              + e.what());
   }
 
   // Read servers list.
   std::map<std::string, std::string> servers;
+  lua_settop(state, 0);
   lua_getglobal(state, "servers");
   lua_str_table_to_map(state, 1, &servers);
-
-  // Free resources.
-  lua_close(state);
+  lua_pop(state, 1);
 
   return servers;
 }
 
+bool lua_connection::defines(lua_State* state, const std::string& script,
+                             const std::string& name,
+                             const std::string& function) {
+  // Execute script.
+  lua_settop(state, 0);
+  try {
+    do_buffer(state, script, name);
+  } catch (const lua_exception&) {
+    return false;
+  }
+
+  // Check function.
+  lua_getglobal(state, function.c_str());
+  bool defined = lua_isfunction(state, -1);
+  lua_pop(state, 1);
+
+  return defined;
+}
+
 void lua_connection::on_error(lua_State* state, const std::string& error_msg) {
-  // Check if callback is set.
-  lua_getglobal(state, BOT_LOGIN_CB);
-  if (!lua_isuserdata(state, -1)) {
-    std::cerr << "fatal: \"" << error_msg << "\" happened but no cb set\n";
-    lua_pop(state, 1);
-    lua_close(state);
-    return;
+  state = main_thread(state);
+
+  // Keep the first error: following errors are most likely consequences.
+  lua_context* ctx = context(state);
+  if (!ctx->failed) {
+    ctx->failed = true;
+    ctx->error = error_msg;
   }
 
-  // Clear our BOT_CALLBACK.
-  lua_pushnil(state);
-  lua_setglobal(state, BOT_CALLBACK);
+  // Report the error as soon as no operation is pending.
+  finalize_if_last_async(state);
+}
+
+lua_context* lua_connection::create_context(lua_State* state) {
+  lua_context* ctx = context(state);
+  if (nullptr != ctx) {
+    return ctx;
+  }
+
+  // Create context userdata, destroyed by the garbage collector on close.
+  void* mem = lua_newuserdata(state, sizeof(lua_context));
+  ctx = new(mem) lua_context();
+  ctx->main = state;
+  if (luaL_newmetatable(state, context_meta)) {
+    lua_pushcfunction(state, destroy_context);
+    lua_setfield(state, -2, "__gc");
+  }
+  lua_setmetatable(state, -2);
+
+  // Store it in the registry.
+  lua_rawsetp(state, LUA_REGISTRYINDEX, &context_key);
+
+  return ctx;
+}
+
+lua_context* lua_connection::context(lua_State* state) {
+  lua_rawgetp(state, LUA_REGISTRYINDEX, &context_key);
   void* p = lua_touserdata(state, -1);
-  on_finish_cb* cb = static_cast<on_finish_cb*>(p);
   lua_pop(state, 1);
-  (*cb)(error_msg);
+  return static_cast<lua_context*>(p);
+}
+
+int lua_connection::destroy_context(lua_State* state) {
+  lua_context* ctx = static_cast<lua_context*>(
+      luaL_checkudata(state, 1, context_meta));
+  ctx->~lua_context();
+
+  // Views finalized later (lua_close) must not find the context.
+  lua_pushnil(state);
+  lua_rawsetp(state, LUA_REGISTRYINDEX, &context_key);
+  return 0;
+}
+
+lua_State* lua_connection::main_thread(lua_State* state) {
+  lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  lua_State* main = lua_tothread(state, -1);
+  lua_pop(state, 1);
+  return main;
+}
+
+void lua_connection::spawn(lua_State* state, int nargs) {
+  // Create coroutine and anchor it in the registry while it is running.
+  lua_State* co = lua_newthread(state);
+  int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+  // Move function and arguments to the coroutine.
+  lua_xmove(state, co, nargs + 1);
+
+  // Start coroutine. A yielded coroutine has been anchored by the function
+  // that yielded it (i.e. http.get): the spawn reference can be released.
+  try {
+    resume(state, co, nargs);
+  } catch (const lua_exception&) {
+    luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    throw;
+  }
+  luaL_unref(state, LUA_REGISTRYINDEX, ref);
+}
+
+void lua_connection::resume(lua_State* state, lua_State* co, int nargs) {
+  int ret = lua_resume(co, state, nargs);
+  if (LUA_OK == ret || LUA_YIELD == ret) {
+    // Results and yielded values are not used.
+    lua_settop(co, 0);
+    return;
+  }
+
+  std::string error;
+  const char* s = nullptr;
+  if (lua_isstring(co, -1)) {
+    s = lua_tostring(co, -1);
+  }
+
+  if (nullptr == s || std::strlen(s) == 0) {
+    switch (ret) {
+      case LUA_ERRRUN:  error = "runtime error"; break;
+      case LUA_ERRMEM:  error = "out of memory"; break;
+      case LUA_ERRERR:  error = "error handling error"; break;
+      case LUA_ERRGCMM: error = "gc error"; break;
+      default:          error = "unknown error code"; break;
+    }
+  } else {
+    error = s;
+  }
+
+  throw lua_exception(error.empty() ? "unknown error" : error);
+}
+
+void lua_connection::begin_async(lua_State* state) {
+  ++context(state)->pending;
+}
+
+bool lua_connection::end_async(lua_State* state) {
+  lua_context* ctx = context(state);
+  assert(ctx->pending > 0);
+  --ctx->pending;
+
+  // Don't continue failed states: just wait for them to drain.
+  return !ctx->failed;
 }
 
 void lua_connection::exec(lua_State* state,
@@ -125,11 +239,12 @@ void lua_connection::exec(lua_State* state,
 }
 
 void lua_connection::run(lua_State* state, on_finish_cb* cb,
-                         const std::string& bot_identifier,
+                         std::shared_ptr<bot> bot,
                          const std::string& name,
+                         module* module_ptr,
                          const std::string& script,
                          const std::string& function,
-                         int nargs, int nresults, int errfunc,
+                         int nargs,
                          execution_hook pre_exec, execution_hook post_exec) {
   // Create new script state.
   if (nullptr == state) {
@@ -146,21 +261,16 @@ void lua_connection::run(lua_State* state, on_finish_cb* cb,
   // Set special on_finish function.
   lua_register(state, "on_finish", lua_connection::on_finish);
 
-  // Set error callback.
-  lua_pushlightuserdata(state, static_cast<void*>(cb));
-  lua_setglobal(state, BOT_LOGIN_CB);
+  // Set bot, module and callback.
+  lua_context* ctx = create_context(state);
+  ctx->bot_ptr = bot;
+  ctx->module_name = name;
+  ctx->module_ptr = module_ptr;
+  ctx->cb = cb;
 
   // Load buffer.
   do_buffer(state, script, name);
 
-  // Set module name.
-  lua_pushstring(state, name.c_str());
-  lua_setglobal(state, BOT_MODULE);
-
-  // Set bot identifier.
-  lua_pushstring(state, bot_identifier.c_str());
-  lua_setglobal(state, BOT_IDENTIFER);
-
   // Check function.
   lua_getglobal(state, function.c_str());
   if (!lua_isfunction(state, -1)) {
@@ -173,7 +283,11 @@ void lua_connection::run(lua_State* state, on_finish_cb* cb,
   }
 
   // Call function.
-  exec(state, nargs, nresults, errfunc);
+  try {
+    spawn(state, nargs);
+  } catch (const lua_exception& e) {
+    return on_error(state, e.what());
+  }
 
   // Execute hook function.
   if (post_exec != nullptr) {
@@ -184,29 +298,47 @@ void lua_connection::run(lua_State* state, on_finish_cb* cb,
 }
 
 void lua_connection::finalize_if_last_async(lua_State* state) {
-  // Check whether an asynchronous action was startet (BOT_CALLBACK set).
-  // If this is NOT the case: call terminated - call on_finish cb the 2nd time.
-  // Otherwise (BOT_CALLBACK is set), the asynchronous function will do this.
-  lua_getglobal(state, BOT_CALLBACK);
-  if (!lua_isfunction(state, -1)) {
-    // Check if callback is set.
-    lua_getglobal(state, BOT_LOGIN_CB);
-    if (!lua_isuserdata(state, -1)) {
-      assert(false);
-    }
+  // Check whether asynchronous actions are pending.
+  // If this is the case, the last of them will call us again.
+  lua_context* ctx = context(state);
+  if (ctx->pending > 0) {
+    return;
+  }
+
+  // Wake up the coroutine waiting for all operations to finish (http.wait).
+  if (ctx->waiting) {
+    int ref = ctx->waiter;
+    ctx->waiting = false;
 
-    // Get callback.
-    void* p = lua_touserdata(state, -1);
-    on_finish_cb* cb = static_cast<on_finish_cb*>(p);
+    lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+    lua_State* co = lua_tothread(state, -1);
     lua_pop(state, 1);
 
-    // Unset login callback
-    lua_pushnil(state);
-    lua_setglobal(state, BOT_LOGIN_CB);
+    if (!ctx->failed) {
+      try {
+        resume(state, co, 0);
+      } catch (const lua_exception& e) {
+        luaL_unref(state, LUA_REGISTRYINDEX, ref);
+        return on_error(state, e.what());
+      }
+    }
+    luaL_unref(state, LUA_REGISTRYINDEX, ref);
 
-    // Call callback function.
-    (*cb)("");
+    return finalize_if_last_async(state);
   }
+
+  // Check if callback is set (not set: already finalized).
+  if (nullptr == ctx->cb) {
+    return;
+  }
+
+  // Unset callback. Copy the error: the callback may close the state.
+  on_finish_cb* cb = ctx->cb;
+  ctx->cb = nullptr;
+  std::string error = ctx->failed ? ctx->error : "";
+
+  // Call callback function.
+  (*cb)(error);
 }
 
 void lua_connection::login(lua_State* state,
@@ -215,8 +347,19 @@ void lua_connection::login(lua_State* state,
                            on_finish_cb* cb) {
   try {
     // Execute login function.
-    run(state, cb, bot->config()->identifier(), "base", script,
-        "login", 0, 0, 0);
+    run(state, cb, bot, "base", nullptr, script, "login", 0);
+  } catch(const lua_exception& e) {
+    (*cb)(e.what());
+  }
+}
+
+void lua_connection::check_login(lua_State* state,
+                                 std::shared_ptr<bot> bot,
+                                 const std::string& script,
+                                 on_finish_cb* cb) {
+  try {
+    // Execute login check function.
+    run(state, cb, bot, "base", nullptr, script, "check_login", 0);
   } catch(const lua_exception& e) {
     (*cb)(e.what());
   }
@@ -233,9 +376,7 @@ void lua_connection::module_run(std::string const& module_name,
 
   try {
     // Execute login function.
-    run(state, cb, bot->config()->identifier(), module_name, script,
-        function_name,
-        0, 0, 0,
+    run(state, cb, bot, module_name, module_ptr, script, function_name, 0,
         [module_ptr, base_script](lua_State* state) {
           do_buffer(state, base_script, "base");
           module_ptr->set_lua_status(state);
@@ -250,54 +391,65 @@ void lua_connection::module_finally(std::string const& function,
                                     on_finish_cb* cb) {
   // Call function.
   try {
-    // Mark state as un-finished.
-    lua_pushboolean(state, static_cast<int>(false));
-    lua_setglobal(state, BOT_FINISH);
-
-    // Set login callback.
-    lua_pushlightuserdata(state, static_cast<void*>(cb));
-    lua_setglobal(state, BOT_LOGIN_CB);
+    // Clear stack (may contain on_finish results of the run function).
+    lua_settop(state, 0);
+
+    // Mark state as un-finished, reset the error of the run function and
+    // set the callback.
+    lua_context* ctx = context(state);
+    if (nullptr == ctx) {
+      throw lua_exception("state not initialized");
+    }
+    ctx->finished = false;
+    ctx->failed = false;
+    ctx->error.clear();
+    ctx->cb = cb;
 
     // Check function.
     lua_getglobal(state, function.c_str());
     if (!lua_isfunction(state, -1)) {
       throw lua_exception(std::string("function ") + function + " not defined");
     }
+  } catch(const lua_exception& e) {
+    return (*cb)(e.what());
+  }
 
-    // Execute function.
-    exec(state, 0, 0, 0);
-
-    // Check if no async call was started.
-    finalize_if_last_async(state);
+  // Execute function.
+  try {
+    spawn(state, 0);
   } catch(const lua_exception& e) {
-    (*cb)(e.what());
+    return on_error(state, e.what());
   }
+
+  // Check if no async call was started.
+  finalize_if_last_async(state);
 }
 
 int lua_connection::on_finish(lua_State* state) {
   // Check if state is already finished.
-  lua_getglobal(state, BOT_FINISH);
-  bool finished = lua_isboolean(state, -1) && lua_toboolean(state, -1);
-  lua_pop(state, 1);
-  if (finished) {
+  lua_context* ctx = context(state);
+  if (nullptr == ctx || ctx->finished) {
     return luaL_error(state, "on_finish_error");
   }
 
   // Mark state as finished.
-  lua_pushboolean(state, static_cast<int>(true));
-  lua_setglobal(state, BOT_FINISH);
+  ctx->finished = true;
 
   // Check if callback is set.
-  lua_getglobal(state, BOT_LOGIN_CB);
-  if (!lua_isuserdata(state, -1)) {
+  if (nullptr == ctx->cb) {
     std::cout << "login cb not set\n";
     return 0;
   }
-
-  // Get callback.
-  void* p = lua_touserdata(state, -1);
-  on_finish_cb* cb = static_cast<on_finish_cb*>(p);
-  lua_pop(state, 1);
+  on_finish_cb* cb = ctx->cb;
+
+  // Callbacks read the results from the main thread stack:
+  // move them there if on_finish was called from a coroutine.
+  lua_State* main = ctx->main;
+  if (main != state) {
+    int argc = lua_gettop(state);
+    lua_checkstack(main, argc);
+    lua_xmove(state, main, argc);
+  }
 
   // Call callback function.
   (*cb)("");
@@ -305,33 +457,6 @@ int lua_connection::on_finish(lua_State* state) {
   return 0;
 }
 
-bool lua_connection::get_status(const std::string& script,
-                                const std::string& var,
-                                std::map<std::string, std::string>* status) {
-  // Initialize lua_State.
-  lua_State* state = luaL_newstate();
-  if (nullptr == state) {
-    return false;
-  }
-  luaL_openlibs(state);
-
-  // Execute script.
-  try {
-    do_buffer(state, script, var);
-  } catch (lua_exception const&) {
-    lua_close(state);
-    return false;
-  }
-
-  // Read servers list.
-  get_status(state, var, status);
-
-  // Free resources.
-  lua_close(state);
-
-  return true;
-}
-
 void lua_connection::get_status(lua_State* state, const std::string& var,
                                 std::map<std::string, std::string>* status) {
   // Clear stack.
@@ -374,26 +499,11 @@ void lua_connection::set_status(lua_State* state,
 }
 
 std::shared_ptr<bot> lua_connection::get_bot(lua_State* state) {
-  // Lock because of bots map r/w access.
-  boost::lock_guard<boost::mutex> lock(bots_mutex_);
-
-  // Get bot identifier.
-  lua_getglobal(state, BOT_IDENTIFER);
-  if (!lua_isstring(state, -1)) {
-    lua_pop(state, 1);
+  lua_context* ctx = context(state);
+  if (nullptr == ctx) {
     return std::shared_ptr<bot>();
   }
-
-  // Extract and pop bot identifier string.
-  std::string identifier = lua_tostring(state, -1);
-  lua_pop(state, 1);
-
-  // Check if bot exists.
-  if (bots_.find(identifier) == bots_.end()) {
-    return std::shared_ptr<bot>();
-  }
-
-  return bots_[identifier];
+  return ctx->bot_ptr.lock();
 }
 
 void lua_connection::add(std::shared_ptr<bot> bot) {
@@ -413,10 +523,8 @@ void lua_connection::remove(const std::string& identifier) {
   // Search for identifier and delete entry.
   auto i = bots_.find(identifier);
   if (i != bots_.end()) {
-    std::stringstream msg;
-    msg << "lua_connection::remove(\""
-        << identifier << "\") -> " << i->second.use_count();
-    i->second->log(bot::BS_LOG_DBG, "base", msg.str());
+    BS_DBG(i->second, "base", "lua_connection::remove(\"", identifier,
+           "\") -> ", i->second.use_count());
     bots_.erase(i);
   } else {
     std::cout << "fatal: lua_connection::remove(\""
@@ -432,6 +540,17 @@ bool lua_connection::contains(const std::string& identifier) {
   return bots_.find(identifier) != bots_.end();
 }
 
+std::vector<std::shared_ptr<bot>> lua_connection::bots() {
+  boost::lock_guard<boost::mutex> lock(bots_mutex_);
+
+  std::vector<std::shared_ptr<bot>> bots;
+  bots.reserve(bots_.size());
+  for (const auto& b : bots_) {
+    bots.push_back(b.second);
+  }
+  return bots;
+}
+
 void lua_connection::do_buffer(lua_State* state,
                                const std::string& script,
                                const std::string& name) {
@@ -5,17 +5,12 @@
 #ifndef LUA_CONNECTION_H_
 #define LUA_CONNECTION_H_
 
-#define BOT_IDENTIFER ("__BOT_IDENTIFIER")
-#define BOT_MODULE    ("__BOT_MODULE")
-#define BOT_CALLBACK  ("__BOT_CALLBACK")
-#define BOT_LOGIN_CB  ("__BOT_ON_LOGIN")
-#define BOT_FINISH    ("__BOT_FINISH")
-
 #include <exception>
 #include <memory>
 #include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "boost/thread.hpp"
 #include "boost/filesystem.hpp"
@@ -50,6 +45,13 @@ namespace botscript {
 ///
 /// Generally speaking, the state can always be closed if an error is set.
 ///
+/// Script functions are executed as coroutines. Asynchronous functions (like
+/// http.get) called without a callback yield the calling coroutine and resume
+/// it with the result. The second call of the callback happens after the last
+/// pending asynchronous operation of the state has finished. Errors raised
+/// while other operations are still pending are reported after those have
+/// finished, too. So the state is never closed with requests in flight.
+///
 /// Warning! The state is only provided in success cases to extract on_finish
 /// function call arguments, not to call lua_close() on it. State livetime
 /// should be managed with the state_wrapper class.
@@ -61,6 +63,61 @@ typedef std::shared_ptr<rapidjson::Value> jsonval_ptr;
 class bot;
 class module;
 
+/// Execution context of a lua state. Owned by the state (stored as userdata
+/// in its registry and destroyed with it) so lua C functions can reach the
+/// calling bot and module without global lookups, locks or allocations.
+struct lua_context {
+  lua_context()
+    : main(nullptr),
+      module_ptr(nullptr),
+      cb(nullptr),
+      finished(false),
+      pending(0),
+      waiting(false),
+      waiter(0),
+      failed(false),
+      views(false),
+      view_bytes(0) {
+  }
+
+  /// The main thread of the state.
+  lua_State* main;
+
+  /// The bot the state belongs to.
+  std::weak_ptr<bot> bot_ptr;
+
+  /// The name of the module the state belongs to ("base" for login).
+  std::string module_name;
+
+  /// The module the state belongs to (nullptr for login).
+  module* module_ptr;
+
+  /// Callback to call on on_finish and finalization (nullptr: finalized).
+  on_finish_cb* cb;
+
+  /// Whether on_finish has already been called.
+  bool finished;
+
+  /// Count of pending asynchronous operations.
+  int pending;
+
+  /// Whether a coroutine waits for all operations to finish (http.wait).
+  bool waiting;
+
+  /// Registry reference of the waiting coroutine.
+  int waiter;
+
+  /// Whether an error occured (error holds the first error message).
+  bool failed;
+  std::string error;
+
+  /// Whether responses are passed to lua as views (http.use_views).
+  bool views;
+
+  /// Size of the response strings held by views.
+  std::size_t view_bytes;
+};
+
 /// This exception indicates an error that occured at lua script execution.
 class lua_exception : public std::exception {
  public:
@@ -85,35 +142,95 @@ class lua_connection {
   // Function to be called before or after the Lua script execution.
   typedef std::function<void (lua_State*)> execution_hook;
 
-  /// Reads the interface description of the module script.
+  /// Executes the module script and reads its interface description.
   ///
   /// The interface description variable name is
   /// 'interface_' + {script path stem}
   ///
+  /// \param state the (introspection) state to execute the script in
   /// \param script the script to load
   /// \param name the script name
   /// \param allocator the rapid-json allocator to use
-  /// \exception lua_exception if the execution of the lua script fails
+  /// \exception std::runtime_error if the execution of the lua script fails
   /// \return the interface description in JSON format
-  static jsonval_ptr iface(const std::string& script,
+  static jsonval_ptr iface(lua_State* state,
+                           const std::string& script,
                            const std::string& name,
                            rapidjson::Document::AllocatorType* allocator);
 
-  /// Loads the servers table contained in the script.
+  /// Executes the script and loads the servers table contained in it.
   ///
+  /// \param state the (introspection) state to execute the script in
   /// \param script the script containing the servers table
-  /// \param servers the servers std::map to write to
-  /// \return true when the servers could be read successfully
-  static std::map<std::string, std::string> server_list(const std::string& script);
+  /// \exception std::runtime_error if the execution of the lua script fails
+  /// \return the servers (URL -> server short tag)
+  static std::map<std::string, std::string> server_list(
+      lua_State* state, const std::string& script);
+
+  /// Executes the script and checks whether it defines the given function.
+  ///
+  /// \param state the (introspection) state to execute the script in
+  /// \param script the script to execute
+  /// \param name the module name of the script
+  /// \param function the function name to look for
+  /// \return whether the function is defined (false if the script fails)
+  static bool defines(lua_State* state, const std::string& script,
+                      const std::string& name, const std::string& function);
 
   /// This function should be called when an error occures in an asynchronous
-  /// function call (like http.xy). It calls the callback function registered
-  /// in the state AND CLOSES IT (!) (do NOT reuse or call functions on this).
+  /// function call (like http.xy). It stores the error and calls the callback
+  /// function registered in the state as soon as no other asynchronous
+  /// operation is pending. The callback may close the state (!) (do NOT reuse
+  /// or call functions on this after calling on_error).
   ///
   /// \param state the lua state
   /// \param error_msg the message of the error that occured
   static void on_error(lua_State* state, const std::string& error_msg);
 
+  /// Creates the context of the state. The context is destroyed when the
+  /// state gets closed. Returns the existing context if already created.
+  ///
+  /// \param state the (main thread) lua state
+  /// \return the context of the state
+  static lua_context* create_context(lua_State* state);
+
+  /// \param state a lua state or one of its coroutines
+  /// \return the context of the state (nullptr if there is none)
+  static lua_context* context(lua_State* state);
+
+  /// \param state a lua state or one of its coroutines
+  /// \return the main thread of the state
+  static lua_State* main_thread(lua_State* state);
+
+  /// Runs the function below the nargs topmost values on the stack of the
+  /// main thread state in a new coroutine. Pops the function and arguments.
+  ///
+  /// \param state the (main thread) lua state
+  /// \param nargs the argument count
+  /// \exception lua_exception if the coroutine raised an error
+  static void spawn(lua_State* state, int nargs);
+
+  /// Resumes the coroutine co with the nargs topmost values of its stack.
+  ///
+  /// \param state the main thread of the coroutine
+  /// \param co the coroutine to resume
+  /// \param nargs the argument count
+  /// \exception lua_exception if the coroutine raised an error
+  static void resume(lua_State* state, lua_State* co, int nargs);
+
+  /// Registers the start of an asynchronous operation.
+  /// Has to be paired with a call to end_async() on completion.
+  ///
+  /// \param state the lua state
+  static void begin_async(lua_State* state);
+
+  /// Registers the end of an asynchronous operation.
+  ///
+  /// \param state the lua state
+  /// \return whether the continuation of the operation should be executed
+  ///         (false if the state already failed)
+  static bool end_async(lua_State* state);
+
   /// Calls the function that is on top of the stack.
   ///
   /// \param state the state where the stack top is already a function
@@ -122,30 +239,32 @@ class lua_connection {
   /// \param errfunc the error function
   static void exec(lua_State* state, int nargs, int nresults, int errfunc);
 
-  /// Calls the function previously pushed to the stack of the lua state.
+  /// Loads the script and runs the given function in a new coroutine.
   ///
   /// \param state            the lua state to run the script on
-  /// \param bot_identifier   the identifier of the calling bot
-  /// \param module_name      the module name of the calling module
+  /// \param bot              the calling bot
+  /// \param name             the module name of the calling module
+  /// \param module_ptr       the calling module (nullptr for login)
   /// \param script           the path where the script to execute is located
   /// \param function         the name of the function to call
   /// \param nargs            the argument count
-  /// \param nresults         the result count
-  /// \param errfunc          the error function
   /// \param pre_exec         pre execution hook function
   /// \param post_exec        post exection hook function
-  /// \exception lua_exception if the function call fails
+  /// \exception lua_exception if the script could not be loaded
   static void run(lua_State* state,
                   on_finish_cb* cb,
-                  const std::string& bot_identifier,
+                  std::shared_ptr<bot> bot,
                   const std::string& name,
+                  module* module_ptr,
                   const std::string& script,
                   const std::string& function,
-                  int nargs, int nresults, int errfunc,
+                  int nargs,
                   execution_hook pre_exec = nullptr,
                   execution_hook post_exec = nullptr);
 
-  /// Calls the login callback if no further async call was made.
+  /// Calls the login callback if no asynchronous operation is pending and no
+  /// coroutine waits for them (http.wait). Resumes the waiting coroutine if
+  /// the last pending operation has finished.
   ///
   /// \param state  the state to work with
   static void finalize_if_last_async(lua_State* state);
@@ -154,12 +273,24 @@ class lua_connection {
   /// Calls the callback function with an empty string on success and with an
   /// errro message if the login failed.
   ///
-  /// \param state  the lua state to run the login script on
-  /// \param bot    the bot to login
-  /// \param cb     the callback to call on finish
+  /// \param state   the lua state to run the login script on
+  /// \param bot     the bot to login
+  /// \param script  the base script (defining login)
+  /// \param cb      the callback to call on finish
   static void login(lua_State* state, std::shared_ptr<bot> bot,
                     const std::string& script, on_finish_cb* cb);
 
+  /// Runs the check_login function of the base script asynchronously:
+  /// checks whether the session (cookies) of the bot is still logged in.
+  /// Same callback protocol as login().
+  ///
+  /// \param state   the lua state to run the check on
+  /// \param bot     the bot to check
+  /// \param script  the base script (defining check_login)
+  /// \param cb      the callback to call on finish
+  static void check_login(lua_State* state, std::shared_ptr<bot> bot,
+                          const std::string& script, on_finish_cb* cb);
+
   /// Runs the module asynchronously. Calls the callback with an error string
   /// and -1, -1 if an error occurs. Otherwise (if on_finish got called), the
   /// callback will be called with the parameters provided to on_finish.
@@ -190,15 +321,6 @@ class lua_connection {
   static void get_status(lua_State* state, const std::string& var,
                          std::map<std::string, std::string>* status);
 
-  /// Reads the lua table var from the lua script to the given status.
-  ///
-  /// \param script path to the script to read from
-  /// \param var the variable name to load
-  /// \param status the std::map status to write to
-  /// \return whether the script could be loaded or not
-  static bool get_status(const std::string& script, const std::string& var,
-                         std::map<std::string, std::string>* status);
-
   /// Writes the key and value to the given variable in the given scrip state
   ///
   /// \param state the lua script state
@@ -210,7 +332,7 @@ class lua_connection {
 
   /// Returns the corresponding bot registered to the script state.
   ///
-  /// \param state the script state to extract the bot identifier from
+  /// \param state the script state to read the bot from
   /// \return the pointer to the bot (or nullptr if the bot could not be found)
   static std::shared_ptr<bot> get_bot(lua_State* state);
 
@@ -230,6 +352,9 @@ class lua_connection {
   /// \return true if found false if not
   static bool contains(const std::string& identifier);
 
+  /// \return all registered bots
+  static std::vector<std::shared_ptr<bot>> bots();
+
   /// Reads the table at the specified stack_index to a std::map.
   ///
   /// \param state the script state
@@ -255,7 +380,11 @@ class lua_connection {
   static jsonval_ptr to_json(lua_State* state, int stack_index,
                              rapidjson::Document::AllocatorType* allocator);
 
-  /// Bots mapping from identifier to bot pointer.
+  /// Destroys the context userdata (__gc metamethod).
+  static int destroy_context(lua_State* state);
+
+  /// Bots mapping from identifier to bot pointer (used for administrative
+  /// lookups only: scripts access their bot through the state context).
   static std::map<std::string, std::shared_ptr<bot>> bots_;
 
   /// Mutex to synchronize access to the lua_connection::bots_ mapping.
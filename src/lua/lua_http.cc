@@ -6,6 +6,8 @@
 
 #include <iostream>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/lambda/lambda.hpp"
@@ -21,37 +23,91 @@
 #include "../bot.h"
 #include "./lua_connection.h"
 #include "./lua_util.h"
+#include "./lua_view.h"
 
 namespace botscript {
 
 void lua_http::open(lua_State* state) {
   luaL_newlib(state, httplib);
   lua_setglobal(state, "http");
+  lua_view::open(state);
 }
 
-void lua_http::on_req_finish(lua_State* state, std::string response,
+lua_http::completion lua_http::continuation(lua_State* state, int cb_index) {
+  // Reference the callback function or the calling coroutine.
+  bool resume = !lua_isfunction(state, cb_index);
+  if (resume) {
+    if (lua_pushthread(state)) {
+      luaL_error(state, "no callback given outside of a coroutine");
+    }
+  } else {
+    lua_pushvalue(state, cb_index);
+  }
+  int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+  // The state is finalized when the last pending operation finished.
+  lua_State* main = lua_connection::main_thread(state);
+  lua_connection::begin_async(main);
+
+  return [main, ref, resume](push_results push,
                              boost::system::error_code ec) {
-  // Check failure.
-  if (ec) {
-    return lua_connection::on_error(state, ec.message());
+    on_req_finish(main, ref, resume, std::move(push), ec);
+  };
+}
+
+http::webclient::callback lua_http::response_handler(lua_State* state,
+                                                     int cb_index) {
+  completion done = continuation(state, cb_index);
+  return [done](std::string response, boost::system::error_code ec) {
+    done([&response](lua_State* s) {
+      push_response(s, &response);
+      return 1;
+    }, ec);
+  };
+}
+
+void lua_http::push_response(lua_State* state, std::string* response) {
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr != ctx && ctx->views) {
+    lua_view::push(state, std::move(*response));
+  } else {
+    lua_pushlstring(state, response->c_str(), response->length());
   }
+}
 
-  // Get and check callback function.
-  lua_getglobal(state, BOT_CALLBACK);
-  if (!lua_isfunction(state, -1)) {
-    return lua_connection::on_error(state, "on_req_finish: no callback set");
+void lua_http::on_req_finish(lua_State* state, int ref, bool resume,
+                             push_results push,
+                             boost::system::error_code ec) {
+  // Check whether the state is still able to continue.
+  if (!lua_connection::end_async(state)) {
+    luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    return lua_connection::finalize_if_last_async(state);
   }
 
-  // The callback is used as indicator: If the callback is set on function exit,
-  // the function has called an asynchronous function. Clear our BOT_CALLBACK.
-  lua_pushnil(state);
-  lua_setglobal(state, BOT_CALLBACK);
+  // Check failure.
+  if (ec) {
+    luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    return lua_connection::on_error(state, ec.message());
+  }
 
-  // Call BOT_CALLBACK function.
-  lua_pushlstring(state, response.c_str(), response.length());
   try {
-    lua_connection::exec(state, 1, LUA_MULTRET, 0);
+    lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+    if (resume) {
+      // Continue the coroutine that waits for the results.
+      // The reference keeps it alive until it yields or finishes.
+      lua_State* co = lua_tothread(state, -1);
+      lua_pop(state, 1);
+      lua_connection::resume(state, co, push(co));
+      luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    } else {
+      // Call the callback function in a new coroutine.
+      luaL_unref(state, LUA_REGISTRYINDEX, ref);
+      lua_connection::spawn(state, push(state));
+    }
   } catch(const lua_exception& e) {
+    if (resume) {
+      luaL_unref(state, LUA_REGISTRYINDEX, ref);
+    }
     return lua_connection::on_error(state, e.what());
   }
 
@@ -60,23 +116,19 @@ void lua_http::on_req_finish(lua_State* state, std::string response,
 
 int lua_http::get(lua_State* state, bool path) {
   // Check if state is finished.
-  lua_getglobal(state, BOT_FINISH);
-  bool finished = lua_isboolean(state, -1) && lua_toboolean(state, -1);
-  lua_pop(state, 1);
-  if (finished) {
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx || ctx->finished) {
     return luaL_error(state, "on_finish_error");
   }
 
   // Check arguments.
   luaL_checktype(state, 1, LUA_TSTRING);
-  luaL_checktype(state, 2, LUA_TFUNCTION);
+  if (lua_gettop(state) >= 2) {
+    luaL_checktype(state, 2, LUA_TFUNCTION);
+  }
 
   // Get URL string.
   std::string url = lua_tostring(state, 1);
-  lua_remove(state, 1);
-
-  // Set callback as global variable.
-  lua_setglobal(state, BOT_CALLBACK);
 
   // Get the calling bot.
   std::shared_ptr<bot> b = lua_connection::get_bot(state);
@@ -86,36 +138,31 @@ int lua_http::get(lua_State* state, bool path) {
 
   // Do asynchronous call.
   url = path ? b->config()->server() + url : url;
+  bool yield = !lua_isfunction(state, 2);
   b->browser()->request_with_retry(
-      http::url(url), http::util::GET, "",
-      boost::bind(on_req_finish, state, _1, _2),
+      http::url(url), http::util::GET, "", response_handler(state, 2),
       boost::posix_time::seconds(15), 3);
 
-  return 0;
+  return yield ? lua_yield(state, 0) : 0;
 }
 
 int lua_http::post(lua_State* state, bool path) {
   // Check if state is finished.
-  lua_getglobal(state, BOT_FINISH);
-  bool finished = lua_isboolean(state, -1) && lua_toboolean(state, -1);
-  lua_pop(state, 1);
-  if (finished) {
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx || ctx->finished) {
     return luaL_error(state, "on_finish_error");
   }
 
   // Check arguments.
   luaL_checktype(state, 1, LUA_TSTRING);
   luaL_checktype(state, 2, LUA_TSTRING);
-  luaL_checktype(state, 3, LUA_TFUNCTION);
+  if (lua_gettop(state) >= 3) {
+    luaL_checktype(state, 3, LUA_TFUNCTION);
+  }
 
   // Get URL string.
   std::string url = lua_tostring(state, 1);
   std::string content = lua_tostring(state, 2);
-  lua_remove(state, 1);
-  lua_remove(state, 1);
-
-  // Set callback as global variable.
-  lua_setglobal(state, BOT_CALLBACK);
 
   // Get the calling bot.
   std::shared_ptr<bot> b = lua_connection::get_bot(state);
@@ -125,12 +172,12 @@ int lua_http::post(lua_State* state, bool path) {
 
   // Do asynchronous call.
   url = path ? b->config()->server() + url : url;
+  bool yield = !lua_isfunction(state, 3);
   b->browser()->request_with_retry(
-      http::url(url), http::util::POST, content,
-      boost::bind(on_req_finish, state, _1, _2),
+      http::url(url), http::util::POST, content, response_handler(state, 3),
       boost::posix_time::seconds(15), 3);
 
-  return 0;
+  return yield ? lua_yield(state, 0) : 0;
 }
 
 int lua_http::get(lua_State* state) {
@@ -149,12 +196,104 @@ int lua_http::post_path(lua_State* state) {
   return post(state, true);
 }
 
+int lua_http::request_all(lua_State* state, int method, bool path) {
+  // Check if state is finished.
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx || ctx->finished) {
+    return luaL_error(state, "on_finish_error");
+  }
+
+  // Check arguments.
+  luaL_checktype(state, 1, LUA_TTABLE);
+  if (lua_gettop(state) >= 2) {
+    luaL_checktype(state, 2, LUA_TFUNCTION);
+  }
+
+  // Read requests: URL strings (GET) or {url, content} tables (POST).
+  std::vector<std::pair<std::string, std::string>> requests;
+  int count = static_cast<int>(lua_rawlen(state, 1));
+  for (int i = 1; i <= count; ++i) {
+    lua_rawgeti(state, 1, i);
+    if (method == http::util::GET) {
+      requests.emplace_back(luaL_checkstring(state, -1), "");
+    } else {
+      luaL_checktype(state, -1, LUA_TTABLE);
+      lua_rawgeti(state, -1, 1);
+      lua_rawgeti(state, -2, 2);
+      requests.emplace_back(luaL_checkstring(state, -2),
+                            luaL_checkstring(state, -1));
+      lua_pop(state, 2);
+    }
+    lua_pop(state, 1);
+  }
+  if (requests.empty()) {
+    return luaL_argerror(state, 1, "no requests given");
+  }
+
+  // Get the calling bot.
+  std::shared_ptr<bot> b = lua_connection::get_bot(state);
+  if (std::shared_ptr<bot>() == b) {
+    return luaL_error(state, "no bot for state");
+  }
+
+  // Collect the results of all requests.
+  struct results {
+    std::vector<std::string> responses, errors;
+    std::size_t remaining;
+    completion done;
+  };
+  auto all = std::make_shared<results>();
+  all->responses.resize(requests.size());
+  all->errors.resize(requests.size());
+  all->remaining = requests.size();
+
+  bool yield = !lua_isfunction(state, 2);
+  all->done = continuation(state, 2);
+
+  // Do asynchronous calls.
+  std::string server = path ? b->config()->server() : "";
+  for (std::size_t i = 0; i < requests.size(); ++i) {
+    auto cb = [all, i](std::string response, boost::system::error_code ec) {
+      if (ec) {
+        all->errors[i] = ec.message();
+      } else {
+        all->responses[i] = std::move(response);
+      }
+
+      if (--all->remaining != 0) {
+        return;
+      }
+
+      all->done([all](lua_State* s) {
+        int n = static_cast<int>(all->responses.size());
+        lua_createtable(s, n, 0);
+        for (int j = 0; j < n; ++j) {
+          push_response(s, &all->responses[j]);
+          lua_rawseti(s, -2, j + 1);
+        }
+        lua_newtable(s);
+        for (int j = 0; j < n; ++j) {
+          if (!all->errors[j].empty()) {
+            lua_pushstring(s, all->errors[j].c_str());
+            lua_rawseti(s, -2, j + 1);
+          }
+        }
+        return 2;
+      }, boost::system::error_code());
+    };
+
+    b->browser()->queued_request(
+        http::url(server + requests[i].first), method, requests[i].second,
+        cb, boost::posix_time::seconds(15), 3);
+  }
+
+  return yield ? lua_yield(state, 0) : 0;
+}
+
 int lua_http::submit_form(lua_State* state) {
   // Check if state is finished.
-  lua_getglobal(state, BOT_FINISH);
-  bool finished = lua_isboolean(state, -1) && lua_toboolean(state, -1);
-  lua_pop(state, 1);
-  if (finished) {
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx || ctx->finished) {
     return luaL_error(state, "on_finish_error");
   }
 
@@ -164,44 +303,59 @@ int lua_http::submit_form(lua_State* state) {
   std::map<std::string, std::string> parameters;
   std::string action;
 
-  // Collect parameters.
+  // Collect parameters (the callback is optional inside of coroutines).
   int argc = lua_gettop(state);
-  switch (argc) {
+  int cb_index = lua_isfunction(state, argc) ? argc : argc + 1;
+  switch (cb_index) {
     case 5:
       action = luaL_checkstring(state, 4);
     case 4:
       lua_connection::lua_str_table_to_map(state, 3, &parameters);
     case 3:
       xpath = luaL_checkstring(state, 2);
-      content = luaL_checkstring(state, 1);
+      boost::string_ref page = lua_view::check(state, 1);
+      content.assign(page.data(), page.length());
   }
 
-  // Arguments read. Pop them.
-  for (int i = 0; i < argc - 1; ++i) {
-    lua_remove(state, 1);
-  }
-
-  // Set callback as global variable.
-  lua_setglobal(state, BOT_CALLBACK);
-
   // Get the calling bot.
   std::shared_ptr<bot> b = lua_connection::get_bot(state);
   if (std::shared_ptr<bot>() == b) {
     return luaL_error(state, "no bot for state");
   }
 
-  // Do asynchronous call.
-  auto cb = std::bind(on_req_finish, state,
-                      std::placeholders::_1, std::placeholders::_2);
+  // Do asynchronous call. The continuation is registered after the form has
+  // been submitted successfully (the callback won't be called on error).
+  auto cb = std::make_shared<http::webclient::callback>();
+  auto forward = [cb](std::string response, boost::system::error_code ec) {
+    (*cb)(std::move(response), ec);
+  };
 
   boost::system::error_code ec;
-  b->browser()->submit_with_retry(xpath, content, parameters, action, cb,
+  b->browser()->submit_with_retry(xpath, content, parameters, action, forward,
                                   boost::posix_time::seconds(15), 3, ec);
   if (ec) {
-    return luaL_error(state, ec.message().c_str());
+    return luaL_error(state, "%s", ec.message().c_str());
   }
 
-  return 0;
+  bool yield = cb_index > argc;
+  *cb = response_handler(state, cb_index);
+  return yield ? lua_yield(state, 0) : 0;
+}
+
+int lua_http::get_all(lua_State* state) {
+  return request_all(state, http::util::GET, false);
+}
+
+int lua_http::get_path_all(lua_State* state) {
+  return request_all(state, http::util::GET, true);
+}
+
+int lua_http::post_all(lua_State* state) {
+  return request_all(state, http::util::POST, false);
+}
+
+int lua_http::post_path_all(lua_State* state) {
+  return request_all(state, http::util::POST, true);
 }
 
 int lua_http::url_encode(lua_State* state) {
@@ -219,4 +373,36 @@ int lua_http::url_encode(lua_State* state) {
   return 1;
 }
 
+int lua_http::use_views(lua_State* state) {
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx) {
+    return luaL_error(state, "no context for state");
+  }
+  ctx->views = lua_toboolean(state, 1) != 0;
+  return 0;
+}
+
+int lua_http::wait(lua_State* state) {
+  // Nothing to wait for.
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr == ctx || ctx->pending == 0) {
+    return 0;
+  }
+
+  // Only one coroutine can wait.
+  if (ctx->waiting) {
+    return luaL_error(state, "another coroutine is already waiting");
+  }
+
+  // Reference the calling coroutine. It will be resumed when the last
+  // pending request has finished.
+  if (lua_pushthread(state)) {
+    return luaL_error(state, "wait called outside of a coroutine");
+  }
+  ctx->waiter = luaL_ref(state, LUA_REGISTRYINDEX);
+  ctx->waiting = true;
+
+  return lua_yield(state, 0);
+}
+
 }  // namespace botscript
@@ -20,15 +20,62 @@ class lua_http {
   static int get(lua_State* state, bool path);
   static int post(lua_State* state, bool path);
 
+  /// Starts all requests of the table at stack index 1 in parallel (limited
+  /// by the bot browser). GET requests are given as URL strings, POST requests
+  /// as {url, content} tables. The callback (or the resumed coroutine)
+  /// receives two tables: the responses in input order (empty string on
+  /// failure) and the error messages of the failed requests (by index).
+  static int request_all(lua_State* state, int method, bool path);
+
+
   static int get(lua_State* state);
   static int get_path(lua_State* state);
   static int post(lua_State* state);
   static int post_path(lua_State* state);
   static int submit_form(lua_State* state);
   static int url_encode(lua_State* state);
+  static int wait(lua_State* state);
+  static int get_all(lua_State* state);
+  static int get_path_all(lua_State* state);
+  static int post_all(lua_State* state);
+  static int post_path_all(lua_State* state);
+  static int use_views(lua_State* state);
 
  private:
-  static void on_req_finish(lua_State* state, std::string response,
+  /// Pushes the results of an asynchronous operation to the given state.
+  /// Returns the number of pushed values.
+  typedef std::function<int (lua_State*)> push_results;
+
+  /// Completion handler of an asynchronous operation.
+  typedef std::function<void (push_results, boost::system::error_code)>
+      completion;
+
+  /// Registers the continuation of an asynchronous operation: the callback
+  /// function at the given stack index or - if there is no callback - the
+  /// calling coroutine which will be resumed with the results.
+  ///
+  /// \param state     the calling lua state
+  /// \param cb_index  the stack index of the (optional) callback function
+  /// \return the completion handler to call with the results
+  static completion continuation(lua_State* state, int cb_index);
+
+  /// Like continuation() for operations with one response string as result.
+  ///
+  /// \param state     the calling lua state
+  /// \param cb_index  the stack index of the (optional) callback function
+  /// \return the completion handler to pass to the bot browser
+  static http::webclient::callback response_handler(lua_State* state,
+                                                    int cb_index);
+
+  /// Pushes the response as view or as string (see use_views).
+  /// Moves the response if it is pushed as view.
+  ///
+  /// \param state     the lua state to push the response to
+  /// \param response  the response to push
+  static void push_response(lua_State* state, std::string* response);
+
+  static void on_req_finish(lua_State* state, int ref, bool resume,
+                            push_results push,
                             boost::system::error_code ec);
 };
 
@@ -39,6 +86,12 @@ static const luaL_Reg httplib[] = {
   {"post_path",        lua_http::post_path},
   {"submit_form",      lua_http::submit_form},
   {"url_encode",       lua_http::url_encode},
+  {"wait",             lua_http::wait},
+  {"get_all",          lua_http::get_all},
+  {"get_path_all",     lua_http::get_path_all},
+  {"post_all",         lua_http::post_all},
+  {"post_path_all",    lua_http::post_path_all},
+  {"use_views",        lua_http::use_views},
   {NULL, NULL}
 };
 
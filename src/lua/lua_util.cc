@@ -14,6 +14,8 @@
 
 #include "pugixml.hpp"
 
+#include "./lua_view.h"
+
 namespace botscript {
 
 void lua_util::open(lua_State* state) {
@@ -22,18 +24,15 @@ void lua_util::open(lua_State* state) {
 }
 
 int lua_util::get_by_xpath(lua_State* state) {
-  // Get arguments from stack.
-  std::string str = luaL_checkstring(state, 1);
+  // Get arguments from stack (the document may be a string or a view).
+  boost::string_ref str = lua_view::check(state, 1);
   std::string xpath = luaL_checkstring(state, 2);
 
-  // Arguments read. Pop them.
-  lua_pop(state, 2);
-
   // Use pugi for xpath query.
   std::string value;
   try {
     pugi::xml_document doc;
-    doc.load(str.c_str());
+    doc.load_buffer(str.data(), str.length());
     pugi::xpath_query query(xpath.c_str());
     value = query.evaluate_string(doc);
   } catch(const pugi::xpath_exception&) {
@@ -48,13 +47,10 @@ int lua_util::get_by_xpath(lua_State* state) {
 }
 
 int lua_util::get_all_by_xpath(lua_State* state) {
-  // Get arguments from stack.
-  std::string str = luaL_checkstring(state, 1);
+  // Get arguments from stack (the document may be a string or a view).
+  boost::string_ref str = lua_view::check(state, 1);
   std::string xpath = luaL_checkstring(state, 2);
 
-  // Arguments read. Pop them.
-  lua_pop(state, 2);
-
   // Use pugi for xpath query.
   try {
     // Result table and match index.
@@ -62,7 +58,7 @@ int lua_util::get_all_by_xpath(lua_State* state) {
     int matchIndex = 1;
 
     pugi::xml_document doc;
-    doc.load(str.c_str());
+    doc.load_buffer(str.data(), str.length());
     pugi::xpath_query query(xpath.c_str());
     pugi::xpath_node_set result = query.evaluate_node_set(doc);
     for (pugi::xpath_node_set::const_iterator i = result.begin();
@@ -91,19 +87,16 @@ int lua_util::get_all_by_xpath(lua_State* state) {
 }
 
 int lua_util::get_by_regex(lua_State* state) {
-  // get arguments from stack
-  std::string str = luaL_checkstring(state, 1);
+  // get arguments from stack (the string may be a string or a view)
+  boost::string_ref str = lua_view::check(state, 1);
   std::string regex = luaL_checkstring(state, 2);
 
-  // Arguments read. Pop them.
-  lua_pop(state, 2);
-
   std::string match;
   try {
     // apply regular expression
     boost::regex r(regex);
-    boost::match_results<std::string::const_iterator> what;
-    boost::regex_search(str, what, r);
+    boost::cmatch what;
+    boost::regex_search(str.begin(), str.end(), what, r);
     match = what.size() > 1 ? what[1].str().c_str() : "";
   } catch(const boost::regex_error&) {
     std::string error = regex;
@@ -117,13 +110,10 @@ int lua_util::get_by_regex(lua_State* state) {
 }
 
 int lua_util::get_all_by_regex(lua_State* state) {
-  // Get arguments from stack.
-  std::string str = luaL_checkstring(state, 1);
+  // Get arguments from stack (the string may be a string or a view).
+  boost::string_ref str = lua_view::check(state, 1);
   std::string regex = luaL_checkstring(state, 2);
 
-  // Arguments read. Pop them.
-  lua_pop(state, 2);
-
   try {
     // Result table and match index.
     lua_newtable(state);
@@ -131,10 +121,10 @@ int lua_util::get_all_by_regex(lua_State* state) {
 
     // Prepare for search:
     // results structure, flags, start, end and compiled regex
-    boost::match_results<std::string::const_iterator> what;
+    boost::cmatch what;
     boost::match_flag_type flags = boost::match_default;
-    std::string::const_iterator start = str.begin();
-    std::string::const_iterator end = str.end();
+    const char* start = str.begin();
+    const char* end = str.end();
     boost::regex r(regex);
 
     // Search:
@@ -184,11 +174,6 @@ int lua_util::log_error(lua_State* state) {
 }
 
 int lua_util::set_status(lua_State* state) {
-  // Get module name.
-  lua_getglobal(state, BOT_MODULE);
-  std::string module = luaL_checkstring(state, -1);
-  lua_pop(state, 1);
-
   // Get key and value.
   std::string key = luaL_checkstring(state, -2);
   std::string value = luaL_checkstring(state, -1);
@@ -196,35 +181,34 @@ int lua_util::set_status(lua_State* state) {
   // Arguments read. Pop them.
   lua_pop(state, 2);
 
-  // Get the calling bot.
-  std::shared_ptr<bot> b = lua_connection::get_bot(state);
-  if (std::shared_ptr<bot>() == b) {
+  // Get the calling bot and module.
+  lua_context* ctx = lua_connection::context(state);
+  std::shared_ptr<bot> b;
+  if (nullptr == ctx || std::shared_ptr<bot>() == (b = ctx->bot_ptr.lock())) {
     return luaL_error(state, "no bot for state");
   }
 
   // Execute set command.
-  b->execute(module + "_set_" + key, value);
+  b->execute(ctx->module_name + "_set_" + key, value);
   return 0;
 }
 
 void lua_util::log(lua_State* state, int log_level) {
-  // Get module name.
-  lua_getglobal(state, BOT_MODULE);
-  std::string module = luaL_checkstring(state, -1);
-  lua_pop(state, 1);
+  // Get message (only copied if the level is enabled).
+  const char* message = luaL_checkstring(state, 1);
 
-  // Get and log message.
-  std::string message = luaL_checkstring(state, 1);
-  lua_pop(state, 1);
-
-  // Get bot.
-  std::shared_ptr<bot> b = lua_connection::get_bot(state);
-  if (std::shared_ptr<bot>() == b) {
+  // Get bot and module.
+  lua_context* ctx = lua_connection::context(state);
+  std::shared_ptr<bot> b;
+  if (nullptr == ctx || std::shared_ptr<bot>() == (b = ctx->bot_ptr.lock())) {
     luaL_error(state, "no bot for state");
     return;
   }
 
-  b->log(log_level, module, message);
+  if (b->log_enabled(log_level, ctx->module_name)) {
+    b->log(log_level, ctx->module_name, message);
+  }
+  lua_pop(state, 1);
 }
 
 int lua_util::set_shared(lua_State* state) {
@@ -242,8 +226,7 @@ int lua_util::set_shared(lua_State* state) {
   }
 
   // Execute set command.
-  b->config()->set("shared", key, value);
-  b->update_shared(key, value);
+  b->set_shared(key, value);
   return 0;
 }
 
@@ -261,11 +244,9 @@ int lua_util::get_shared(lua_State* state) {
   }
 
   // Read bot status and push result.
-  auto module_settings = b->config()->module_settings();
-  auto& base_module = module_settings["shared"];
-  auto it = base_module.find(key);
-  if (it != base_module.end()) {
-    lua_pushstring(state, it->second.c_str());
+  const std::string* value = b->config()->find("shared", key);
+  if (value != nullptr) {
+    lua_pushstring(state, value->c_str());
   } else {
     lua_pushstring(state, "");
   }
@@ -0,0 +1,98 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./lua_view.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "./lua_connection.h"
+
+namespace botscript {
+
+// Name of the metatable of view userdata.
+static const char* const view_meta = "botscript.view";
+
+static const luaL_Reg viewlib[] = {
+  {"__tostring", lua_view::to_string},
+  {"__len",      lua_view::length},
+  {"__concat",   lua_view::concat},
+  {"__gc",       lua_view::destroy},
+  {NULL, NULL}
+};
+
+void lua_view::open(lua_State* state) {
+  if (luaL_newmetatable(state, view_meta)) {
+    luaL_setfuncs(state, viewlib, 0);
+  }
+  lua_pop(state, 1);
+}
+
+void lua_view::push(lua_State* state, std::string&& str) {
+  void* mem = lua_newuserdata(state, sizeof(std::string));
+  std::string* view = new(mem) std::string(std::move(str));
+  luaL_setmetatable(state, view_meta);
+
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr != ctx) {
+    ctx->view_bytes += view->capacity();
+  }
+}
+
+boost::string_ref lua_view::check(lua_State* state, int index) {
+  if (lua_type(state, index) == LUA_TSTRING ||
+      lua_type(state, index) == LUA_TNUMBER) {
+    std::size_t length = 0;
+    const char* s = lua_tolstring(state, index, &length);
+    return boost::string_ref(s, length);
+  }
+
+  void* p = luaL_testudata(state, index, view_meta);
+  if (nullptr == p) {
+    luaL_argerror(state, index, "string or view expected");
+  }
+  const std::string* str = static_cast<const std::string*>(p);
+  return boost::string_ref(*str);
+}
+
+int lua_view::to_string(lua_State* state) {
+  boost::string_ref s = check(state, 1);
+  lua_pushlstring(state, s.data(), s.length());
+  return 1;
+}
+
+int lua_view::length(lua_State* state) {
+  lua_pushinteger(state, static_cast<lua_Integer>(check(state, 1).length()));
+  return 1;
+}
+
+int lua_view::concat(lua_State* state) {
+  // One of the operands is a view: convert both to strings.
+  boost::string_ref lhs = check(state, 1);
+  boost::string_ref rhs = check(state, 2);
+  lua_pushlstring(state, lhs.data(), lhs.length());
+  lua_pushlstring(state, rhs.data(), rhs.length());
+  lua_concat(state, 2);
+  return 1;
+}
+
+int lua_view::destroy(lua_State* state) {
+  typedef std::string string;
+  string* view = static_cast<string*>(luaL_checkudata(state, 1, view_meta));
+
+  lua_context* ctx = lua_connection::context(state);
+  if (nullptr != ctx) {
+    ctx->view_bytes -= std::min(ctx->view_bytes, view->capacity());
+  }
+
+  view->~string();
+  return 0;
+}
+
+}  // namespace botscript
@@ -0,0 +1,57 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef LUA_VIEW_H_
+#define LUA_VIEW_H_
+
+#include <string>
+
+#include "boost/utility/string_ref.hpp"
+
+struct lua_State;
+
+namespace botscript {
+
+/// Lua userdata owning a response string. Passing responses to lua as views
+/// avoids copying them to lua strings: a view is converted to a lua string on
+/// demand only (tostring(view), view .. "", #view). The util.get_*_by_xpath
+/// and util.get_*_by_regex functions read views directly.
+class lua_view {
+ public:
+  /// Registers the view metatable.
+  ///
+  /// \param state the lua state
+  static void open(lua_State* state);
+
+  /// Pushes a view that takes ownership of the given string.
+  ///
+  /// \param state the lua state
+  /// \param str the string to move to the view
+  static void push(lua_State* state, std::string&& str);
+
+  /// Reads the string or view at the given stack index. Raises a lua error
+  /// if the value is neither a string (or number) nor a view. The returned
+  /// reference is valid as long as the value stays on the stack.
+  ///
+  /// \param state the lua state
+  /// \param index the stack index of the string or view
+  /// \return reference to the string contents
+  static boost::string_ref check(lua_State* state, int index);
+
+  /// __tostring metamethod.
+  static int to_string(lua_State* state);
+
+  /// __len metamethod.
+  static int length(lua_State* state);
+
+  /// __concat metamethod.
+  static int concat(lua_State* state);
+
+  /// __gc metamethod.
+  static int destroy(lua_State* state);
+};
+
+}  // namespace botscript
+
+#endif  // LUA_VIEW_H_
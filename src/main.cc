@@ -1,20 +1,33 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
-#include <fstream>
 #include <vector>
 
 #include "boost/asio/io_service.hpp"
 #include "boost/asio/deadline_timer.hpp"
-#include "boost/iostreams/copy.hpp"
 #include "boost/filesystem.hpp"
+#include "boost/thread.hpp"
 
 #include "./bot.h"
-#include "./mem_bot_config.h"
+#include "./config_loader.h"
+#include "./fleet_checkpoint.h"
+#include "./log_bot_config.h"
+#include "./login_admission.h"
+#include "./log_ring.h"
+#include "./log_sink.h"
+#include "./shard_pool.h"
+#include "./update_channel.h"
+#include "./wakeup_scheduler.h"
 
 using namespace botscript;
 namespace asio = boost::asio;
 
+// Bots running on different threads log concurrently.
+boost::mutex log_mutex;
+
 void print_log(const std::string& msg) {
+  boost::lock_guard<boost::mutex> lock(log_mutex);
 #if defined _WIN32 || defined _WIN64
   HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
   int color = 0x0007;
@@ -42,40 +55,295 @@ void init_cb(std::shared_ptr<bot>, std::string error) {
   }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+  // Number of threads running the io_service (--threads N) or number of
+  // shards with one io_service each (--shards N, 0 = one per core).
+  // Fleet wide module start cap (--max-starts N per second, 0 = unlimited),
+  // split between the shards.
+  // Login admission (--login-concurrency N logins at once, --login-rate R
+  // logins per second and server, 0 = unlimited).
+  // Hibernation of idle bots (--hibernate-after N seconds, 0 = never).
+  // Soft memory budget per bot (--memory-budget N kilobytes, 0 = none).
+  // Configuration logs (configs/*.log) flush every --log-sync N updates.
+  // Write-behind config buffering (--write-behind N milliseconds, 0 = off,
+  // --write-behind-max N pending writes).
+  // Fleet checkpoint (--checkpoint FILE written every --checkpoint-interval
+  // N seconds): restored bots resume their sessions without login if the
+  // checkpoint is younger than --session-ttl N seconds and the package's
+  // session check confirms the session.
+  // Bulk configurations: --ndjson FILE with one JSON configuration per line.
+  // Batched update delivery (--update-batch N milliseconds, 0 = off,
+  // --update-batch-max N queued updates).
+  // Default log level of the bots (--log-level debug|info|error), bots and
+  // modules override it with their log_level setting.
+  // Asynchronous log files (--log-dir DIR, "-" for stdout) split by
+  // --log-files single|bot|shard, rotated at --log-rotate-size N kilobytes
+  // (0 = never) and after --log-rotate-interval N seconds (0 = never).
+  int thread_count = 1;
+  int shard_count = -1;
+  unsigned int login_concurrency = 0;
+  double login_rate = 0.0;
+  std::size_t log_sync = 64;
+  int write_behind_ms = 0;
+  int write_behind_max = 64;
+  std::string checkpoint_path;
+  int checkpoint_interval = 60;
+  int session_ttl = 600;
+  std::string ndjson_path;
+  int update_batch_ms = 0;
+  int update_batch_max = 256;
+  std::string log_dir;
+  std::string log_files = "single";
+  int log_rotate_kb = 10240;
+  int log_rotate_interval = 0;
+  for (int i = 1; i < argc - 1; ++i) {
+    if (std::strcmp(argv[i], "--threads") == 0) {
+      thread_count = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--shards") == 0) {
+      shard_count = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--max-starts") == 0) {
+      int max = std::max(0, std::atoi(argv[i + 1]));
+      wakeup_scheduler::max_starts_per_second(max);
+    } else if (std::strcmp(argv[i], "--login-concurrency") == 0) {
+      login_concurrency = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--login-rate") == 0) {
+      login_rate = std::max(0.0, std::atof(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--hibernate-after") == 0) {
+      bot::hibernate_after(std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--memory-budget") == 0) {
+      bot::footprint_budget(std::max(0, std::atoi(argv[i + 1])) * 1024u);
+    } else if (std::strcmp(argv[i], "--log-sync") == 0) {
+      log_sync = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--write-behind") == 0) {
+      write_behind_ms = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--write-behind-max") == 0) {
+      write_behind_max = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--checkpoint") == 0) {
+      checkpoint_path = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--checkpoint-interval") == 0) {
+      checkpoint_interval = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--session-ttl") == 0) {
+      session_ttl = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--ndjson") == 0) {
+      ndjson_path = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--update-batch") == 0) {
+      update_batch_ms = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--update-batch-max") == 0) {
+      update_batch_max = std::max(1, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--log-level") == 0) {
+      int level = bot::parse_log_level(argv[i + 1]);
+      if (level >= 0) {
+        bot::log_level(level);
+      }
+    } else if (std::strcmp(argv[i], "--log-dir") == 0) {
+      log_dir = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--log-files") == 0) {
+      log_files = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--log-rotate-size") == 0) {
+      log_rotate_kb = std::max(0, std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--log-rotate-interval") == 0) {
+      log_rotate_interval = std::max(0, std::atoi(argv[i + 1]));
+    }
+  }
+  bot::write_behind(write_behind_ms, write_behind_max);
+  login_admission::configure(login_concurrency, login_rate,
+                             std::max(1, static_cast<int>(login_rate)));
+
   bot::load_packages("packages");
 
   asio::io_service io_service;
   asio::io_service::work work(io_service);
 
-  std::map<std::string, std::shared_ptr<bot_config>> configs;
+  // JSON configurations (configs/* and the --ndjson file), parsed in parallel.
+  config_loader::error_fn on_error = [](const std::string& source,
+                                        const std::string& error) {
+    std::cout << "invalid configuration " << source << ": " << error << "\n";
+  };
+  config_loader::config_map configs =
+      config_loader::load_directory("configs", 0, on_error);
+  if (!ndjson_path.empty()) {
+    try {
+      auto bulk = config_loader::load_ndjson(ndjson_path, 0, on_error);
+      configs.insert(bulk.begin(), bulk.end());
+    } catch (const std::runtime_error& e) {
+      std::cout << "ERROR: " << e.what() << "\n";
+    }
+  }
 
+  // Persistent configurations (append-only logs).
   using boost::filesystem::directory_iterator;
   for (directory_iterator i = directory_iterator("configs");
        i != directory_iterator(); ++i) {
-    std::string path = i->path().relative_path().generic_string();
+    if (i->path().extension() != ".log") {
+      continue;
+    }
 
-    std::ifstream file;
-    file.open(path.c_str(), std::ios::in);
-    std::stringstream content;
-    boost::iostreams::copy(file, content);
+    std::string path = i->path().relative_path().generic_string();
+    try {
+      configs[path] = std::make_shared<log_bot_config>(path, log_sync);
+    } catch (const std::runtime_error& e) {
+      std::cout << "invalid configuration log " << path << ": "
+                << e.what() << "\n";
+    }
+  }
 
+  // Restore the checkpointed bots that still have a configuration. The
+  // configuration (file or log) wins, the checkpoint only contributes the
+  // session: cookies, checked proxies and whether the bot was logged in.
+  struct restored_bot {
+    std::shared_ptr<bot_config> config;
+    std::vector<std::string> proxies;
+    bool session;
+  };
+  std::vector<restored_bot> restored;
+  std::unique_ptr<fleet_checkpoint> checkpoint;
+  if (!checkpoint_path.empty()) {
     try {
-      auto c = std::make_shared<mem_bot_config>(content.str());
-      std::string identifier = bot::identifier(c->username(),
-                                               c->package(),
-                                               c->server());
-      configs[path] = c;
+      checkpoint.reset(new fleet_checkpoint(checkpoint_path));
+
+      std::map<std::string, std::string> paths;
+      for (const auto& c : configs) {
+        paths[c.second->identifier()] = c.first;
+      }
+
+      std::time_t saved = checkpoint->restore(
+          [&configs, &paths, &restored](const fleet_checkpoint::entry& e) {
+        // Configurations deleted while the process was down stay deleted.
+        auto path = paths.find(e.identifier.to_string());
+        if (path == paths.end()) {
+          return;
+        }
+
+        restored_bot r;
+        r.config = configs[path->second];
+        std::map<std::string, std::string> cookies;
+        for (const auto& cookie : e.cookies) {
+          cookies[cookie.first.to_string()] = cookie.second.to_string();
+        }
+        r.config->cookies(cookies);
+        configs.erase(path->second);
+
+        for (const auto& proxy : e.proxies) {
+          r.proxies.push_back(proxy.to_string());
+        }
+        r.session = e.session && !e.cookies.empty();
+        restored.push_back(r);
+      });
+
+      bool fresh = std::time(nullptr) - saved < session_ttl;
+      for (auto& r : restored) {
+        r.session = r.session && fresh;
+      }
+      std::cout << "restored " << restored.size() << " bots"
+                << (fresh ? "" : " (sessions expired)") << "\n";
     } catch (const std::runtime_error& e) {
-      std::cout << "invalid configuation:\n" << content.str() << "\n";
+      std::cout << "invalid checkpoint " << checkpoint_path << ": "
+                << e.what() << "\n";
+    }
+  }
+
+  // Log lines go to the log sink if enabled (written on its own thread).
+  shard_pool* shards = nullptr;
+  std::unique_ptr<log_sink> sink;
+  if (!log_dir.empty()) {
+    log_sink::file_fn file_of = log_sink::single("botscript");
+    if (log_files == "bot") {
+      file_of = log_sink::per_bot();
+    } else if (log_files == "shard") {
+      file_of = [&shards](const std::string& identifier) {
+        std::size_t shard = shards != nullptr ? shards->shard_of(identifier)
+                                              : 0;
+        return "shard-" + std::to_string(shard);
+      };
     }
+    sink.reset(new log_sink(log_dir == "-" ? "" : log_dir, file_of,
+                            log_rotate_kb * 1024u, log_rotate_interval));
   }
 
-  bot::upd_cb update_cb = [](std::string, std::string k, std::string v) {
-    if (k == "log") { print_log(v); }
+  bot::upd_cb update_cb =
+      [&sink](std::string identifier, std::string k, std::string v) {
+    if (k != "log") {
+      return;
+    } else if (sink != nullptr) {
+      sink->push(std::move(identifier), std::move(v));
+    } else {
+      print_log(v);
+    }
   };
+  // Called concurrently by the shard channels: log_sink::push and
+  // print_log are thread safe.
+  update_channel::deliver_fn deliver =
+      [&sink](const std::vector<update_channel::update>& updates) {
+    for (const auto& u : updates) {
+      if (u.key != "log") {
+        continue;
+      } else if (sink != nullptr) {
+        sink->push(u.identifier, u.value);
+      } else {
+        print_log(u.value);
+      }
+    }
+  };
+  auto batch_interval = boost::posix_time::milliseconds(update_batch_ms);
+
+  // Sharded runtime: bots are pinned to shards, the pool runs forever.
+  if (shard_count >= 0) {
+    shard_pool pool(static_cast<std::size_t>(shard_count));
+    shards = &pool;
+    if (update_batch_ms > 0) {
+      pool.batch_updates(batch_interval, update_batch_max, deliver);
+    }
+    for (const auto& r : restored) {
+      try {
+        if (r.session) {
+          pool.resume(r.config, r.proxies, update_cb, init_cb);
+        } else {
+          pool.start(r.config, update_cb, init_cb);
+        }
+      } catch (const std::runtime_error& e) {
+        std::cout << "ERROR: " << e.what() << "\n";
+      }
+    }
+    for (const auto& c : configs) {
+      try {
+        pool.start(c.second, update_cb, init_cb);
+      } catch (const std::runtime_error& e) {
+        std::cout << "ERROR: " << e.what() << "\n";
+      }
+    }
+    if (checkpoint != nullptr) {
+      checkpoint->start(pool.io_service(0), checkpoint_interval);
+    }
+    coarse_clock::start(pool.io_service(0));
+    login_admission::refill_service(pool.io_service(0));
+    pool.run();
+    pool.join();
+    if (sink != nullptr) {
+      sink->stop();
+      std::cout << "log lines dropped: " << sink->stats().dropped << "\n";
+    }
+    checkpoint.reset();
+    return 0;
+  }
+
+  std::unique_ptr<update_channel> channel;
+  if (update_batch_ms > 0) {
+    channel.reset(new update_channel(&io_service, batch_interval,
+                                     update_batch_max, deliver));
+    update_cb = channel->callback();
+  }
 
   std::vector<std::shared_ptr<bot>> bots;
+  for (const auto& r : restored) {
+    auto b = std::make_shared<bot>(&io_service);
+    b->update_callback_ = update_cb;
+    if (r.session) {
+      b->restore(r.config, r.proxies, init_cb);
+    } else {
+      b->init(r.config, init_cb);
+    }
+    bots.push_back(b);
+  }
   for(const auto& c : configs) {
     auto b = std::make_shared<bot>(&io_service);
     b->update_callback_ = update_cb;
@@ -90,11 +358,27 @@ int main() {
   });
 */
 
+  if (checkpoint != nullptr) {
+    checkpoint->start(&io_service, checkpoint_interval);
+  }
+  coarse_clock::start(&io_service);
+  login_admission::refill_service(&io_service);
+
+  // Run the io_service on all threads (bots are serialized by their strands).
+  boost::thread_group threads;
+  for (int i = 1; i < thread_count; ++i) {
+    threads.create_thread([&io_service]() { io_service.run(); });
+  }
   io_service.run();
+  threads.join_all();
 
   for (auto& b : bots) {
     b->shutdown();
   }
 
+  if (sink != nullptr) {
+    sink->stop();
+    std::cout << "log lines dropped: " << sink->stats().dropped << "\n";
+  }
   return 0;
 }
@@ -13,6 +13,7 @@
 #include "rapidjson/stringbuffer.h"
 
 #include "./bot.h"
+#include "./footprint.h"
 
 namespace json = rapidjson;
 using namespace std;
@@ -28,11 +29,29 @@ mem_bot_config::mem_bot_config(const string& json_config) {
   if (document.Parse<0>(json_config.c_str()).HasParseError()) {
     throw runtime_error("invalid JSON");
   }
+  load(document);
+}
+
+mem_bot_config::mem_bot_config(const json::Value& document) {
+  load(document);
+}
+
+namespace {
+
+/// \return a reference to the string value (no copy)
+inline boost::string_ref str(const json::Value& value) {
+  return boost::string_ref(value.GetString(), value.GetStringLength());
+}
 
+}  // namespace
+
+void mem_bot_config::load(const json::Value& document) {
   // Check if all necessary configuration values are available.
-  if (!document.HasMember("modules") ||
+  if (!document.IsObject() ||
+      !document.HasMember("modules") ||
       !document["modules"].IsObject() ||
       !document["modules"].HasMember("base") ||
+      !document["modules"]["base"].IsObject() ||
       !document["modules"]["base"].HasMember("wait_time_factor") ||
       !document["modules"]["base"]["wait_time_factor"].IsString() ||
       !document["modules"]["base"].HasMember("proxy") ||
@@ -49,10 +68,10 @@ mem_bot_config::mem_bot_config(const string& json_config) {
   }
 
   // Read basic configuration values.
-  username_ = document["username"].GetString();
-  password_ = document["password"].GetString();
-  package_ = document["package"].GetString();
-  server_ = document["server"].GetString();
+  username_ = str(document["username"]).to_string();
+  password_ = str(document["password"]).to_string();
+  package_ = str(document["package"]).to_string();
+  server_ = str(document["server"]).to_string();
   identifier_ = bot::identifier(username_, package_, server_);
 
   // Read inactive flag.
@@ -60,7 +79,7 @@ mem_bot_config::mem_bot_config(const string& json_config) {
     if (!document["inactive"].IsString()) {
       throw runtime_error("invalid configuration: inactive flag must be str");
     }
-    inactive_ = std::string(document["inactive"].GetString()) == "1";
+    inactive_ = str(document["inactive"]) == "1";
   } else {
     inactive_ = false;
   }
@@ -71,18 +90,19 @@ mem_bot_config::mem_bot_config(const string& json_config) {
     json::Value const& cookies = document["cookies"];
     json::Value::ConstMemberIterator it = cookies.MemberBegin();
     for (; it != cookies.MemberEnd(); ++it) {
-      cookies_[it->name.GetString()] = it->value.GetString();
+      if (!it->value.IsString()) {
+        throw runtime_error("invalid configuration: cookie must be str");
+      }
+      cookies_[str(it->name).to_string()] = str(it->value).to_string();
     }
   }
 
   // Read and set wait time factor.
-  string wtf = document["modules"]["base"]["wait_time_factor"].GetString();
-  wtf = wtf.empty() ? "1.00" : wtf;
-  module_settings_["base"]["wait_time_factor"] = wtf;
+  boost::string_ref wtf = str(document["modules"]["base"]["wait_time_factor"]);
+  put("base", "wait_time_factor", wtf.empty() ? "1.00" : wtf);
 
   // Read and set proxy.
-  string proxy = document["modules"]["base"]["proxy"].GetString();
-  module_settings_["base"]["proxy"] = proxy;
+  put("base", "proxy", str(document["modules"]["base"]["proxy"]));
 
   // Read module settings
   const json::Value& modules = document["modules"];
@@ -96,7 +116,7 @@ mem_bot_config::mem_bot_config(const string& json_config) {
     }
 
     // Extract module name.
-    string module_name = i->name.GetString();
+    boost::string_ref module_name = str(i->name);
 
     // Base module had been handled previously.
     if (module_name == "base") {
@@ -107,16 +127,19 @@ mem_bot_config::mem_bot_config(const string& json_config) {
     json::Value::ConstMemberIterator it = m.MemberBegin();
     for (; it != m.MemberEnd(); ++it) {
       // Read property name.
-      string key = it->name.GetString();
+      boost::string_ref key = str(it->name);
 
       // Ignore "name" because the module name is not relevant for the state.
       if (key == "name") {
         continue;
       }
 
+      if (!it->value.IsString()) {
+        throw runtime_error("invalid configuration: setting must be str");
+      }
+
       // Set module status variable.
-      string value = it->value.GetString();
-      module_settings_[module_name][key] = value;
+      put(module_name, key, str(it->value));
     }
   }
 }
@@ -132,20 +155,26 @@ mem_bot_config::mem_bot_config(const string& identifier,
     username_(username),
     password_(password),
     package_(package),
-    server_(server),
-    module_settings_(module_settings) {
+    server_(server) {
+  for (const auto& module : module_settings) {
+    for (const auto& setting : module.second) {
+      put(module.first, setting.first, setting.second);
+    }
+  }
 }
 
 command_sequence mem_bot_config::init_command_sequence() const {
   command_sequence commands;
 
   // Base settings first.
-  const string& wtf = module_settings_.at("base").at("wait_time_factor");
-  auto wtf_init = make_pair("base_set_wait_time_factor", wtf);
-  commands.emplace_back(move(wtf_init));
+  const string* wtf = find("base", "wait_time_factor");
+  if (wtf == nullptr) {
+    throw out_of_range("base_wait_time_factor not set");
+  }
+  commands.emplace_back(make_pair("base_set_wait_time_factor", *wtf));
 
-  // Iterate modules.
-  for (const auto& module : module_settings_) {
+  // Iterate modules (sorted by name).
+  for (const auto& module : module_settings()) {
     const string& module_name = module.first;
 
     // Don't handle base twice.
@@ -200,7 +229,7 @@ string mem_bot_config::to_json(bool with_password) const {
 
   // Write module configuration values.
   rapidjson::Value modules(rapidjson::kObjectType);
-  for(const auto& module : module_settings_) {
+  for(const auto& module : module_settings()) {
     // Initialize module JSON object and add name property.
     rapidjson::Value m(rapidjson::kObjectType);
 
@@ -229,24 +258,90 @@ string mem_bot_config::to_json(bool with_password) const {
   return buffer.GetString();
 }
 
+bool mem_bot_config::split(boost::string_ref full_key,
+                           boost::string_ref* module,
+                           boost::string_ref* key) {
+  auto pos = full_key.find('_');
+  if (pos == boost::string_ref::npos) {
+    return false;
+  }
+  *module = full_key.substr(0, pos);
+  *key = full_key.substr(pos + 1);
+  return true;
+}
+
+void mem_bot_config::put(boost::string_ref module, boost::string_ref key,
+                         boost::string_ref value) {
+  key_pool::id module_id = key_pool::intern(module);
+  key_pool::id key_id = key_pool::intern(key);
+  setting& s = settings_[key_pool::pair(module_id, key_id)];
+  if (s.module == nullptr) {
+    s.module = &key_pool::str(module_id);
+    s.key = &key_pool::str(key_id);
+  }
+  s.value.assign(value.data(), value.size());
+}
+
+const string* mem_bot_config::find(boost::string_ref module,
+                                   boost::string_ref key) const {
+  // Names that were never interned can't be set.
+  key_pool::id module_id, key_id;
+  if (!key_pool::find(module, &module_id) || !key_pool::find(key, &key_id)) {
+    return nullptr;
+  }
+
+  auto it = settings_.find(key_pool::pair(module_id, key_id));
+  return it != settings_.end() ? &it->second.value : nullptr;
+}
+
 string mem_bot_config::value_of(const string& key) const {
-  auto pos = key.find("_");
-  if (pos != string::npos) {
-    string module = key.substr(0, pos);
-    string setting = key.substr(pos + 1);
-
-    const auto it1 = module_settings_.find(module);
-    if (it1 != module_settings_.cend()) {
-      const auto it2 = it1->second.find(setting);
-      if (it2 != it1->second.end()) {
-        return it2->second;
-      }
-    }
+  boost::string_ref module, setting;
+  if (split(key, &module, &setting)) {
+    return value_of(module, setting);
   }
 
   return "";
 }
 
+void mem_bot_config::visit(const setting_visitor& visitor) const {
+  for (const auto& s : settings_) {
+    visitor(*s.second.module, *s.second.key, s.second.value);
+  }
+}
+
+void mem_bot_config::visit(boost::string_ref module,
+                           const setting_visitor& visitor) const {
+  key_pool::id module_id;
+  if (!key_pool::find(module, &module_id)) {
+    return;
+  }
+
+  for (const auto& s : settings_) {
+    if (s.first >> 32 == module_id) {
+      visitor(*s.second.module, *s.second.key, s.second.value);
+    }
+  }
+}
+
+bool mem_bot_config::has_cookies() const {
+  return !cookies_.empty();
+}
+
+std::size_t mem_bot_config::settings_footprint() const {
+  // Hash nodes: next pointer + cached hash + key + setting (names are
+  // interned and shared, they are not counted).
+  std::size_t size = settings_.bucket_count() * sizeof(void*);
+  for (const auto& s : settings_) {
+    size += 2 * sizeof(void*) + sizeof(std::uint64_t) +
+            sizeof(setting) - sizeof(string) + footprint_of(s.second.value);
+  }
+  return size;
+}
+
+std::size_t mem_bot_config::cookies_footprint() const {
+  return footprint_of(cookies_);
+}
+
 bool mem_bot_config::inactive() const {
   return inactive_;
 }
@@ -276,7 +371,11 @@ string mem_bot_config::server() const {
 }
 
 map<string, string_map> mem_bot_config::module_settings() const {
-  return module_settings_;
+  map<string, string_map> modules;
+  for (const auto& s : settings_) {
+    modules[*s.second.module][*s.second.key] = s.second.value;
+  }
+  return modules;
 }
 
 std::map<std::string, std::string> mem_bot_config::cookies() const {
@@ -288,15 +387,13 @@ void mem_bot_config::cookies(std::map<std::string, std::string> const& cookies)
 }
 
 void mem_bot_config::set(const string& module, const string& key, const string& value) {
-  module_settings_[module][key] = value;
+  put(module, key, value);
 }
 
 void mem_bot_config::set(const string& key, const string& value) {
-  auto pos = key.find("_");
-  if (pos != string::npos) {
-    string module = key.substr(0, pos);
-    string setting = key.substr(pos + 1);
-    module_settings_[module][setting] = value;
+  boost::string_ref module, setting;
+  if (split(key, &module, &setting)) {
+    put(module, setting, value);
   }
 }
 
@@ -5,12 +5,17 @@
 #ifndef MEM_CONFIG_H_
 #define MEM_CONFIG_H_
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <utility>
 
+#include "rapidjson/document.h"
+
 #include "./bot_config.h"
+#include "./key_pool.h"
 
 namespace botscript {
 
@@ -18,6 +23,14 @@ class mem_bot_config : public bot_config {
  public:
   mem_bot_config();
   mem_bot_config(const std::string& json_config);
+
+  /// Reads the configuration from a parsed JSON document (for example
+  /// parsed in-situ by the config_loader). Strings are read with their
+  /// length and copied once into the configuration.
+  ///
+  /// \param document the configuration document
+  /// \throws std::runtime_error if the configuration is invalid
+  explicit mem_bot_config(const rapidjson::Value& document);
   mem_bot_config(const std::string& identifier,
                  const std::string& username,
                  const std::string& password,
@@ -28,6 +41,14 @@ class mem_bot_config : public bot_config {
   virtual command_sequence init_command_sequence() const override;
   virtual std::string to_json(bool with_password) const override;
   virtual std::string value_of(const std::string& key) const override;
+  using bot_config::value_of;
+
+  virtual const std::string* find(boost::string_ref module,
+                                  boost::string_ref key) const override;
+  virtual void visit(const setting_visitor& visitor) const override;
+  virtual void visit(boost::string_ref module,
+                     const setting_visitor& visitor) const override;
+  virtual bool has_cookies() const override;
 
   virtual void inactive(bool flag) override;
   virtual bool inactive() const override;
@@ -42,6 +63,9 @@ class mem_bot_config : public bot_config {
   virtual std::map<std::string, std::string> cookies() const override;
   virtual void cookies(std::map<std::string, std::string> const&) override;
 
+  virtual std::size_t settings_footprint() const override;
+  virtual std::size_t cookies_footprint() const override;
+
   virtual void set(const std::string& module,
                    const std::string& key,
                    const std::string& value) override;
@@ -49,9 +73,34 @@ class mem_bot_config : public bot_config {
                    const std::string& value) override;
 
  private:
+  /// Reads and validates the configuration document.
+  ///
+  /// \param document the configuration document
+  /// \throws std::runtime_error if the configuration is invalid
+  void load(const rapidjson::Value& document);
+
+  /// A module setting. Module and key reference the interned names.
+  struct setting {
+    const std::string* module;
+    const std::string* key;
+    std::string value;
+  };
+
+  /// Splits "{module}_{key}" at the first underscore.
+  ///
+  /// \return whether the key contains an underscore
+  static bool split(boost::string_ref full_key,
+                    boost::string_ref* module, boost::string_ref* key);
+
+  /// Sets a module setting (interns module and key if they are new).
+  void put(boost::string_ref module, boost::string_ref key,
+           boost::string_ref value);
+
   bool inactive_;
   std::string identifier_, username_, password_, package_, server_;
-  std::map<std::string, string_map> module_settings_;
+
+  /// Flat settings storage: (module id, setting id) -> setting.
+  std::unordered_map<std::uint64_t, setting> settings_;
   std::map<std::string, std::string> cookies_;
 };
 
@@ -4,10 +4,6 @@
 
 #include "./module.h"
 
-#include <sstream>
-
-#include "boost/lexical_cast.hpp"
-
 namespace botscript {
 
 namespace asio = boost::asio;
@@ -15,6 +11,7 @@ namespace asio = boost::asio;
 module::module(const std::string& module_name,
                const std::string& base_script,
                const std::string& script,
+               const std::map<std::string, std::string>* defaults,
                std::shared_ptr<bot> bot,
                asio::io_service* io_service)
     : io_service_(io_service),
@@ -30,9 +27,9 @@ module::module(const std::string& module_name,
       finally_result_stored_(false),
       wait_min_(-1),
       wait_max_(-1),
-      load_success_(false) {
-  bot_->log(bot::BS_LOG_NFO, "base",
-            std::string("loading module ") + module_name_);
+      wakeup_(-1),
+      load_success_(nullptr != defaults) {
+  bot_->log(bot::BS_LOG_NFO, "base", "loading module ", module_name_);
 
   // Build basic strings.
   lua_run_ += module_name_;
@@ -42,21 +39,21 @@ module::module(const std::string& module_name,
   // Set active status to "0" (not running).
   bot_->status(lua_active_status_, "0");
 
-  // Initialize status.
-  std::map<std::string, std::string> lua_status;
-  load_success_ = lua_connection::get_status(script, lua_status_, &lua_status);
-  for(const auto& s : lua_status) {
-    bot->status(module_name_ + "_" + s.first, s.second);
+  // Initialize status from the defaults read at package load time.
+  // Values set before the (lazy) instantiation are kept.
+  if (load_success_) {
+    for(const auto& s : *defaults) {
+      if (bot->status_of(module_name_ + "_" + s.first).empty()) {
+        bot->status(module_name_ + "_" + s.first, s.second);
+      }
+    }
   }
 }
 
 module::~module() {
-  std::stringstream msg;
-  msg << "bot use count = " << bot_.use_count();
-  bot_->log(bot::BS_LOG_DBG, module_name_, msg.str());
-  msg.str("");
-  msg << "run callback " << (nullptr == run_callback_ ? "not " : "") << "set";
-  bot_->log(bot::BS_LOG_DBG, module_name_, msg.str());
+  BS_DBG(bot_, module_name_, "bot use count = ", bot_.use_count());
+  BS_DBG(bot_, module_name_, "run callback ",
+         nullptr == run_callback_ ? "not set" : "set");
 }
 
 void module::run(std::shared_ptr<module> self, boost::system::error_code) {
@@ -65,7 +62,7 @@ void module::run(std::shared_ptr<module> self, boost::system::error_code) {
     boost::lock_guard<boost::mutex> lock(state_mutex_);
     if (module_state_ == OFF || module_state_ == STOP_RUN) {
       // Module state is STOP_RUN - stop!
-      bot_->log(bot::BS_LOG_DBG, module_name_, "STOP_RUN -> run(): OFF");
+      BS_DBG(bot_, module_name_, "STOP_RUN -> run(): OFF");
       module_state_ = OFF;
       return;
     } else {
@@ -77,6 +74,7 @@ void module::run(std::shared_ptr<module> self, boost::system::error_code) {
   // Start module.
   bot_->log(bot::BS_LOG_NFO, module_name_, "starting");
   std::shared_ptr<state_wrapper> state = std::make_shared<state_wrapper>();
+  state_ = state;
   run_callback_ = boost::bind(&module::run_cb, this, self, state, _1);
   lua_connection::module_run(module_name_, lua_run_, state->get(),
                              this, &run_callback_);
@@ -96,18 +94,18 @@ void module::run_cb(std::shared_ptr<module> self,
         boost::lock_guard<boost::mutex> lock(state_mutex_);
         if (module_state_ == OFF || module_state_ == STOP_RUN) {
           // Module state is STOP_RUN - stop!
-          bot_->log(bot::BS_LOG_DBG, module_name_, "STOP_RUN -> run(): OFF");
+          BS_DBG(bot_, module_name_, "STOP_RUN -> run(): OFF");
           module_state_ = OFF;
           return;
         }
       }
 
       module_state_ = WAIT;
-      int sleep = bot_->random(60, 120);
+      int sleep = bot_->wakeup(60, 120, &wakeup_);
       timer_.expires_from_now(boost::posix_time::seconds(sleep));
-      timer_.async_wait(boost::bind(&module::run, this, self, _1));
-      std::string s_str = boost::lexical_cast<std::string>(sleep);
-      bot_->log(bot::BS_LOG_NFO, module_name_, std::string("sleeping ") + s_str);
+      timer_.async_wait(
+          bot_->strand()->wrap(boost::bind(&module::run, this, self, _1)));
+      bot_->log(bot::BS_LOG_NFO, module_name_, "sleeping ", sleep);
     });
   } else {
     if (!run_result_stored_) {
@@ -132,7 +130,7 @@ void module::run_cb(std::shared_ptr<module> self,
           boost::lock_guard<boost::mutex> lock(state_mutex_);
           if (module_state_ == OFF || module_state_ == STOP_RUN) {
             // Module state is STOP_RUN - stop!
-            bot_->log(bot::BS_LOG_DBG, module_name_, "STOP_RUN -> run(): OFF");
+            BS_DBG(bot_, module_name_, "STOP_RUN -> run(): OFF");
             module_state_ = OFF;
             return;
           }
@@ -142,7 +140,7 @@ void module::run_cb(std::shared_ptr<module> self,
 
         // Handle shutdown request.
         if (wait_min_ == -1 && wait_max_ == -1) {
-          bot_->log(bot::BS_LOG_DBG, module_name_, "shutdown requested -> OFF");
+          BS_DBG(bot_, module_name_, "shutdown requested -> OFF");
           bot_->status(lua_active_status_, "0");
           module_state_ = OFF;
           return;
@@ -150,18 +148,18 @@ void module::run_cb(std::shared_ptr<module> self,
 
         int sleep;
         if (wait_min_ >= 0 && wait_max_ >= 0) {
-          sleep = bot_->random(wait_min_, wait_max_);
+          sleep = bot_->wakeup(wait_min_, wait_max_, &wakeup_);
         } else if (wait_max_ >= 0) {
-          sleep = wait_max_;
+          sleep = bot_->wakeup(wait_max_, wait_max_, &wakeup_);
         } else {
-          sleep = bot_->random(60, 120);
+          sleep = bot_->wakeup(60, 120, &wakeup_);
         }
 
         timer_.expires_from_now(boost::posix_time::seconds(sleep));
-        timer_.async_wait(boost::bind(&module::run, this, self, _1));
+        timer_.async_wait(
+            bot_->strand()->wrap(boost::bind(&module::run, this, self, _1)));
 
-        std::string str = boost::lexical_cast<std::string>(sleep);
-        bot_->log(bot::BS_LOG_NFO, module_name_, std::string("sleeping ") + str);
+        bot_->log(bot::BS_LOG_NFO, module_name_, "sleeping ", sleep);
       });
     }
   }
@@ -175,12 +173,12 @@ void module::finally(std::shared_ptr<module> self,
   lua_State* state = state_wr->get();
   lua_getglobal(state, fun_name.c_str());
   if (lua_isfunction(state, -1)) {
-    bot_->log(bot::BS_LOG_DBG, module_name_, "executing finally function");
+    BS_DBG(bot_, module_name_, "executing finally function");
     finally_callback_ = boost::bind(&module::finally_cb, this, self,
                                     state_wr, callback, _1);
     lua_connection::module_finally(fun_name, state, &finally_callback_);
   } else {
-    bot_->log(bot::BS_LOG_DBG, module_name_, "skipping finally function");
+    BS_DBG(bot_, module_name_, "skipping finally function");
     callback();
   }
 }
@@ -190,7 +188,7 @@ void module::finally_cb(std::shared_ptr<module>,
                         std::function<void()> callback,
                         std::string err) {
   if (!err.empty()) {
-    bot_->log(bot::BS_LOG_ERR, module_name_, "finally error: " + err);
+    bot_->log(bot::BS_LOG_ERR, module_name_, "finally error: ", err);
 
     finally_callback_ = nullptr;
     finally_result_stored_ = false;
@@ -207,14 +205,28 @@ void module::finally_cb(std::shared_ptr<module>,
   }
 }
 
-void module::execute(const std::string& command, const std::string& argument) {
-  // Don't handle commands for other modules.
-  bool global = false;
-  if (!boost::starts_with(command, module_name_ +  "_set_") &&
-      !(global = boost::starts_with(command, "global_set_"))) {
+void module::footprint(std::size_t* lua, std::size_t* views) const {
+  std::shared_ptr<state_wrapper> state = state_.lock();
+  if (!state || nullptr == state->get()) {
     return;
   }
 
+  lua_State* l = state->get();
+  *lua += static_cast<std::size_t>(lua_gc(l, LUA_GCCOUNT, 0)) * 1024 +
+          static_cast<std::size_t>(lua_gc(l, LUA_GCCOUNTB, 0));
+
+  lua_context* ctx = lua_connection::context(l);
+  if (nullptr != ctx) {
+    *views += ctx->view_bytes;
+  }
+}
+
+bool module::idle() {
+  boost::lock_guard<boost::mutex> lock(state_mutex_);
+  return module_state_ == OFF;
+}
+
+void module::apply(const std::string& var, const std::string& argument) {
   // Stop execute if we would have to wait for the state mutex.
   if (!state_mutex_.try_lock()) {
     bot_->log(bot::BS_LOG_NFO, module_name_, "execute not possible (locked)");
@@ -224,27 +236,25 @@ void module::execute(const std::string& command, const std::string& argument) {
   // Let the lock guard adopt the lock (RAII).
   boost::lock_guard<boost::mutex> state_lock(state_mutex_, boost::adopt_lock);
 
-  // Extract variable name.
-  std::string var = global ? command.substr(11) :
-                             command.substr(module_name_.length() + 5);
-
   if (var == "active") {
     bool start = (argument == "1");
     if (start) {
       // Handle start command.
       switch (module_state_) {
         case OFF: {
-          bot_->log(bot::BS_LOG_DBG, module_name_, "OFF -> start: RUN");
-          module_state_ = RUN;
-          boost::system::error_code ignored;
-          io_service_->post(boost::bind(&module::run, this,
-                                        shared_from_this(), ignored));
+          // Start at the next second with free capacity (start cap).
+          BS_DBG(bot_, module_name_, "OFF -> start: WAIT");
+          module_state_ = WAIT;
+          int delay = bot_->wakeup(0, 0, &wakeup_);
+          timer_.expires_from_now(boost::posix_time::seconds(delay));
+          timer_.async_wait(bot_->strand()->wrap(
+              boost::bind(&module::run, this, shared_from_this(), _1)));
           bot_->status(lua_active_status_, "1");
           break;
         }
 
         case STOP_RUN: {
-          bot_->log(bot::BS_LOG_DBG, module_name_, "STOP_RUN -> start: RUN");
+          BS_DBG(bot_, module_name_, "STOP_RUN -> start: RUN");
           module_state_ = RUN;
           bot_->status(lua_active_status_, "1");
           break;
@@ -252,16 +262,17 @@ void module::execute(const std::string& command, const std::string& argument) {
 
         default: {
           bot_->refresh_status(lua_active_status_);
-          bot_->log(bot::BS_LOG_DBG, module_name_,
-                    state2s(module_state_) + " -> start: nothing to do");
+          BS_DBG(bot_, module_name_,
+                 state2s(module_state_), " -> start: nothing to do");
         }
       }
     } else {
       // Handle stop command.
       switch (module_state_) {
         case WAIT: {
-          bot_->log(bot::BS_LOG_DBG, module_name_, "WAIT -> stop: STOP_RUN");
+          BS_DBG(bot_, module_name_, "WAIT -> stop: STOP_RUN");
           timer_.cancel();
+          bot_->cancel_wakeup(wakeup_);
           module_state_ = STOP_RUN;
           bot_->status(lua_active_status_, "0");
           break;
@@ -269,15 +280,15 @@ void module::execute(const std::string& command, const std::string& argument) {
 
         case RUN: {
           module_state_ = STOP_RUN;
-          bot_->log(bot::BS_LOG_DBG, module_name_, "RUN -> stop: STOP_RUN");
+          BS_DBG(bot_, module_name_, "RUN -> stop: STOP_RUN");
           bot_->status(lua_active_status_, "0");
           break;
         }
 
         default: {
           bot_->refresh_status(lua_active_status_);
-          bot_->log(bot::BS_LOG_DBG, module_name_,
-                    state2s(module_state_) + " -> stop: nothing to do");
+          BS_DBG(bot_, module_name_,
+                 state2s(module_state_), " -> stop: nothing to do");
         }
       }
     }
@@ -287,34 +298,31 @@ void module::execute(const std::string& command, const std::string& argument) {
     std::string full_key = module_name_ + "_" + var;
 
     // Apply status change if not already done.
-    std::stringstream msg;
-    msg << "setting " << var << " to " << argument;
-    bot_->log(bot::BS_LOG_NFO, module_name_, msg.str());
+    bot_->log(bot::BS_LOG_NFO, module_name_, "setting ", var, " to ", argument);
     bot_->status(full_key, argument);
   }
 }
 
 void module::set_lua_status(lua_State* lua_state) {
   // Get current module staus from the bot.
-  auto module_settings = bot_->config()->module_settings();
-  std::map<std::string, std::string> status = module_settings[module_name_];
-
   // Write the status to the lua script state.
-  for(const auto& s : status) {
+  bool failed = false;
+  bot_->config()->visit(module_name_, [&](const std::string&,
+                                          const std::string& key,
+                                          const std::string& value) {
     // Don't set the active status in lua.
-    if (s.first == "active") {
-      continue;
+    if (failed || key == "active") {
+      return;
     }
 
     try {
-      lua_connection::set_status(lua_state, lua_status_, s.first, s.second);
+      lua_connection::set_status(lua_state, lua_status_, key, value);
     } catch(lua_exception const&) {
-      std::stringstream msg;
-      msg << "could not set status " << s.first << " = " << s.second;
-      bot_->log(bot::BS_LOG_NFO, module_name_, msg.str());
-      return;
+      bot_->log(bot::BS_LOG_NFO, module_name_,
+                "could not set status ", key, " = ", value);
+      failed = true;
     }
-  }
+  });
 }
 
 }  // namespace botscript
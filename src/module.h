@@ -9,6 +9,8 @@
 #include <string>
 
 #include "./bot.h"
+#include "./timing_wheel.h"
+#include "./wakeup_scheduler.h"
 #include "./lua/state_wrapper.h"
 #include "./lua/lua_connection.h"
 
@@ -20,20 +22,25 @@ class module : public std::enable_shared_from_this<module> {
   /// \param module_name  the name of the module
   /// \param base_script  the lua base script (containing util functions)
   /// \param script       the lua script to load
+  /// \param defaults     the default module status (cached by the package),
+  ///                     nullptr if the module could not be introspected
   /// \param bot          the bot that owns this module
   /// \param io_service   the io_service to use for asynchronous operations
   module(const std::string& modul_name,
          const std::string& base_script,
          const std::string& script,
+         const std::map<std::string, std::string>* defaults,
          std::shared_ptr<bot> bot,
          boost::asio::io_service* io_service);
 
   /// Debug deconstructor.
   virtual ~module();
 
-  /// \param command   the command to execute
-  /// \param argument  the command argument
-  void execute(const std::string& command, const std::string& argument);
+  /// Applies a setting routed to this module by bot::execute.
+  ///
+  /// \param setting   the setting to change (without module prefix)
+  /// \param argument  the new value
+  void apply(const std::string& setting, const std::string& argument);
 
   /// \param lua_state the state to write the module_status_ to
   void set_lua_status(lua_State* lua_state);
@@ -45,6 +52,15 @@ class module : public std::enable_shared_from_this<module> {
   bool load_success()              const { return load_success_; }
   const std::string& base_script() const { return base_script_; }
 
+  /// \return whether the module is off (not running, waiting or stopping)
+  bool idle();
+
+  /// Adds the memory held by the lua state of the running module.
+  ///
+  /// \param lua    the lua heap size (in bytes) to add to
+  /// \param views  the size of the responses held by lua views to add to
+  void footprint(std::size_t* lua, std::size_t* views) const;
+
  private:
   /// Enum representing the different states the module can be in.
   ///
@@ -67,7 +83,7 @@ class module : public std::enable_shared_from_this<module> {
   }
 
   /// \param self shared pointer to self to keep us in mind
-  /// \param ec the error code provided by the Asio deadline_timer
+  /// \param ec the error code provided by the wheel_timer
   void run(std::shared_ptr<module> self, boost::system::error_code);
 
   /// Callback function that will be called after the lua script execution has
@@ -110,7 +126,10 @@ class module : public std::enable_shared_from_this<module> {
   std::string lua_status_;
   std::string lua_active_status_;
 
-  boost::asio::deadline_timer timer_;
+  wheel_timer timer_;
+
+  /// The lua state of the current run (if running).
+  std::weak_ptr<state_wrapper> state_;
 
   boost::mutex state_mutex_;
   char module_state_;
@@ -120,6 +139,9 @@ class module : public std::enable_shared_from_this<module> {
 
   int wait_min_, wait_max_;
 
+  /// The planned wakeup (given back if the wait is cancelled).
+  wakeup_scheduler::reservation wakeup_;
+
   bool load_success_;
 };
 
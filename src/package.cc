@@ -21,6 +21,7 @@
 #include "boost/iostreams/device/back_inserter.hpp"
 
 #include "./lua/lua_connection.h"
+#include "./lua/state_wrapper.h"
 
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
@@ -34,15 +35,15 @@ typedef std::map<std::string, std::string> mod_map;
 package::package(std::string name, std::map<std::string, std::string> modules, bool const zipped)
     : name_(std::move(name)),
       modules_(zipped ? unzip(std::move(modules)) : std::move(modules)),
-      servers_(lua_connection::server_list(modules_["servers"])),
-      interface_(json_description(modules_, servers_, name_)) {
+      login_check_(false) {
+  introspect();
 }
 
 package::package(const std::string& path)
     : name_(name_from_path(path)),
       modules_(unzip_if_no_directory(read_modules(path), path)),
-      servers_(lua_connection::server_list(modules_["servers"])),
-      interface_(json_description(modules_, servers_, name_)) {
+      login_check_(false) {
+  introspect();
 }
 
 const std::string& package::name() const {
@@ -66,6 +67,38 @@ const std::string& package::interface_desc() const {
   return interface_;
 }
 
+bool package::has_login_check() const {
+  return login_check_;
+}
+
+const std::map<std::string, std::string>* package::status_defaults(
+    const std::string& module) const {
+  auto i = statuses_.find(module);
+  return i == statuses_.end() ? nullptr : &i->second;
+}
+
+void package::introspect() {
+  // One state for all scripts of the package.
+  state_wrapper state;
+  if (nullptr == state.get()) {
+    throw std::runtime_error("Could not open state to introspect package");
+  }
+  luaL_openlibs(state.get());
+
+  servers_ = lua_connection::server_list(state.get(), modules_["servers"]);
+  interface_ = json_description(state.get());
+
+  // The module scripts ran in the introspection state and may have defined
+  // globals (even check_login): check the base script in a fresh state.
+  state_wrapper base_state;
+  if (nullptr == base_state.get()) {
+    throw std::runtime_error("Could not open state to introspect package");
+  }
+  luaL_openlibs(base_state.get());
+  login_check_ = lua_connection::defines(base_state.get(), modules_["base"],
+                                         "base", "check_login");
+}
+
 std::string package::name_from_path(const std::string& path) {
   // Discover package name.
   std::string stripped_path = path;
@@ -122,23 +155,20 @@ std::map<std::string, std::string> package::unzip(
   return modules;
 }
 
-std::string package::json_description(
-    const std::map<std::string, std::string>& modules,
-    const std::map<std::string, std::string>& servers,
-    const std::string& package_name) {
+std::string package::json_description(lua_State* state) {
   // Initialize JSON document object.
   rapidjson::Document a;
   rapidjson::Document::AllocatorType& alloc = a.GetAllocator();
   a.SetObject();
 
   // Write package name.
-  rapidjson::Value name(package_name.c_str(), alloc);
+  rapidjson::Value name(name_.c_str(), alloc);
   a.AddMember("name", name, alloc);
 
   // Write servers from package:
   // Lua table -> map -> JSON array
   rapidjson::Value l(rapidjson::kArrayType);
-  for (const auto& server : servers) {
+  for (const auto& server : servers_) {
     rapidjson::Value server_name(server.first.c_str(), alloc);
     l.PushBack(server_name, alloc);
   }
@@ -166,15 +196,20 @@ std::string package::json_description(
   // Add base module to modules.
   a.AddMember("base", base, alloc);
 
-  // Write interface descriptions from all modules.
-  for (const auto& module : modules) {
+  // Write interface descriptions and read status defaults from all modules.
+  for (const auto& module : modules_) {
     // Write interface description for real modules
     // (not server listing or base module containing the login function).
     if (module.first != "servers" && module.first != "base") {
       // Write value to package information.
-      auto iface = lua_connection::iface(module.second, module.first, &alloc);
+      auto iface = lua_connection::iface(state, module.second, module.first,
+                                         &alloc);
       rapidjson::Value module_name(module.first.c_str(), alloc);
       a.AddMember(module_name, *iface.get(), alloc);
+
+      // Cache status defaults (the script has just been executed).
+      lua_connection::get_status(state, "status_" + module.first,
+                                 &statuses_[module.first]);
     }
   }
 
@@ -9,6 +9,8 @@
 #include <vector>
 #include <map>
 
+struct lua_State;
+
 namespace botscript {
 
 /// Abstract parent class for bot package provider classes.
@@ -40,6 +42,16 @@ class package {
   /// \return the interface description
   const std::string& interface_desc() const;
 
+  /// \return whether the base script defines a check_login function
+  ///         (checks whether a stored session is still logged in)
+  bool has_login_check() const;
+
+  /// \param module  the name of the module
+  /// \return the default status of the module (status_{module} table)
+  ///         or nullptr if there is no such module
+  const std::map<std::string, std::string>* status_defaults(
+      const std::string& module) const;
+
   /// Loads all module files ("*.lua") from the specified folder.
   /// Excludes hidden files (starting with a ".").
   ///
@@ -75,15 +87,18 @@ class package {
   static std::map<std::string, std::string> unzip(
       std::map<std::string, std::string> modules);
 
-  /// Generates a JSON description of the package.
+  /// Executes all scripts once in a single lua state to read the servers,
+  /// the module interface descriptions and the module status defaults.
+  /// Sets servers_, statuses_, interface_ and login_check_.
   ///
-  /// \param modules       the packages's modules
-  /// \param servers       the packages's servers
-  /// \param package_name  the package name (e.g. 'kv' or 'pg')
-  std::string json_description(
-      const std::map<std::string, std::string>& modules,
-      const std::map<std::string, std::string>& servers,
-      const std::string& package_name);
+  /// \throws std::runtime_error if a script could not be executed
+  void introspect();
+
+  /// Generates a JSON description of the package. Reads the interface
+  /// descriptions and status defaults of all modules.
+  ///
+  /// \param state  the introspection state to execute the module scripts in
+  std::string json_description(lua_State* state);
 
   /// Decompresses using G(un)zip.
   ///
@@ -100,8 +115,14 @@ class package {
   /// Servers mapping (URL -> server short tag).
   std::map<std::string, std::string> servers_;
 
+  /// Module status defaults (module name -> status_{module} table).
+  std::map<std::string, std::map<std::string, std::string>> statuses_;
+
   /// Package interface description.
   std::string interface_;
+
+  /// Whether the base script defines check_login.
+  bool login_check_;
 };
 
 }  // namespace botscript
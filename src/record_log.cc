@@ -0,0 +1,223 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./record_log.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "boost/crc.hpp"
+#include "boost/filesystem.hpp"
+
+namespace botscript {
+
+namespace ip = boost::interprocess;
+namespace fs = boost::filesystem;
+
+static const char log_magic[8] = { 'B', 'S', 'L', 'O', 'G', '0', '0', '1' };
+static const std::size_t record_header = 2 * sizeof(std::uint32_t);
+
+static std::uint32_t checksum(const char* data, std::size_t size) {
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+record_log::record_log(const std::string& path, std::size_t sync_every,
+                       const replay_fn& replay)
+    : path_(path),
+      sync_every_(sync_every),
+      data_(nullptr),
+      capacity_(0),
+      tail_(0),
+      synced_(0),
+      records_(0),
+      unsynced_(0),
+      syncs_(0) {
+  open(replay);
+}
+
+record_log::~record_log() {
+  try {
+    close();
+  } catch (const std::exception&) {
+    // Nothing to do: the records are recovered by the next open().
+  }
+}
+
+void record_log::append(boost::string_ref record) {
+  // A zero length marks the end of the log.
+  if (record.empty()) {
+    return;
+  }
+
+  std::size_t end = tail_ + record_header + record.size();
+  if (end > capacity_) {
+    grow(end);
+  }
+
+  std::uint32_t length = static_cast<std::uint32_t>(record.size());
+  std::uint32_t crc = checksum(record.data(), record.size());
+  char* pos = data_ + tail_;
+  std::memcpy(pos + record_header, record.data(), record.size());
+  std::memcpy(pos + sizeof(length), &crc, sizeof(crc));
+  std::memcpy(pos, &length, sizeof(length));
+
+  tail_ = end;
+  ++records_;
+
+  if (sync_every_ != 0 && ++unsynced_ >= sync_every_) {
+    sync();
+  }
+}
+
+void record_log::sync() {
+  if (region_ == nullptr || synced_ == tail_) {
+    return;
+  }
+
+  region_->flush(synced_, tail_ - synced_, false);
+  synced_ = tail_;
+  unsynced_ = 0;
+  ++syncs_;
+}
+
+void record_log::rewrite(const std::vector<std::string>& records) {
+  // Write the new log completely before replacing the old one.
+  std::string tmp_path = path_ + ".tmp";
+  fs::remove(tmp_path);
+  {
+    record_log tmp(tmp_path, 0, nullptr);
+    for (const auto& record : records) {
+      tmp.append(record);
+    }
+  }
+
+  close();
+  fs::rename(tmp_path, path_);
+  open(nullptr);
+}
+
+void record_log::open(const replay_fn& replay) {
+  if (!fs::exists(path_)) {
+    std::ofstream create(path_.c_str(), std::ios::out | std::ios::binary);
+    if (!create) {
+      throw std::runtime_error("could not create " + path_);
+    }
+  }
+
+  // Preallocate: zeros behind the last record mark the end of the log.
+  std::size_t size = static_cast<std::size_t>(fs::file_size(path_));
+  if (size < RECORD_LOG_INITIAL_SIZE) {
+    size = RECORD_LOG_INITIAL_SIZE;
+    fs::resize_file(path_, size);
+  }
+
+  ip::file_mapping file(path_.c_str(), ip::read_write);
+  file_.swap(file);
+  region_.reset(new ip::mapped_region(file_, ip::read_write, 0, size));
+  data_ = static_cast<char*>(region_->get_address());
+  capacity_ = size;
+
+  // New (or never initialized) file: write the magic.
+  static const char zeros[sizeof(log_magic)] = { 0 };
+  bool fresh = std::memcmp(data_, zeros, sizeof(zeros)) == 0;
+  if (fresh) {
+    std::memcpy(data_, log_magic, sizeof(log_magic));
+  } else if (std::memcmp(data_, log_magic, sizeof(log_magic)) != 0) {
+    region_.reset();
+    throw std::runtime_error(path_ + " is no record log");
+  }
+
+  // Replay the valid records.
+  tail_ = scan(replay, &records_);
+
+  // Discard a torn record (and everything behind it).
+  // (A new magic gets flushed with the first records.)
+  std::memset(data_ + tail_, 0, capacity_ - tail_);
+  synced_ = fresh ? 0 : tail_;
+  unsynced_ = 0;
+}
+
+std::size_t record_log::scan(const replay_fn& replay,
+                             std::size_t* records) const {
+  std::size_t pos = sizeof(log_magic);
+  *records = 0;
+  while (pos + record_header <= capacity_) {
+    std::uint32_t length, crc;
+    std::memcpy(&length, data_ + pos, sizeof(length));
+    std::memcpy(&crc, data_ + pos + sizeof(length), sizeof(crc));
+    const char* record = data_ + pos + record_header;
+    if (length == 0 || length > capacity_ - pos - record_header ||
+        checksum(record, length) != crc) {
+      break;
+    }
+
+    if (replay != nullptr) {
+      replay(boost::string_ref(record, length));
+    }
+    pos += record_header + length;
+    ++*records;
+  }
+  return pos;
+}
+
+void record_log::replay(const replay_fn& replay) const {
+  std::size_t records;
+  scan(replay, &records);
+}
+
+void record_log::put_field(std::string* record, boost::string_ref field) {
+  std::uint32_t length = static_cast<std::uint32_t>(field.size());
+  record->append(reinterpret_cast<const char*>(&length), sizeof(length));
+  record->append(field.data(), field.size());
+}
+
+bool record_log::get_field(boost::string_ref* record,
+                           boost::string_ref* field) {
+  std::uint32_t length;
+  if (record->size() < sizeof(length)) {
+    return false;
+  }
+  std::memcpy(&length, record->data(), sizeof(length));
+  record->remove_prefix(sizeof(length));
+  if (record->size() < length) {
+    return false;
+  }
+  *field = record->substr(0, length);
+  record->remove_prefix(length);
+  return true;
+}
+
+void record_log::close() {
+  if (region_ == nullptr) {
+    return;
+  }
+
+  sync();
+  region_.reset();
+  ip::file_mapping none;
+  file_.swap(none);
+  data_ = nullptr;
+
+  // Give the preallocated space back.
+  fs::resize_file(path_, tail_);
+}
+
+void record_log::grow(std::size_t size) {
+  std::size_t capacity = capacity_;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+
+  sync();
+  region_.reset();
+  fs::resize_file(path_, capacity);
+  region_.reset(new ip::mapped_region(file_, ip::read_write, 0, capacity));
+  data_ = static_cast<char*>(region_->get_address());
+  capacity_ = capacity;
+}
+
+}  // namespace botscript
@@ -0,0 +1,132 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef RECORD_LOG_H_
+#define RECORD_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility/string_ref.hpp"
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+
+/// Initial size of a log file (grows by doubling).
+#define RECORD_LOG_INITIAL_SIZE (64 * 1024)
+
+namespace botscript {
+
+/// Append-only, memory-mapped log of records.
+///
+/// File layout: an 8 byte magic followed by the records. Every record is
+/// stored as [length (4 byte)][CRC-32 of the data (4 byte)][data]. The file
+/// is preallocated with zeros, a zero length marks the end of the log.
+///
+/// Crash safety: when the log is opened, records are replayed up to the first
+/// torn record (length out of bounds or checksum mismatch). Everything behind
+/// it is discarded.
+class record_log {
+ public:
+  typedef std::function<void (boost::string_ref)> replay_fn;
+
+  /// Opens or creates the log and replays the valid records.
+  ///
+  /// \param path        the log file path
+  /// \param sync_every  flush the mapping to disk every n appends
+  ///                    (0 = only on sync(), rewrite() and destruction)
+  /// \param replay      called for every valid record (may be nullptr)
+  /// \throws std::runtime_error if the file is no record log
+  record_log(const std::string& path, std::size_t sync_every,
+             const replay_fn& replay);
+
+  /// Flushes the log and truncates the file to the used size.
+  ~record_log();
+
+  record_log(const record_log&) = delete;
+  record_log& operator=(const record_log&) = delete;
+
+  /// Appends a record (amortized O(1), the file grows by doubling).
+  ///
+  /// \param record  the record data
+  void append(boost::string_ref record);
+
+  /// Flushes all appended records to disk.
+  void sync();
+
+  /// Calls the function for every record in the log. The records reference
+  /// the mapped file (no copy): they are valid until the next append.
+  ///
+  /// \param replay  the function to call
+  void replay(const replay_fn& replay) const;
+
+  /// Atomically replaces the log content with the given records
+  /// (written to "{path}.tmp" which is renamed afterwards).
+  ///
+  /// \param records  the records of the new log
+  void rewrite(const std::vector<std::string>& records);
+
+  /// \return the number of bytes used by the log (including the magic)
+  std::size_t size() const { return tail_; }
+
+  /// \return the number of records in the log
+  std::size_t records() const { return records_; }
+
+  /// \return the number of disk flushes so far
+  std::size_t syncs() const { return syncs_; }
+
+  /// Appends a field (prefixed with its length) to a record.
+  ///
+  /// \param record  the record to append to
+  /// \param field   the field to append
+  static void put_field(std::string* record, boost::string_ref field);
+
+  /// Reads and removes the first field (written by put_field) of a record.
+  ///
+  /// \param record  the remaining record
+  /// \param field   the field to write (references the record data)
+  /// \return whether a complete field was read
+  static bool get_field(boost::string_ref* record, boost::string_ref* field);
+
+ private:
+  /// Maps the file (creating it if it doesn't exist) and determines the
+  /// tail by scanning the records.
+  void open(const replay_fn& replay);
+
+  /// Scans the valid records.
+  ///
+  /// \param replay   called for every valid record (may be nullptr)
+  /// \param records  the number of valid records to write
+  /// \return the end of the last valid record
+  std::size_t scan(const replay_fn& replay, std::size_t* records) const;
+
+  /// Flushes and unmaps the file and truncates it to the used size.
+  void close();
+
+  /// Remaps the file with at least the given size.
+  ///
+  /// \param size  the minimum file size
+  void grow(std::size_t size);
+
+  std::string path_;
+  std::size_t sync_every_;
+
+  boost::interprocess::file_mapping file_;
+  std::unique_ptr<boost::interprocess::mapped_region> region_;
+  char* data_;
+  std::size_t capacity_;
+
+  std::size_t tail_;
+  std::size_t synced_;
+  std::size_t records_;
+  std::size_t unsynced_;
+  std::size_t syncs_;
+};
+
+}  // namespace botscript
+
+#endif  // RECORD_LOG_H_
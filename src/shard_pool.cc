@@ -0,0 +1,270 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./shard_pool.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+namespace botscript {
+
+shard_pool::shard_pool(std::size_t shards)
+    : stopped_(false) {
+  if (shards == 0) {
+    shards = std::max(1u, boost::thread::hardware_concurrency());
+  }
+
+  for (std::size_t i = 0; i < shards; ++i) {
+    std::unique_ptr<shard> s(new shard());
+    s->work.reset(new boost::asio::io_service::work(s->io_service));
+    shards_.push_back(std::move(s));
+  }
+}
+
+shard_pool::~shard_pool() {
+  // Without work the shards return once the posted shutdowns and the
+  // handlers they cancel have run.
+  stop();
+  boost::system_time deadline = boost::get_system_time() +
+      boost::posix_time::milliseconds(SHARD_POOL_SHUTDOWN_MS);
+  for (auto& t : threads_) {
+    if (t.joinable() && !t.timed_join(deadline)) {
+      break;
+    }
+  }
+
+  // Fallback: shards kept alive by pending operations (timers, connections).
+  for (const auto& s : shards_) {
+    s->io_service.stop();
+  }
+  join();
+}
+
+std::size_t shard_pool::size() const {
+  return shards_.size();
+}
+
+boost::asio::io_service* shard_pool::io_service(std::size_t shard) {
+  return &shards_.at(shard)->io_service;
+}
+
+std::size_t shard_pool::shard_of(const std::string& identifier) const {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return shard_of_locked(identifier);
+}
+
+std::size_t shard_pool::shard_of_locked(const std::string& identifier) const {
+  auto i = pinned_.find(identifier);
+  if (i != pinned_.end()) {
+    return i->second;
+  }
+  return std::hash<std::string>()(identifier) % shards_.size();
+}
+
+void shard_pool::start(std::shared_ptr<bot_config> config,
+                       bot::upd_cb update_cb, bot::error_cb cb) {
+  std::string identifier = bot::identifier(config->username(),
+                                           config->package(),
+                                           config->server());
+
+  entry e;
+  e.config = std::move(config);
+  e.update_cb = std::move(update_cb);
+  e.cb = std::move(cb);
+  e.resume = false;
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  start_on(shard_of_locked(identifier), identifier, std::move(e));
+}
+
+void shard_pool::resume(std::shared_ptr<bot_config> config,
+                        std::vector<std::string> proxies,
+                        bot::upd_cb update_cb, bot::error_cb cb) {
+  std::string identifier = bot::identifier(config->username(),
+                                           config->package(),
+                                           config->server());
+
+  entry e;
+  e.config = std::move(config);
+  e.update_cb = std::move(update_cb);
+  e.cb = std::move(cb);
+  e.resume = true;
+  e.proxies = std::move(proxies);
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  start_on(shard_of_locked(identifier), identifier, std::move(e));
+}
+
+void shard_pool::start_on(std::size_t index, const std::string& identifier,
+                          entry e) {
+  shard& s = *shards_[index];
+
+  // Create the bot on the shard's io_service.
+  auto b = std::make_shared<bot>(&s.io_service);
+  b->update_callback_ = s.channel != nullptr ? s.channel->callback()
+                                             : e.update_cb;
+  e.b = b;
+
+  // Forget bots that could not be initialized.
+  bot::error_cb cb = e.cb;
+  bot::error_cb done = [this, index, identifier, cb](std::shared_ptr<bot> b,
+                                                     std::string err) {
+    if (!err.empty()) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      auto& bots = shards_[index]->bots;
+      auto i = bots.find(identifier);
+      if (i != bots.end() && i->second.b == b) {
+        bots.erase(i);
+      }
+    }
+    if (cb != nullptr) {
+      cb(b, err);
+    }
+  };
+
+  std::shared_ptr<bot_config> config = e.config;
+  bool resume = e.resume;
+  std::vector<std::string> proxies = e.proxies;
+  s.bots[identifier] = std::move(e);
+
+  // Initialize within the shard.
+  b->strand()->post([b, config, resume, proxies, done]() {
+    try {
+      if (resume) {
+        b->restore(config, proxies, done);
+      } else {
+        b->init(config, done);
+      }
+    } catch (const std::runtime_error& ex) {
+      done(b, ex.what());
+    }
+  });
+}
+
+void shard_pool::batch_updates(boost::posix_time::time_duration interval,
+                               std::size_t max_batch,
+                               update_channel::deliver_fn deliver) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  for (const auto& s : shards_) {
+    s->channel.reset(new update_channel(&s->io_service, interval, max_batch,
+                                        deliver));
+  }
+}
+
+update_channel::statistics shard_pool::update_stats() const {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  update_channel::statistics sum;
+  for (const auto& s : shards_) {
+    if (s->channel == nullptr) {
+      continue;
+    }
+    update_channel::statistics stats = s->channel->stats();
+    sum.pushed += stats.pushed;
+    sum.coalesced += stats.coalesced;
+    sum.delivered += stats.delivered;
+    sum.batches += stats.batches;
+    sum.stalls += stats.stalls;
+    sum.stall_us += stats.stall_us;
+    sum.max_pending = std::max(sum.max_pending, stats.max_pending);
+  }
+  return sum;
+}
+
+void shard_pool::run() {
+  for (const auto& s : shards_) {
+    boost::asio::io_service* io_service = &s->io_service;
+    threads_.emplace_back([io_service]() { io_service->run(); });
+  }
+}
+
+void shard_pool::stop() {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  stopped_ = true;
+  for (const auto& s : shards_) {
+    for (const auto& b : s->bots) {
+      std::shared_ptr<bot> bot_ptr = b.second.b;
+      bot_ptr->strand()->post([bot_ptr]() { bot_ptr->shutdown(); });
+    }
+    s->bots.clear();
+    s->work.reset();
+
+    // The delivery timer would keep the shard running.
+    if (s->channel != nullptr) {
+      update_channel* channel = s->channel.get();
+      s->io_service.post([channel]() { channel->stop(); });
+    }
+  }
+}
+
+void shard_pool::join() {
+  for (auto& t : threads_) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+}
+
+std::vector<std::size_t> shard_pool::load() const {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  std::vector<std::size_t> loads;
+  for (const auto& s : shards_) {
+    loads.push_back(s->bots.size());
+  }
+  return loads;
+}
+
+std::size_t shard_pool::rebalance(double tolerance) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  // Bots being moved are counted for their target shard.
+  std::vector<std::size_t> loads;
+  std::size_t total = 0;
+  for (const auto& s : shards_) {
+    loads.push_back(s->bots.size());
+    total += s->bots.size();
+  }
+  double limit = (total / static_cast<double>(loads.size())) * (1 + tolerance);
+
+  std::size_t moved = 0;
+  while (true) {
+    auto max = std::max_element(loads.begin(), loads.end());
+    auto min = std::min_element(loads.begin(), loads.end());
+    if (*max - *min <= 1 || *max <= limit) {
+      break;
+    }
+
+    std::size_t from = max - loads.begin(), to = min - loads.begin();
+    auto& bots = shards_[from]->bots;
+    if (bots.empty()) {
+      break;
+    }
+
+    // Detach the bot from its shard and pin it to the target shard.
+    auto it = bots.begin();
+    std::string identifier = it->first;
+    entry e = std::move(it->second);
+    bots.erase(it);
+    pinned_[identifier] = to;
+    --*max;
+    ++*min;
+    ++moved;
+
+    // Shut it down within the old shard, then restart it on the new one.
+    std::shared_ptr<bot> old = std::move(e.b);
+    e.resume = false;
+    old->strand()->post([this, old, identifier, to, e]() {
+      old->shutdown();
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (!stopped_) {
+        start_on(to, identifier, e);
+      }
+    });
+  }
+
+  return moved;
+}
+
+}  // namespace botscript
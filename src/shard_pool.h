@@ -0,0 +1,171 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef SHARD_POOL_H_
+#define SHARD_POOL_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/thread.hpp"
+#include "boost/utility.hpp"
+
+#include "./bot.h"
+#include "./bot_config.h"
+#include "./update_channel.h"
+
+/// Time the destructor waits for the shards to run the bot shutdowns before
+/// it stops their io_services (milliseconds).
+#define SHARD_POOL_SHUTDOWN_MS 5000
+
+namespace botscript {
+
+/// Sharded executor: one io_service run by one thread per shard.
+///
+/// Every bot is pinned to a shard by hashing its identifier. All objects of
+/// a bot (browser, connections, resolvers, timers, lua states) are created on
+/// the io_service of its shard, so no handler state is shared across shards.
+/// Per shard are also the io_service services (timing_wheel,
+/// wakeup_scheduler with its share of the start cap). Shared by all shards
+/// are:
+///
+///   * the (immutable) packages
+///   * the mutex protected lua_connection bot registry
+///   * login_admission (fleet wide login limits, mutex protected)
+///   * key_pool (lock-free reads, interning takes a mutex)
+///
+/// Bots can be moved between shards with rebalance(). A moved bot is shut
+/// down on its old shard and initialized (logged in) again on the new one
+/// with the same configuration.
+class shard_pool : boost::noncopyable {
+ public:
+  /// \param shards the number of shards (0: one per hardware thread)
+  explicit shard_pool(std::size_t shards = 0);
+
+  /// Shuts down all bots and waits for the shard threads to finish. Shards
+  /// still running after SHARD_POOL_SHUTDOWN_MS are stopped.
+  ~shard_pool();
+
+  /// \return the number of shards
+  std::size_t size() const;
+
+  /// \param shard the shard index
+  /// \return the io_service of the given shard
+  boost::asio::io_service* io_service(std::size_t shard);
+
+  /// \param identifier the bot identifier
+  /// \return the shard the bot with the given identifier is pinned to
+  std::size_t shard_of(const std::string& identifier) const;
+
+  /// Creates the bot on its shard and initializes it there.
+  ///
+  /// \param config the bot configuration
+  /// \param update_cb the update callback to set
+  /// \param cb the init callback
+  /// \throws std::runtime_error if the package of the bot is not available
+  void start(std::shared_ptr<bot_config> config, bot::upd_cb update_cb,
+             bot::error_cb cb);
+
+  /// Creates the bot on its shard and restores its session there
+  /// (see bot::restore()). Rebalanced bots log in again.
+  ///
+  /// \param config the restored bot configuration
+  /// \param proxies the proxies that passed the check
+  /// \param update_cb the update callback to set
+  /// \param cb the init callback
+  /// \throws std::runtime_error if the package of the bot is not available
+  void resume(std::shared_ptr<bot_config> config,
+              std::vector<std::string> proxies, bot::upd_cb update_cb,
+              bot::error_cb cb);
+
+  /// Delivers the updates of bots started afterwards in batches: every shard
+  /// gets its own update_channel (the update callbacks passed to start() are
+  /// not used then). Batches of different shards are delivered concurrently,
+  /// so the batch callback has to be thread safe.
+  ///
+  /// \param interval the maximum time an update stays queued
+  /// \param max_batch deliver when this many updates are queued
+  /// \param deliver the batch callback
+  void batch_updates(boost::posix_time::time_duration interval,
+                     std::size_t max_batch,
+                     update_channel::deliver_fn deliver);
+
+  /// \return the update channel statistics of all shards (summed up)
+  update_channel::statistics update_stats() const;
+
+  /// Starts one thread per shard running its io_service.
+  void run();
+
+  /// Shuts down all bots and stops the shards (without waiting).
+  void stop();
+
+  /// Waits for all shard threads to finish.
+  void join();
+
+  /// \return the number of bots per shard
+  std::vector<std::size_t> load() const;
+
+  /// Moves bots from the most to the least loaded shards until the difference
+  /// is within the given tolerance (relative to the average load).
+  ///
+  /// \param tolerance the accepted relative deviation from the average load
+  /// \return the number of bots moved
+  std::size_t rebalance(double tolerance = 0.25);
+
+ private:
+  /// A bot running on a shard and the information to restart it elsewhere.
+  struct entry {
+    std::shared_ptr<bot> b;
+    std::shared_ptr<bot_config> config;
+    bot::upd_cb update_cb;
+    bot::error_cb cb;
+
+    /// Whether to restore the session instead of logging in.
+    bool resume;
+    std::vector<std::string> proxies;
+  };
+
+  /// A shard: io_service, the work keeping it alive, its bots and the
+  /// update channel (if updates are batched).
+  struct shard {
+    boost::asio::io_service io_service;
+    std::unique_ptr<boost::asio::io_service::work> work;
+    std::map<std::string, entry> bots;
+    std::unique_ptr<update_channel> channel;
+  };
+
+  /// \param identifier the bot identifier
+  /// \return the shard of the bot (has to be called with mutex_ locked)
+  std::size_t shard_of_locked(const std::string& identifier) const;
+
+  /// Creates and initializes the bot on the given shard.
+  /// Has to be called with mutex_ locked.
+  ///
+  /// \param index the shard index
+  /// \param identifier the bot identifier
+  /// \param e the bot entry (without bot)
+  void start_on(std::size_t index, const std::string& identifier, entry e);
+
+  /// Guards shards_ bot maps and pinned_.
+  mutable boost::mutex mutex_;
+
+  /// The shards.
+  std::vector<std::unique_ptr<shard>> shards_;
+
+  /// Shard overrides of rebalanced bots (identifier -> shard).
+  std::map<std::string, std::size_t> pinned_;
+
+  /// The shard threads.
+  std::vector<boost::thread> threads_;
+
+  /// Whether stop() has been called (moved bots won't be restarted).
+  bool stopped_;
+};
+
+}  // namespace botscript
+
+#endif  // SHARD_POOL_H_
@@ -0,0 +1,246 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./timing_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "boost/asio/error.hpp"
+
+namespace botscript {
+
+namespace pt = boost::posix_time;
+
+// Number of ticks covered by the whole wheel.
+static const std::uint64_t wheel_span =
+    std::uint64_t(1) << (TIMING_WHEEL_BITS * TIMING_WHEEL_LEVELS);
+
+boost::asio::io_service::id timing_wheel::id;
+
+timing_wheel::timing_wheel(boost::asio::io_service& io_service)
+    : boost::asio::io_service::service(io_service),
+      io_service_(io_service),
+      tick_timer_(io_service),
+      ticking_(false),
+      start_(pt::microsec_clock::universal_time()),
+      now_(0) {
+  for (int level = 0; level < TIMING_WHEEL_LEVELS; ++level) {
+    for (int slot = 0; slot < TIMING_WHEEL_SLOTS; ++slot) {
+      entry& head = slots_[level][slot];
+      head.prev = &head;
+      head.next = &head;
+    }
+  }
+}
+
+void timing_wheel::arm(entry* e, const pt::time_duration& duration,
+                       handler fn) {
+  cancel(e);
+
+  pt::ptime now = pt::microsec_clock::universal_time();
+  std::int64_t ms = std::max<std::int64_t>(0, duration.total_milliseconds());
+  std::uint64_t ticks = (ms + TIMING_WHEEL_TICK_MS - 1) / TIMING_WHEEL_TICK_MS;
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  // An empty wheel does not tick: skip the idle time.
+  if (!ticking_) {
+    now_ = std::max(now_, current_tick());
+  }
+
+  e->deadline = now + duration;
+  e->expiry = std::max(now_ + 1, current_tick() + ticks);
+  e->fn = std::move(fn);
+  insert(e);
+  ++stats_.armed;
+
+  start_ticking();
+}
+
+std::size_t timing_wheel::cancel(entry* e) {
+  handler fn;
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (!e->armed()) {
+      return 0;
+    }
+    unlink(e);
+    fn = std::move(e->fn);
+    e->fn = nullptr;
+    --stats_.armed;
+    ++stats_.cancelled;
+  }
+
+  io_service_.post(std::bind(fn, boost::asio::error::operation_aborted));
+  return 1;
+}
+
+timing_wheel::statistics timing_wheel::stats() const {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return stats_;
+}
+
+void timing_wheel::shutdown_service() {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  for (int level = 0; level < TIMING_WHEEL_LEVELS; ++level) {
+    for (int slot = 0; slot < TIMING_WHEEL_SLOTS; ++slot) {
+      entry* head = &slots_[level][slot];
+      while (head->next != head) {
+        entry* e = head->next;
+        unlink(e);
+        e->fn = nullptr;
+      }
+    }
+  }
+  stats_.armed = 0;
+}
+
+void timing_wheel::insert(entry* e) {
+  // Entries beyond the wheel span are parked in the last reachable slot
+  // and re-inserted when they get cascaded.
+  std::uint64_t expiry = std::min(e->expiry, now_ + wheel_span - 1);
+  std::uint64_t delta = expiry > now_ ? expiry - now_ : 0;
+
+  int level = 0;
+  while (level < TIMING_WHEEL_LEVELS - 1 &&
+         delta >= (std::uint64_t(1) << (TIMING_WHEEL_BITS * (level + 1)))) {
+    ++level;
+  }
+  std::size_t slot = (std::max(expiry, now_) >> (TIMING_WHEEL_BITS * level))
+                     & (TIMING_WHEEL_SLOTS - 1);
+
+  entry* head = &slots_[level][slot];
+  e->prev = head->prev;
+  e->next = head;
+  head->prev->next = e;
+  head->prev = e;
+}
+
+void timing_wheel::unlink(entry* e) {
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  e->prev = nullptr;
+  e->next = nullptr;
+}
+
+void timing_wheel::advance(std::vector<entry*>* expired) {
+  ++now_;
+
+  // Cascade entries from the higher levels when a lower level wraps around.
+  for (int level = 1; level < TIMING_WHEEL_LEVELS; ++level) {
+    if ((now_ & ((std::uint64_t(1) << (TIMING_WHEEL_BITS * level)) - 1)) != 0) {
+      break;
+    }
+
+    std::size_t slot = (now_ >> (TIMING_WHEEL_BITS * level))
+                       & (TIMING_WHEEL_SLOTS - 1);
+    entry* head = &slots_[level][slot];
+    while (head->next != head) {
+      entry* e = head->next;
+      unlink(e);
+      insert(e);
+    }
+  }
+
+  // Collect the entries of the current slot.
+  entry* head = &slots_[0][now_ & (TIMING_WHEEL_SLOTS - 1)];
+  while (head->next != head) {
+    entry* e = head->next;
+    unlink(e);
+    if (e->expiry > now_) {
+      insert(e);
+    } else {
+      expired->push_back(e);
+    }
+  }
+}
+
+std::uint64_t timing_wheel::current_tick() const {
+  pt::time_duration elapsed = pt::microsec_clock::universal_time() - start_;
+  return std::max<std::int64_t>(0, elapsed.total_milliseconds())
+         / TIMING_WHEEL_TICK_MS;
+}
+
+void timing_wheel::start_ticking() {
+  if (ticking_ || stats_.armed == 0) {
+    return;
+  }
+
+  ticking_ = true;
+  tick_timer_.expires_at(start_ +
+                         pt::milliseconds((now_ + 1) * TIMING_WHEEL_TICK_MS));
+  tick_timer_.async_wait(std::bind(&timing_wheel::on_tick, this,
+                                   std::placeholders::_1));
+}
+
+void timing_wheel::on_tick(const boost::system::error_code& ec) {
+  if (ec == boost::asio::error::operation_aborted) {
+    return;
+  }
+
+  std::vector<std::pair<handler, pt::ptime>> handlers;
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    // Process all ticks up to now (catches up if the thread was busy).
+    std::vector<entry*> expired;
+    std::uint64_t target = current_tick();
+    while (now_ < target) {
+      advance(&expired);
+    }
+
+    handlers.reserve(expired.size());
+    for (entry* e : expired) {
+      handlers.emplace_back(std::move(e->fn), e->deadline);
+      e->fn = nullptr;
+    }
+    stats_.armed -= expired.size();
+
+    ticking_ = false;
+    start_ticking();
+  }
+
+  // Account lateness and dispatch outside of the lock.
+  pt::ptime now = pt::microsec_clock::universal_time();
+  std::uint64_t total = 0, max = 0;
+  for (auto& h : handlers) {
+    std::int64_t late = (now - h.second).total_milliseconds();
+    std::uint64_t lateness = std::max<std::int64_t>(0, late);
+    total += lateness;
+    max = std::max(max, lateness);
+    io_service_.post(std::bind(h.first, boost::system::error_code()));
+  }
+
+  if (!handlers.empty()) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    stats_.expired += handlers.size();
+    stats_.total_lateness_ms += total;
+    stats_.max_lateness_ms = std::max(stats_.max_lateness_ms, max);
+  }
+}
+
+wheel_timer::wheel_timer(boost::asio::io_service& io_service)
+    : wheel_(boost::asio::use_service<timing_wheel>(io_service)) {
+}
+
+wheel_timer::~wheel_timer() {
+  cancel();
+}
+
+std::size_t wheel_timer::expires_from_now(
+    const pt::time_duration& duration) {
+  duration_ = duration;
+  return cancel();
+}
+
+void wheel_timer::async_wait(timing_wheel::handler fn) {
+  wheel_.arm(&entry_, duration_, std::move(fn));
+}
+
+std::size_t wheel_timer::cancel() {
+  return wheel_.cancel(&entry_);
+}
+
+}  // namespace botscript
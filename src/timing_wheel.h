@@ -0,0 +1,180 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef TIMING_WHEEL_H_
+#define TIMING_WHEEL_H_
+
+#define TIMING_WHEEL_TICK_MS 100
+#define TIMING_WHEEL_LEVELS  4
+#define TIMING_WHEEL_BITS    6
+#define TIMING_WHEEL_SLOTS   (1 << TIMING_WHEEL_BITS)
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "boost/asio/deadline_timer.hpp"
+#include "boost/asio/io_service.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/system/error_code.hpp"
+#include "boost/thread.hpp"
+#include "boost/utility.hpp"
+
+namespace botscript {
+
+/// Hierarchical timing wheel (4 levels with 64 slots, 100ms resolution).
+///
+/// Arming and cancelling timers is O(1). Expired timers are collected in
+/// batches once per tick and their handlers are posted to the io_service.
+/// A single deadline_timer drives the wheel (only while timers are armed).
+///
+/// The wheel is an io_service service: there is one wheel per io_service
+/// (obtained with boost::asio::use_service<timing_wheel>), so it works with
+/// a single io_service as well as with one io_service per shard. Access is
+/// synchronized, the io_service may be run by multiple threads.
+class timing_wheel : public boost::asio::io_service::service {
+ public:
+  /// Handler to call on expiry (or with operation_aborted on cancel).
+  typedef std::function<void (const boost::system::error_code&)> handler;
+
+  /// A timer registered with the wheel (intrusive list node).
+  struct entry : boost::noncopyable {
+    entry() : prev(nullptr), next(nullptr), expiry(0) {}
+
+    /// Whether the entry is linked into a slot of the wheel.
+    bool armed() const { return nullptr != next; }
+
+    entry* prev;
+    entry* next;
+    std::uint64_t expiry;
+    boost::posix_time::ptime deadline;
+    handler fn;
+  };
+
+  /// Wakeup lateness and load statistics.
+  struct statistics {
+    statistics()
+      : armed(0), expired(0), cancelled(0),
+        total_lateness_ms(0), max_lateness_ms(0) {}
+
+    /// \return the mean lateness of expired timers in milliseconds
+    double mean_lateness_ms() const {
+      return expired == 0 ? 0.0 : total_lateness_ms / static_cast<double>(expired);
+    }
+
+    std::size_t armed;
+    std::uint64_t expired;
+    std::uint64_t cancelled;
+    std::uint64_t total_lateness_ms;
+    std::uint64_t max_lateness_ms;
+  };
+
+  /// Service identifier.
+  static boost::asio::io_service::id id;
+
+  /// \param io_service the io_service to post the handlers to
+  explicit timing_wheel(boost::asio::io_service& io_service);
+
+  /// Arms the entry (cancels it first if it is already armed).
+  ///
+  /// \param e the entry to arm
+  /// \param duration the duration from now until the handler is called
+  /// \param fn the handler to call
+  void arm(entry* e, const boost::posix_time::time_duration& duration,
+           handler fn);
+
+  /// Cancels the entry: posts its handler with operation_aborted.
+  ///
+  /// \param e the entry to cancel
+  /// \return the number of cancelled handlers (0 or 1)
+  std::size_t cancel(entry* e);
+
+  /// \return the current statistics
+  statistics stats() const;
+
+ private:
+  /// Destroys all pending handlers without calling them.
+  virtual void shutdown_service();
+
+  /// Inserts the entry into the slot matching its expiry tick.
+  void insert(entry* e);
+
+  /// Unlinks the entry from its slot.
+  static void unlink(entry* e);
+
+  /// Advances the wheel by one tick and moves expired entries to expired.
+  void advance(std::vector<entry*>* expired);
+
+  /// \return the tick the current time belongs to
+  std::uint64_t current_tick() const;
+
+  /// Starts the tick timer if it is not running.
+  void start_ticking();
+
+  /// Tick timer handler: processes all ticks until now.
+  void on_tick(const boost::system::error_code& ec);
+
+  /// The io_service to post the handlers to.
+  boost::asio::io_service& io_service_;
+
+  /// Guards all members below.
+  mutable boost::mutex mutex_;
+
+  /// Drives the wheel.
+  boost::asio::deadline_timer tick_timer_;
+
+  /// Whether the tick timer is running.
+  bool ticking_;
+
+  /// The start time (tick 0).
+  boost::posix_time::ptime start_;
+
+  /// The last processed tick.
+  std::uint64_t now_;
+
+  /// Slot list heads (sentinels) per level.
+  entry slots_[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS];
+
+  /// Statistics.
+  statistics stats_;
+};
+
+/// Drop-in replacement for boost::asio::deadline_timer (the parts used by
+/// the modules) scheduling its wakeups on the timing wheel of the io_service.
+/// Only one wait can be pending: a new async_wait cancels the previous one.
+class wheel_timer : boost::noncopyable {
+ public:
+  /// \param io_service the io_service whose timing wheel to use
+  explicit wheel_timer(boost::asio::io_service& io_service);
+
+  /// Cancels the pending wait.
+  ~wheel_timer();
+
+  /// Sets the expiry time relative to now. Cancels the pending wait.
+  ///
+  /// \param duration the duration from now
+  /// \return the number of cancelled handlers
+  std::size_t expires_from_now(
+      const boost::posix_time::time_duration& duration);
+
+  /// Waits asynchronously for the timer to expire.
+  ///
+  /// \param fn the handler to call on expiry (or on cancel)
+  void async_wait(timing_wheel::handler fn);
+
+  /// Cancels the pending wait (the handler is called with operation_aborted).
+  ///
+  /// \return the number of cancelled handlers
+  std::size_t cancel();
+
+ private:
+  timing_wheel& wheel_;
+  boost::posix_time::time_duration duration_;
+  timing_wheel::entry entry_;
+};
+
+}  // namespace botscript
+
+#endif  // TIMING_WHEEL_H_
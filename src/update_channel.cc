@@ -0,0 +1,141 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./update_channel.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+#include "boost/asio/error.hpp"
+
+namespace botscript {
+
+namespace pt = boost::posix_time;
+
+update_channel::update_channel(boost::asio::io_service* io_service,
+                               pt::time_duration interval,
+                               std::size_t max_batch, deliver_fn deliver)
+    : io_service_(io_service),
+      interval_(interval),
+      max_batch_(std::max<std::size_t>(1, max_batch)),
+      deliver_(std::move(deliver)),
+      queue_(UPDATE_CHANNEL_CAPACITY),
+      pending_(0),
+      flush_posted_(false),
+      timer_(*io_service),
+      stopped_(false),
+      pushed_(0),
+      stalls_(0),
+      stall_us_(0),
+      max_pending_(0),
+      coalesced_(0),
+      delivered_(0),
+      batches_(0) {
+  if (interval_ > pt::time_duration()) {
+    schedule();
+  }
+}
+
+update_channel::~update_channel() {
+  stop();
+}
+
+bot::upd_cb update_channel::callback() {
+  return [this](std::string identifier, std::string key, std::string value) {
+    push(std::move(identifier), std::move(key), std::move(value));
+  };
+}
+
+void update_channel::push(std::string identifier, std::string key,
+                          std::string value) {
+  update* u = new update{ std::move(identifier), std::move(key),
+                          std::move(value) };
+  ++pushed_;
+
+  std::size_t depth = ++pending_;
+  std::uint64_t max = max_pending_;
+  while (depth > max && !max_pending_.compare_exchange_weak(max, depth)) {
+  }
+
+  // Queue full: deliver on this thread until there is space again.
+  if (!queue_.bounded_push(u)) {
+    pt::ptime start = pt::microsec_clock::universal_time();
+    do {
+      flush();
+    } while (!queue_.bounded_push(u));
+    ++stalls_;
+    stall_us_ += (pt::microsec_clock::universal_time() - start)
+        .total_microseconds();
+  }
+
+  if (depth >= max_batch_ && !flush_posted_.exchange(true)) {
+    io_service_->post([this]() { flush(); });
+  }
+}
+
+void update_channel::flush() {
+  boost::lock_guard<boost::mutex> lock(deliver_mutex_);
+  flush_posted_ = false;
+
+  // Superseded values are replaced in place (at the first update's position).
+  std::vector<update> batch;
+  std::unordered_map<std::string, std::size_t> index;
+  update* u;
+  while (queue_.pop(u)) {
+    --pending_;
+    std::unique_ptr<update> owned(u);
+    if (u->key != "log") {
+      auto i = index.emplace(u->identifier + '\0' + u->key, batch.size());
+      if (!i.second) {
+        batch[i.first->second].value = std::move(u->value);
+        ++coalesced_;
+        continue;
+      }
+    }
+    batch.push_back(std::move(*u));
+  }
+
+  if (batch.empty()) {
+    return;
+  }
+
+  ++batches_;
+  delivered_ += batch.size();
+  deliver_(batch);
+}
+
+void update_channel::stop() {
+  if (!stopped_.exchange(true)) {
+    timer_.cancel();
+  }
+  flush();
+}
+
+update_channel::statistics update_channel::stats() const {
+  statistics s;
+  s.pushed = pushed_;
+  s.stalls = stalls_;
+  s.stall_us = stall_us_;
+  s.max_pending = max_pending_;
+
+  boost::lock_guard<boost::mutex> lock(deliver_mutex_);
+  s.coalesced = coalesced_;
+  s.delivered = delivered_;
+  s.batches = batches_;
+  return s;
+}
+
+void update_channel::schedule() {
+  timer_.expires_from_now(interval_);
+  timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted || stopped_) {
+      return;
+    }
+    flush();
+    schedule();
+  });
+}
+
+}  // namespace botscript
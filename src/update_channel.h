@@ -0,0 +1,136 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef UPDATE_CHANNEL_H_
+#define UPDATE_CHANNEL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio/deadline_timer.hpp"
+#include "boost/asio/io_service.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/lockfree/queue.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "./bot.h"
+
+/// Capacity of the update queue of a channel.
+#define UPDATE_CHANNEL_CAPACITY 65536
+
+namespace botscript {
+
+/// Batched delivery of bot updates (status changes, log messages).
+///
+/// Bots push their updates (through the callback() set as their
+/// update_callback_) into a lock-free queue. The queue is drained when the
+/// delivery interval elapsed or when max_batch updates are pending: updates
+/// superseded by a later value of the same bot and key are dropped (log
+/// messages are never dropped) and the rest is delivered with one call.
+///
+/// Backpressure: if the queue is full, the pushing bot drains it itself and
+/// delivers the batch before it continues (counted as stall).
+class update_channel {
+ public:
+  /// A bot update.
+  struct update {
+    std::string identifier;
+    std::string key;
+    std::string value;
+  };
+
+  /// Called with every batch. The batches of one channel are delivered one
+  /// after another, a function shared by several channels has to be thread
+  /// safe.
+  typedef std::function<void (const std::vector<update>&)> deliver_fn;
+
+  /// Delivery and backpressure statistics.
+  struct statistics {
+    statistics()
+      : pushed(0), coalesced(0), delivered(0), batches(0), stalls(0),
+        stall_us(0), max_pending(0) {
+    }
+
+    std::uint64_t pushed;       ///< updates pushed by bots
+    std::uint64_t coalesced;    ///< updates superseded before delivery
+    std::uint64_t delivered;    ///< updates delivered
+    std::uint64_t batches;      ///< deliver calls
+    std::uint64_t stalls;       ///< pushes blocked by a full queue
+    std::uint64_t stall_us;     ///< time bots spent blocked
+    std::uint64_t max_pending;  ///< maximum number of queued updates
+  };
+
+  /// \param io_service  the io_service running the delivery timer
+  /// \param interval    the maximum time an update stays queued
+  /// \param max_batch   deliver when this many updates are queued
+  /// \param deliver     the batch callback
+  update_channel(boost::asio::io_service* io_service,
+                 boost::posix_time::time_duration interval,
+                 std::size_t max_batch, deliver_fn deliver);
+
+  /// Stops the timer and delivers the queued updates.
+  ~update_channel();
+
+  update_channel(const update_channel&) = delete;
+  update_channel& operator=(const update_channel&) = delete;
+
+  /// \return an update callback pushing into this channel
+  ///         (the channel has to outlive the bots using it)
+  bot::upd_cb callback();
+
+  /// Queues an update (thread safe).
+  ///
+  /// \param identifier  the bot identifier
+  /// \param key         the update key
+  /// \param value       the update value
+  void push(std::string identifier, std::string key, std::string value);
+
+  /// Drains the queue and delivers the batch (thread safe).
+  void flush();
+
+  /// Stops the delivery timer and delivers the queued updates.
+  void stop();
+
+  /// \return the delivery statistics
+  statistics stats() const;
+
+ private:
+  /// Arms the delivery timer.
+  void schedule();
+
+  boost::asio::io_service* io_service_;
+  boost::posix_time::time_duration interval_;
+  std::size_t max_batch_;
+  deliver_fn deliver_;
+
+  /// Queued updates (owned by the queue until they are drained).
+  boost::lockfree::queue<update*> queue_;
+  std::atomic<std::size_t> pending_;
+
+  /// Whether a flush was posted because max_batch was reached.
+  std::atomic<bool> flush_posted_;
+
+  /// Serializes draining and delivery.
+  mutable boost::mutex deliver_mutex_;
+
+  boost::asio::deadline_timer timer_;
+  std::atomic<bool> stopped_;
+
+  std::atomic<std::uint64_t> pushed_;
+  std::atomic<std::uint64_t> stalls_;
+  std::atomic<std::uint64_t> stall_us_;
+  std::atomic<std::uint64_t> max_pending_;
+
+  /// Guarded by deliver_mutex_.
+  std::uint64_t coalesced_, delivered_, batches_;
+};
+
+}  // namespace botscript
+
+#endif  // UPDATE_CHANNEL_H_
@@ -0,0 +1,94 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#include "./wakeup_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace botscript {
+
+// Initialization of the static wakeup_scheduler class attributes.
+boost::asio::io_service::id wakeup_scheduler::id;
+std::atomic<unsigned int> wakeup_scheduler::max_(0);
+std::atomic<unsigned int> wakeup_scheduler::schedulers_(0);
+
+wakeup_scheduler::wakeup_scheduler(boost::asio::io_service& io_service)
+    : boost::asio::io_service::service(io_service) {
+  ++schedulers_;
+}
+
+wakeup_scheduler::~wakeup_scheduler() {
+  --schedulers_;
+}
+
+void wakeup_scheduler::max_starts_per_second(unsigned int max) {
+  max_ = max;
+}
+
+unsigned int wakeup_scheduler::max_starts_per_second() {
+  return max_;
+}
+
+int wakeup_scheduler::schedule(int min, int max, rng* r,
+                               reservation* planned) {
+  min = std::max(0, min);
+  max = std::max(min, max);
+  std::int64_t current = now();
+  unsigned int cap = share();
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  // Forget the past.
+  buckets_.erase(buckets_.begin(), buckets_.lower_bound(current));
+
+  // Take the less loaded of two random seconds within the window.
+  std::uniform_int_distribution<int> dist(min, max);
+  int a = dist(*r), b = dist(*r);
+  unsigned int& load_a = buckets_[current + a];
+  unsigned int& load_b = buckets_[current + b];
+  int delay = load_b < load_a ? b : a;
+
+  // Window full: use the next second with free capacity.
+  if (cap != 0 && buckets_[current + delay] >= cap) {
+    delay = min;
+    auto i = buckets_.lower_bound(current + delay);
+    while (i != buckets_.end() && i->first == current + delay &&
+           i->second >= cap) {
+      ++i;
+      ++delay;
+    }
+  }
+
+  ++buckets_[current + delay];
+  *planned = current + delay;
+  return delay;
+}
+
+void wakeup_scheduler::release(reservation planned) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  auto i = buckets_.find(planned);
+  if (i != buckets_.end() && i->second > 0) {
+    --i->second;
+  }
+}
+
+void wakeup_scheduler::shutdown_service() {
+  // No handlers: the buckets are dropped with the service.
+}
+
+unsigned int wakeup_scheduler::share() {
+  unsigned int max = max_;
+  unsigned int schedulers = std::max(1u, schedulers_.load());
+  return max == 0 ? 0 : std::max(1u, max / schedulers);
+}
+
+std::int64_t wakeup_scheduler::now() {
+  using std::chrono::duration_cast;
+  using std::chrono::seconds;
+  using std::chrono::steady_clock;
+  return duration_cast<seconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace botscript
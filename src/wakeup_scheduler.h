@@ -0,0 +1,90 @@
+// Copyright (c) 2012, makielski.net
+// Licensed under the MIT license
+// https://raw.github.com/makielski/botscript/master/COPYING
+
+#ifndef WAKEUP_SCHEDULER_H_
+#define WAKEUP_SCHEDULER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <random>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/thread.hpp"
+
+namespace botscript {
+
+/// Module wakeup scheduler.
+///
+/// Counts the module wakeups planned for every second. Wakeups are placed
+/// into the less loaded of two random seconds within the requested window,
+/// which spreads them evenly over the window. An optional cap limits the
+/// number of wakeups (module starts) per second: wakeups that do not fit
+/// are moved to the next second with free capacity.
+///
+/// The scheduler is an io_service service like the timing_wheel: there is
+/// one scheduler per io_service (one per shard), so the shards don't
+/// contend for a common lock. The fleet wide cap is split evenly between
+/// the schedulers. Cancelled wakeups give their reservation back.
+class wakeup_scheduler : public boost::asio::io_service::service {
+ public:
+  typedef std::minstd_rand rng;
+
+  /// A planned wakeup: the second it is counted in (-1 = none).
+  typedef std::int64_t reservation;
+
+  /// Service identifier.
+  static boost::asio::io_service::id id;
+
+  /// \param io_service the io_service the scheduler belongs to
+  explicit wakeup_scheduler(boost::asio::io_service& io_service);
+
+  ~wakeup_scheduler();
+
+  /// \param max the maximum number of wakeups per second of all schedulers
+  ///            (0 = unlimited)
+  static void max_starts_per_second(unsigned int max);
+
+  /// \return the maximum number of wakeups per second (0 = unlimited)
+  static unsigned int max_starts_per_second();
+
+  /// Plans a wakeup within the window [min, max] seconds from now.
+  ///
+  /// \param min the minimum delay in seconds
+  /// \param max the maximum delay in seconds
+  /// \param r the (per bot) random number generator to use
+  /// \param planned the reservation to write (to release it on cancel)
+  /// \return the delay in seconds
+  int schedule(int min, int max, rng* r, reservation* planned);
+
+  /// Gives the reservation of a cancelled wakeup back.
+  ///
+  /// \param planned the reservation returned by schedule()
+  void release(reservation planned);
+
+ private:
+  virtual void shutdown_service();
+
+  /// \return the cap of this scheduler (its share of max_, 0 = unlimited)
+  static unsigned int share();
+
+  /// \return the current second (monotonic clock)
+  static std::int64_t now();
+
+  /// Guards buckets_ (the io_service may be run by multiple threads).
+  boost::mutex mutex_;
+
+  /// Planned wakeups per second.
+  std::map<std::int64_t, unsigned int> buckets_;
+
+  /// Wakeup cap per second of all schedulers (0 = unlimited).
+  static std::atomic<unsigned int> max_;
+
+  /// Number of schedulers sharing max_.
+  static std::atomic<unsigned int> schedulers_;
+};
+
+}  // namespace botscript
+
+#endif  // WAKEUP_SCHEDULER_H_
@@ -0,0 +1,146 @@
+#include "gtest/gtest.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/filesystem.hpp"
+
+#include "../src/bot.h"
+#include "../src/mem_bot_config.h"
+
+#include "test_dir.h"
+
+using namespace std;
+using namespace botscript;
+
+namespace {
+
+typedef map<string, string> update_map;
+
+/// Restores a bot with mod1_a = "^x", mod2_e = "$x", shared_x (the session
+/// check of the test package passes, no login).
+shared_ptr<bot> make_bot(boost::asio::io_service* io_service,
+                         shared_ptr<mem_bot_config>* config,
+                         update_map* updates) {
+  boost::filesystem::current_path(TEST_EXECUTION_DIR);
+  bot::load_packages("./test/packages");
+
+  map<string, string_map> settings;
+  settings["base"]["wait_time_factor"] = "1.00";
+  settings["base"]["proxy"] = "";
+  settings["mod1"]["a"] = "^x";
+  settings["mod2"]["e"] = "$x";
+  settings["shared"]["x"] = "1";
+  *config = make_shared<mem_bot_config>("", "test_user", "test_password",
+                                        "te", "http://test.example.com",
+                                        settings);
+  (*config)->cookies({ { "session", "1" } });
+
+  auto b = make_shared<bot>(io_service);
+  b->update_callback_ = [updates](string, string key, string value) {
+    (*updates)[key] = value;
+  };
+  b->restore(*config, vector<string>(), [](shared_ptr<bot>, string err) {
+    EXPECT_EQ("", err);
+  });
+  io_service->poll();
+  io_service->reset();
+  return b;
+}
+
+}  // namespace
+
+TEST(bot_test, shared_redirect_test) {
+  boost::asio::io_service io_service;
+  shared_ptr<mem_bot_config> config;
+  update_map updates;
+  auto b = make_bot(&io_service, &config, &updates);
+
+  // "^x" redirects the write to the shared variable, both dependents are
+  // notified and the redirect itself stays in place.
+  updates.clear();
+  b->execute("mod1_set_a", "2");
+  io_service.poll();
+  io_service.reset();
+  EXPECT_EQ("2", config->value_of("shared", "x"));
+  EXPECT_EQ("^x", config->value_of("mod1", "a"));
+  EXPECT_EQ("2", updates["mod1_a"]);
+  EXPECT_EQ("2", updates["mod2_e"]);
+
+  // Within a batch the redirect is resolved the same way.
+  updates.clear();
+  b->execute_batch({ { "mod1_set_a", "3" }, { "shared_set_x", "4" } });
+  io_service.poll();
+  io_service.reset();
+  EXPECT_EQ("4", config->value_of("shared", "x"));
+  EXPECT_EQ("4", updates["mod2_e"]);
+
+  b->shutdown();
+  io_service.poll();
+}
+
+TEST(bot_test, dependency_index_test) {
+  boost::asio::io_service io_service;
+  shared_ptr<mem_bot_config> config;
+  update_map updates;
+  auto b = make_bot(&io_service, &config, &updates);
+
+  vector<string> dependents = b->get_dependent_variables("x");
+  ASSERT_EQ(2u, dependents.size());
+  EXPECT_EQ("mod1_a", dependents[0]);
+  EXPECT_EQ("mod2_e", dependents[1]);
+  EXPECT_EQ("1", b->update_all_shared()["mod2_e"]);
+
+  // Rewriting a dependent setting moves it in the index.
+  b->execute("shared_set_y", "5");
+  io_service.poll();
+  io_service.reset();
+  b->status("mod2_e", "$y");
+  EXPECT_EQ(1u, b->get_dependent_variables("x").size());
+  ASSERT_EQ(1u, b->get_dependent_variables("y").size());
+  EXPECT_EQ("5", b->update_all_shared()["mod2_e"]);
+
+  b->status("mod2_e", "plain");
+  EXPECT_TRUE(b->get_dependent_variables("y").empty());
+
+  b->shutdown();
+  io_service.poll();
+}
+
+TEST(bot_test, log_level_test) {
+  boost::asio::io_service io_service;
+  shared_ptr<mem_bot_config> config;
+  update_map updates;
+  auto b = make_bot(&io_service, &config, &updates);
+
+  b->execute("base_set_log_level", "info");
+  b->execute("mod1_set_log_level", "error");
+  io_service.poll();
+  io_service.reset();
+  EXPECT_EQ("info", config->value_of("base", "log_level"));
+  EXPECT_EQ("error", config->value_of("mod1", "log_level"));
+  EXPECT_FALSE(b->log_enabled(bot::BS_LOG_DBG, "base"));
+  EXPECT_TRUE(b->log_enabled(bot::BS_LOG_NFO, "mod2"));
+  EXPECT_FALSE(b->log_enabled(bot::BS_LOG_NFO, "mod1"));
+  EXPECT_TRUE(b->log_enabled(bot::BS_LOG_ERR, "mod1"));
+
+  // Filtered messages are neither stored nor passed to the update callback.
+  updates.clear();
+  b->log(bot::BS_LOG_NFO, "mod1", "filtered ", 1);
+  EXPECT_EQ(0u, updates.count("log"));
+  b->log(bot::BS_LOG_ERR, "mod1", "logged ", 2);
+  EXPECT_NE(string::npos, updates["log"].find("logged 2"));
+  EXPECT_EQ(string::npos, b->log_msgs().find("filtered"));
+
+  // An empty module level falls back to the bot level.
+  b->execute("mod1_set_log_level", "");
+  io_service.poll();
+  io_service.reset();
+  EXPECT_TRUE(b->log_enabled(bot::BS_LOG_NFO, "mod1"));
+
+  b->shutdown();
+  io_service.poll();
+}
@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/asio/strand.hpp"
+#include "boost/thread.hpp"
+
+#include "../src/buffered_bot_config.h"
+#include "../src/mem_bot_config.h"
+
+using namespace std;
+using namespace botscript;
+namespace pt = boost::posix_time;
+
+namespace {
+
+shared_ptr<mem_bot_config> make_backend() {
+  map<string, string_map> settings;
+  settings["base"]["wait_time_factor"] = "1.00";
+  settings["base"]["proxy"] = "";
+  settings["mod1"]["a"] = "b";
+  return make_shared<mem_bot_config>("id", "user", "password", "package",
+                                     "server", settings);
+}
+
+}  // namespace
+
+TEST(buffered_config_test, coalesce_and_skip_test) {
+  boost::asio::io_service io_service;
+  boost::asio::io_service::strand strand(io_service);
+  auto backend = make_backend();
+  buffered_bot_config c(backend, &io_service, &strand, pt::seconds(60), 100);
+
+  c.set("mod1_a", "b");  // unchanged
+  c.set("mod1_a", "c");
+  c.set("mod1", "a", "d");
+  c.set("mod2_x", "y");
+  c.cookies({ { "session", "1" } });
+
+  // Reads see the pending writes, the backend doesn't.
+  EXPECT_EQ("d", c.value_of("mod1_a"));
+  EXPECT_EQ("y", c.value_of("mod2", "x"));
+  EXPECT_EQ("1", c.cookies().at("session"));
+  EXPECT_EQ("b", backend->value_of("mod1_a"));
+  EXPECT_FALSE(backend->has_cookies());
+  EXPECT_EQ("d", c.module_settings()["mod1"]["a"]);
+
+  int visited = 0;
+  c.visit("mod1", [&visited](const string&, const string& key,
+                             const string& value) {
+    EXPECT_EQ("a", key);
+    EXPECT_EQ("d", value);
+    ++visited;
+  });
+  EXPECT_EQ(1, visited);
+
+  c.flush();
+  EXPECT_EQ("d", backend->value_of("mod1_a"));
+  EXPECT_EQ("y", backend->value_of("mod2_x"));
+  EXPECT_EQ("1", backend->cookies().at("session"));
+  EXPECT_EQ(0u, c.pending());
+
+  buffered_bot_config::statistics s = c.stats();
+  EXPECT_EQ(4u, s.writes);
+  EXPECT_EQ(1u, s.coalesced);
+  EXPECT_EQ(1u, s.skipped);
+  EXPECT_EQ(1u, s.flushes);
+  EXPECT_EQ(3u, s.flushed);
+}
+
+TEST(buffered_config_test, threshold_flush_test) {
+  boost::asio::io_service io_service;
+  boost::asio::io_service::strand strand(io_service);
+  auto backend = make_backend();
+  buffered_bot_config c(backend, &io_service, &strand, pt::seconds(60), 2);
+
+  c.set("mod1_a", "1");
+  EXPECT_EQ("b", backend->value_of("mod1_a"));
+  c.set("mod1_b", "2");
+  EXPECT_EQ("1", backend->value_of("mod1_a"));
+  EXPECT_EQ("2", backend->value_of("mod1_b"));
+}
+
+TEST(buffered_config_test, timer_flush_test) {
+  boost::asio::io_service io_service;
+  boost::asio::io_service::strand strand(io_service);
+  auto backend = make_backend();
+  buffered_bot_config c(backend, &io_service, &strand,
+                        pt::milliseconds(200), 100);
+
+  c.set("mod1_a", "timer");
+  io_service.run();
+  EXPECT_EQ("timer", backend->value_of("mod1_a"));
+  EXPECT_GE(c.stats().max_delay_ms, 200u);
+}
+
+TEST(buffered_config_test, destroyed_with_queued_flush_test) {
+  boost::asio::io_service io_service;
+  boost::asio::io_service::strand strand(io_service);
+  auto backend = make_backend();
+  auto c = new buffered_bot_config(backend, &io_service, &strand,
+                                   pt::milliseconds(1), 100);
+
+  // The flush handler is queued in the strand while the config is in use
+  // and runs after the config was destroyed.
+  strand.post([c]() {
+    c->set("mod1_a", "x");
+    boost::this_thread::sleep(pt::milliseconds(3 * TIMING_WHEEL_TICK_MS));
+    delete c;
+  });
+  boost::thread other([&io_service]() { io_service.run(); });
+  io_service.run();
+  other.join();
+  EXPECT_EQ("x", backend->value_of("mod1_a"));
+}
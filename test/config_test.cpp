@@ -1,11 +1,17 @@
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <string>
 #include <map>
+#include <thread>
 #include <vector>
 
 #include "boost/filesystem.hpp"
 
+#include "../src/config_loader.h"
+#include "../src/key_pool.h"
 #include "../src/mem_bot_config.h"
 #include "../src/bot.h"
 
@@ -188,3 +194,61 @@ TEST(config_test, write_cookies_test) {
   EXPECT_EQ("val1", c.cookies().at("cookie1"));
   EXPECT_EQ("val2", c.cookies().at("cookie2"));
 }
+
+TEST(config_test, ndjson_loader_test) {
+  std::string other = TEST_CONFIG;
+  other.replace(other.find("test_user"), 9, "other_user");
+
+  // Valid, empty, invalid, duplicate and unterminated last line.
+  std::string path = "/tmp/botscript_config_test.ndjson";
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out << TEST_CONFIG << "\n\n{\n" << CONFIG_WITH_COOKIES << "\n" << other;
+  }
+
+  std::vector<std::string> errors;
+  config_loader::config_map configs = config_loader::load_ndjson(
+      path, 2, [&errors](const std::string& source, const std::string&) {
+    errors.push_back(source);
+  });
+  std::remove(path.c_str());
+
+  ASSERT_EQ(2u, configs.size());
+  EXPECT_EQ("2.00", configs[path + ":1"]->value_of("base_wait_time_factor"));
+  EXPECT_EQ("other_user", configs[path + ":5"]->username());
+  ASSERT_EQ(2u, errors.size());
+  EXPECT_EQ(path + ":3", errors[0]);
+  EXPECT_EQ(path + ":4", errors[1]);
+}
+
+TEST(config_test, key_pool_concurrent_test) {
+  // Readers resolve names while the pool grows (new chunks and tables).
+  const int count = 3 * KEY_POOL_CHUNK;
+  key_pool::id first = key_pool::intern("key_pool_test_0");
+  std::atomic<bool> done(false);
+  std::thread reader([&done, first]() {
+    while (!done) {
+      key_pool::id id;
+      ASSERT_TRUE(key_pool::find("key_pool_test_0", &id));
+      EXPECT_EQ(first, id);
+      EXPECT_EQ("key_pool_test_0", key_pool::str(id));
+    }
+  });
+
+  std::vector<key_pool::id> ids;
+  for (int i = 0; i < count; ++i) {
+    ids.push_back(key_pool::intern("key_pool_test_" + std::to_string(i)));
+  }
+  done = true;
+  reader.join();
+
+  for (int i = 0; i < count; ++i) {
+    key_pool::id id;
+    std::string name = "key_pool_test_" + std::to_string(i);
+    ASSERT_TRUE(key_pool::find(name, &id));
+    EXPECT_EQ(ids[i], id);
+    EXPECT_EQ(name, key_pool::str(id));
+  }
+  key_pool::id unknown;
+  EXPECT_FALSE(key_pool::find("key_pool_test_unknown", &unknown));
+}
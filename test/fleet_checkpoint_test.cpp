@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "../src/fleet_checkpoint.h"
+#include "../src/mem_bot_config.h"
+
+using namespace std;
+using namespace botscript;
+namespace fs = boost::filesystem;
+
+namespace {
+
+/// \return the record of a bot "te_a" with mod1 value = value
+string record_of(const string& value) {
+  mem_bot_config config("te_a", "a", "pw", "te", "http://example.com",
+                        { { "mod1", { { "value", value } } } });
+  return fleet_checkpoint::serialize(config, true, vector<string>());
+}
+
+/// \return the restored bots (identifier -> mod1 value)
+map<string, string> restore(const fs::path& path) {
+  map<string, string> bots;
+  fleet_checkpoint c(path.string());
+  c.restore([&bots](const fleet_checkpoint::entry& e) {
+    bots[e.identifier.to_string()] =
+        fleet_checkpoint::make_config(e)->value_of("mod1", "value");
+  });
+  return bots;
+}
+
+}  // namespace
+
+TEST(fleet_checkpoint_test, round_trip_test) {
+  mem_bot_config config("te_a", "a", "pw", "te", "http://example.com",
+                        { { "mod1", { { "active", "1" }, { "x", "y" } } },
+                          { "base", { { "wait_time_factor", "2.00" } } } });
+  config.inactive(true);
+  config.cookies({ { "session", "1" }, { "lang", "de" } });
+
+  string record = fleet_checkpoint::serialize(config, true, { "1.2.3.4:80" });
+  ASSERT_FALSE(record.empty());
+
+  fleet_checkpoint::entry e;
+  ASSERT_TRUE(fleet_checkpoint::parse(
+      boost::string_ref(record).substr(1), &e));
+  EXPECT_EQ("te_a", e.identifier);
+  EXPECT_EQ("a", e.username);
+  EXPECT_EQ("pw", e.password);
+  EXPECT_EQ("te", e.package);
+  EXPECT_EQ("http://example.com", e.server);
+  EXPECT_TRUE(e.inactive);
+  EXPECT_TRUE(e.session);
+  ASSERT_EQ(1u, e.proxies.size());
+  EXPECT_EQ("1.2.3.4:80", e.proxies[0]);
+  EXPECT_EQ(2u, e.cookies.size());
+  EXPECT_EQ(3u, e.settings.size());
+
+  shared_ptr<bot_config> restored = fleet_checkpoint::make_config(e);
+  EXPECT_EQ(config.identifier(), restored->identifier());
+  EXPECT_EQ(config.password(), restored->password());
+  EXPECT_EQ(config.server(), restored->server());
+  EXPECT_TRUE(restored->inactive());
+  EXPECT_EQ(config.module_settings(), restored->module_settings());
+  EXPECT_EQ(config.cookies(), restored->cookies());
+
+  // A truncated record is rejected.
+  fleet_checkpoint::entry truncated;
+  EXPECT_FALSE(fleet_checkpoint::parse(
+      boost::string_ref(record).substr(1, 10), &truncated));
+}
+
+TEST(fleet_checkpoint_test, unchanged_test) {
+  fs::path path = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  {
+    fleet_checkpoint c(path.string());
+    EXPECT_EQ(1u, c.write({ { "te_a", record_of("1") } }));
+    EXPECT_EQ(0u, c.write({ { "te_a", record_of("1") } }));
+    EXPECT_EQ(1u, c.write({ { "te_a", record_of("2") } }));
+  }
+  {
+    // Restored bots are only written again when they changed.
+    fleet_checkpoint c(path.string());
+    c.restore([](const fleet_checkpoint::entry&) {});
+    EXPECT_EQ(0u, c.write({ { "te_a", record_of("2") } }));
+  }
+  EXPECT_EQ("2", restore(path)["te_a"]);
+  fs::remove(path);
+}
+
+TEST(fleet_checkpoint_test, tombstone_test) {
+  fs::path path = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  {
+    string b = record_of("1");
+    b.replace(b.find("te_a"), 4, "te_b");
+
+    fleet_checkpoint c(path.string());
+    EXPECT_EQ(2u, c.write({ { "te_a", record_of("1") }, { "te_b", b } }));
+    EXPECT_EQ(0u, c.write({ { "te_a", record_of("1") } }));
+  }
+  map<string, string> bots = restore(path);
+  EXPECT_EQ(1u, bots.size());
+  EXPECT_EQ(1u, bots.count("te_a"));
+  fs::remove(path);
+}
+
+TEST(fleet_checkpoint_test, compact_test) {
+  fs::path path = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  std::size_t live = record_of(string(100 * 1024, 'a')).size();
+
+  // The last write exceeds FLEET_CHECKPOINT_COMPACT_MIN and compacts.
+  std::size_t writes = FLEET_CHECKPOINT_COMPACT_MIN / live + 1;
+  {
+    fleet_checkpoint c(path.string());
+    for (std::size_t i = 0; i < writes; ++i) {
+      c.write({ { "te_a", record_of(string(100 * 1024, 'a' + i)) } });
+    }
+  }
+  EXPECT_LT(fs::file_size(path), 2 * live);
+  EXPECT_EQ(string(100 * 1024, 'a' + writes - 1), restore(path)["te_a"]);
+  fs::remove(path);
+}
+
+TEST(fleet_checkpoint_test, torn_tail_test) {
+  fs::path path = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  {
+    fleet_checkpoint c(path.string());
+    c.write({ { "te_a", record_of("1") } });
+  }
+  std::size_t intact = fs::file_size(path);
+  {
+    fleet_checkpoint c(path.string());
+    c.write({ { "te_a", record_of("2") } });
+  }
+
+  // Damage the data of the second bot record.
+  {
+    fstream f(path.string().c_str(), ios::in | ios::out | ios::binary);
+    f.seekp(intact + 20);
+    f.put('X');
+  }
+  EXPECT_EQ("1", restore(path)["te_a"]);
+  fs::remove(path);
+}
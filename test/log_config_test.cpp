@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "../src/log_bot_config.h"
+#include "../src/mem_bot_config.h"
+#include "../src/record_log.h"
+
+using namespace std;
+using namespace botscript;
+namespace fs = boost::filesystem;
+
+namespace {
+
+string temp_log() {
+  fs::path p = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%.log");
+  return p.string();
+}
+
+vector<string> read_all(const string& path) {
+  vector<string> records;
+  record_log log(path, 0, [&records](boost::string_ref r) {
+    records.push_back(r.to_string());
+  });
+  return records;
+}
+
+}  // namespace
+
+TEST(log_config_test, record_log_replay_test) {
+  string path = temp_log();
+  {
+    record_log log(path, 2, nullptr);
+    std::size_t syncs = log.syncs();
+    log.append("first");
+    log.append("second");
+    log.append(string(100000, 'x'));  // grows the mapping
+    EXPECT_EQ(3u, log.records());
+    EXPECT_EQ(syncs + 1, log.syncs());
+  }
+
+  vector<string> records = read_all(path);
+  ASSERT_EQ(3u, records.size());
+  EXPECT_EQ("first", records[0]);
+  EXPECT_EQ("second", records[1]);
+  EXPECT_EQ(100000u, records[2].size());
+  fs::remove(path);
+}
+
+TEST(log_config_test, record_log_torn_tail_test) {
+  string path = temp_log();
+  {
+    record_log log(path, 0, nullptr);
+    log.append("complete");
+    log.append("torn record");
+  }
+
+  // Corrupt the last byte (crash while writing the last record).
+  std::uintmax_t size = fs::file_size(path);
+  {
+    fstream f(path.c_str(), ios::in | ios::out | ios::binary);
+    f.seekp(size - 1);
+    f.put('?');
+  }
+
+  {
+    record_log log(path, 0, nullptr);
+    EXPECT_EQ(1u, log.records());
+    log.append("after");
+  }
+
+  vector<string> records = read_all(path);
+  ASSERT_EQ(2u, records.size());
+  EXPECT_EQ("complete", records[0]);
+  EXPECT_EQ("after", records[1]);
+  fs::remove(path);
+}
+
+TEST(log_config_test, recovery_test) {
+  string path = temp_log();
+  map<string, string_map> settings;
+  settings["base"]["wait_time_factor"] = "1.00";
+  settings["base"]["proxy"] = "";
+  settings["mod1"]["a"] = "b";
+  mem_bot_config initial("id", "user", "password", "package", "server",
+                         settings);
+  {
+    log_bot_config c(path, initial, 1);
+    c.set("mod1_a", "c");
+    c.set("mod2", "x", "y");
+    c.inactive(true);
+    c.cookies({ { "session", "123" } });
+  }
+
+  log_bot_config c(path, 1);
+  EXPECT_EQ("user", c.username());
+  EXPECT_EQ("server", c.server());
+  EXPECT_EQ("c", c.value_of("mod1", "a"));
+  EXPECT_EQ("y", c.value_of("mod2_x"));
+  EXPECT_EQ("1.00", c.value_of("base_wait_time_factor"));
+  EXPECT_TRUE(c.inactive());
+  EXPECT_EQ("123", c.cookies().at("session"));
+  fs::remove(path);
+}
+
+TEST(log_config_test, compaction_test) {
+  string path = temp_log();
+  map<string, string_map> settings;
+  settings["base"]["wait_time_factor"] = "1.00";
+  settings["base"]["proxy"] = "";
+  mem_bot_config initial("id", "user", "password", "package", "server",
+                         settings);
+  {
+    log_bot_config c(path, initial, 0);
+    for (int i = 0; i < 50000; ++i) {
+      c.set("mod1", "counter", to_string(i));
+    }
+    EXPECT_LT(c.log_size(), 2u * LOG_CONFIG_COMPACT_MIN);
+  }
+
+  log_bot_config c(path, 0);
+  EXPECT_EQ("49999", c.value_of("mod1", "counter"));
+  fs::remove(path);
+}
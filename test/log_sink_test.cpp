@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include "boost/filesystem.hpp"
+
+#include "../src/log_sink.h"
+
+using namespace std;
+using namespace botscript;
+namespace fs = boost::filesystem;
+
+namespace {
+
+string read(const fs::path& p) {
+  ifstream f(p.string().c_str());
+  stringstream content;
+  content << f.rdbuf();
+  return content.str();
+}
+
+}  // namespace
+
+TEST(log_sink_test, per_bot_test) {
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  {
+    log_sink s(dir.string(), log_sink::per_bot(), 0, 0);
+    EXPECT_TRUE(s.push("te_a", "1\n"));
+    EXPECT_TRUE(s.push("te/b", "2\n"));
+    EXPECT_TRUE(s.push("te_a", "3\n"));
+    s.stop();
+    EXPECT_FALSE(s.push("te_a", "4\n"));
+
+    log_sink::statistics stats = s.stats();
+    EXPECT_EQ(3u, stats.pushed);
+    EXPECT_EQ(3u, stats.lines);
+    EXPECT_EQ(1u, stats.dropped);
+    EXPECT_EQ(0u, stats.errors);
+  }
+  EXPECT_EQ("1\n3\n", read(dir / "te_a.log"));
+  EXPECT_EQ("2\n", read(dir / "te_b.log"));
+  fs::remove_all(dir);
+}
+
+TEST(log_sink_test, rotate_test) {
+  fs::path dir = fs::temp_directory_path() / fs::unique_path("bs-%%%%%%");
+  {
+    // Lines are written when the writer wakes up, the second batch exceeds
+    // the size limit and rotates the file.
+    log_sink s(dir.string(), log_sink::single("all"), 8, 0);
+    s.push("a", "12345\n");
+    while (s.stats().lines < 1) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    s.push("a", "67890\n");
+    s.stop();
+    EXPECT_EQ(1u, s.stats().rotations);
+  }
+  EXPECT_EQ("67890\n", read(dir / "all.log"));
+  EXPECT_EQ(2, distance(fs::directory_iterator(dir), fs::directory_iterator()));
+  fs::remove_all(dir);
+}
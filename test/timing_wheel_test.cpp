@@ -0,0 +1,97 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "../src/timing_wheel.h"
+
+using namespace std;
+using namespace botscript;
+namespace pt = boost::posix_time;
+
+TEST(timing_wheel_test, expiry_test) {
+  boost::asio::io_service io_service;
+  wheel_timer timer(io_service);
+
+  pt::ptime start = pt::microsec_clock::universal_time();
+  boost::system::error_code result = boost::asio::error::would_block;
+  timer.expires_from_now(pt::milliseconds(250));
+  timer.async_wait([&result](const boost::system::error_code& ec) {
+    result = ec;
+  });
+  io_service.run();
+
+  EXPECT_FALSE(result);
+  EXPECT_GE((pt::microsec_clock::universal_time() - start).total_milliseconds(),
+            250);
+
+  timing_wheel::statistics s =
+      boost::asio::use_service<timing_wheel>(io_service).stats();
+  EXPECT_EQ(1u, s.expired);
+  EXPECT_EQ(0u, s.armed);
+  EXPECT_LT(s.max_lateness_ms, 1000u);
+}
+
+TEST(timing_wheel_test, cancel_test) {
+  boost::asio::io_service io_service;
+  wheel_timer timer(io_service);
+
+  boost::system::error_code result;
+  timer.expires_from_now(pt::seconds(60));
+  timer.async_wait([&result](const boost::system::error_code& ec) {
+    result = ec;
+  });
+  EXPECT_EQ(1u, timer.cancel());
+  EXPECT_EQ(0u, timer.cancel());
+  io_service.run();
+
+  EXPECT_EQ(boost::asio::error::operation_aborted, result);
+  EXPECT_EQ(1u,
+            boost::asio::use_service<timing_wheel>(io_service).stats().cancelled);
+}
+
+TEST(timing_wheel_test, order_test) {
+  boost::asio::io_service io_service;
+  vector<int> order;
+
+  wheel_timer t1(io_service), t2(io_service), t3(io_service);
+  t1.expires_from_now(pt::milliseconds(500));
+  t1.async_wait([&order](const boost::system::error_code&) {
+    order.push_back(3);
+  });
+  t2.expires_from_now(pt::milliseconds(100));
+  t2.async_wait([&order](const boost::system::error_code&) {
+    order.push_back(1);
+  });
+  t3.expires_from_now(pt::milliseconds(300));
+  t3.async_wait([&order](const boost::system::error_code&) {
+    order.push_back(2);
+  });
+  io_service.run();
+
+  ASSERT_EQ(3u, order.size());
+  EXPECT_EQ(1, order[0]);
+  EXPECT_EQ(2, order[1]);
+  EXPECT_EQ(3, order[2]);
+}
+
+TEST(timing_wheel_test, rearm_test) {
+  boost::asio::io_service io_service;
+  wheel_timer timer(io_service);
+
+  int expired = 0, aborted = 0;
+  auto handler = [&](const boost::system::error_code& ec) {
+    ec ? ++aborted : ++expired;
+  };
+
+  timer.expires_from_now(pt::seconds(30));
+  timer.async_wait(handler);
+  timer.expires_from_now(pt::milliseconds(100));
+  timer.async_wait(handler);
+  io_service.run();
+
+  EXPECT_EQ(1, expired);
+  EXPECT_EQ(1, aborted);
+}
@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+
+#include "../src/update_channel.h"
+
+using namespace std;
+using namespace botscript;
+namespace pt = boost::posix_time;
+
+TEST(update_channel_test, coalesce_test) {
+  boost::asio::io_service io_service;
+  vector<vector<update_channel::update>> batches;
+  update_channel c(&io_service, pt::milliseconds(50), 100,
+                   [&batches](const vector<update_channel::update>& b) {
+    batches.push_back(b);
+  });
+
+  bot::upd_cb cb = c.callback();
+  cb("a", "mod1_status", "1");
+  cb("a", "log", "x");
+  cb("b", "mod1_status", "1");
+  cb("a", "mod1_status", "2");
+  cb("a", "log", "y");
+  EXPECT_TRUE(batches.empty());
+
+  io_service.run_one();
+  ASSERT_EQ(1u, batches.size());
+  ASSERT_EQ(4u, batches[0].size());
+  EXPECT_EQ("2", batches[0][0].value);
+  EXPECT_EQ("x", batches[0][1].value);
+  EXPECT_EQ("b", batches[0][2].identifier);
+  EXPECT_EQ("y", batches[0][3].value);
+
+  update_channel::statistics s = c.stats();
+  EXPECT_EQ(5u, s.pushed);
+  EXPECT_EQ(1u, s.coalesced);
+  EXPECT_EQ(4u, s.delivered);
+  EXPECT_EQ(1u, s.batches);
+}
+
+TEST(update_channel_test, batch_size_and_backpressure_test) {
+  boost::asio::io_service io_service;
+  size_t delivered = 0;
+  update_channel c(&io_service, pt::seconds(60), 10,
+                   [&delivered](const vector<update_channel::update>& b) {
+    delivered += b.size();
+  });
+
+  // Reaching the batch size posts a flush.
+  for (int i = 0; i < 10; ++i) {
+    c.push("a", "log", to_string(i));
+  }
+  io_service.poll_one();
+  EXPECT_EQ(10u, delivered);
+
+  // A full queue is drained by the pushing thread.
+  for (int i = 0; i < UPDATE_CHANNEL_CAPACITY + 1; ++i) {
+    c.push("a", "log", "");
+  }
+  EXPECT_EQ(1u, c.stats().stalls);
+  EXPECT_EQ(10u + UPDATE_CHANNEL_CAPACITY, delivered);
+
+  c.stop();
+  EXPECT_EQ(11u + UPDATE_CHANNEL_CAPACITY, delivered);
+}